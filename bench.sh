@@ -0,0 +1,133 @@
+#!/bin/bash
+set -e
+
+# benchmark harness - generates a corpus, then runs every chain at every
+# queue size, through output/pipeline_bench (latency, throughput and cpu per
+# stage) and through output/analyzer itself (end to end wall time)
+# results go to stdout (or --out FILE) as csv or json, one record per run
+
+# colors
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+NC='\033[0m'
+
+print_status() {
+    echo -e "${GREEN}[BENCH]${NC} $1" >&2
+}
+print_error() {
+    echo -e "${RED}[ERROR]${NC} $1" >&2
+}
+
+usage() {
+    cat >&2 <<EOF
+Usage: ./bench.sh [options]
+Options:
+    --format F      csv or json (default csv)
+    --out FILE      write the results to FILE instead of stdout
+    --lines N       corpus lines (default 200000)
+    --min N         shortest corpus line (default 1)
+    --max N         longest corpus line (default 128)
+    --dist D        fixed, uniform or exp line lengths (default uniform)
+    --queues "..."  queue sizes to run (default "16 256 4096")
+    --chain "..."   a chain to run, may be repeated (default: a few standard chains)
+    --fuse          also run every chain with --fuse
+    --waits "..."   queue wait strategies to run (default "park"), e.g. "park yield spin"
+    --rounds N      latency samples per run (default 10000)
+EOF
+}
+
+FORMAT=csv
+OUT=/dev/stdout
+LINES=200000
+MIN=1
+MAX=128
+DIST=uniform
+QUEUES="16 256 4096"
+CHAINS=()
+FUSE_MODES="0"
+WAITS="park"
+ROUNDS=10000
+
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --format) FORMAT="$2"; shift 2 ;;
+        --out) OUT="$2"; shift 2 ;;
+        --lines) LINES="$2"; shift 2 ;;
+        --min) MIN="$2"; shift 2 ;;
+        --max) MAX="$2"; shift 2 ;;
+        --dist) DIST="$2"; shift 2 ;;
+        --queues) QUEUES="$2"; shift 2 ;;
+        --chain) CHAINS+=("$2"); shift 2 ;;
+        --fuse) FUSE_MODES="0 1"; shift ;;
+        --waits) WAITS="$2"; shift 2 ;;
+        --rounds) ROUNDS="$2"; shift 2 ;;
+        *) usage; exit 1 ;;
+    esac
+done
+if [ "$FORMAT" != "csv" ] && [ "$FORMAT" != "json" ]; then
+    print_error "unknown format $FORMAT"
+    exit 1
+fi
+if [ ${#CHAINS[@]} -eq 0 ]; then
+    CHAINS=("uppercaser" "uppercaser flipper rotator" "uppercaser rotator flipper expander logger")
+fi
+
+if [ ! -x output/analyzer ] || [ ! -x output/pipeline_bench ] || [ ! -x output/gen_corpus ]; then
+    print_status "building project..."
+    ./build.sh >/dev/null
+fi
+
+CORPUS=$(mktemp)
+trap 'rm -f "$CORPUS"' EXIT
+print_status "generating corpus: $LINES lines, $DIST lengths $MIN..$MAX"
+./output/gen_corpus --lines "$LINES" --min "$MIN" --max "$MAX" --dist "$DIST" > "$CORPUS"
+
+# monotonic-ish wall clock in nanoseconds
+now_ns() {
+    date +%s%N
+}
+
+first=1
+{
+    [ "$FORMAT" == "json" ] && echo "["
+    for chain in "${CHAINS[@]}"; do
+        for queue in $QUEUES; do
+            for fuse in $FUSE_MODES; do
+            for wait in $WAITS; do
+                FLAGS=(--wait "$wait")
+                [ "$fuse" == "1" ] && FLAGS+=(--fuse)
+                print_status "chain '$chain' queue $queue wait $wait$([ "$fuse" == "1" ] && echo " fused")"
+
+                # latency, throughput and cpu per stage
+                HEADER=()
+                [ "$first" == "1" ] && HEADER+=(--header)
+                # shellcheck disable=SC2086
+                RECORD=$(./output/pipeline_bench "${FLAGS[@]}" --input "$CORPUS" --rounds "$ROUNDS" \
+                    --format "$FORMAT" "${HEADER[@]}" "$queue" $chain)
+
+                # the analyzer binary end to end, output discarded
+                start=$(now_ns)
+                # shellcheck disable=SC2086
+                ./output/analyzer "${FLAGS[@]}" --input "$CORPUS" "$queue" $chain >/dev/null
+                seconds=$(awk -v ns=$(( $(now_ns) - start )) 'BEGIN { printf "%.6f", ns / 1e9 }')
+                rate=$(awk -v s="$seconds" -v n="$LINES" 'BEGIN { printf "%.0f", n / s }')
+
+                if [ "$FORMAT" == "csv" ]; then
+                    if [ "$first" == "1" ]; then
+                        echo "$(head -n 1 <<<"$RECORD"),analyzer_seconds,analyzer_lines_per_sec"
+                        RECORD=$(tail -n 1 <<<"$RECORD")
+                    fi
+                    echo "$RECORD,$seconds,$rate"
+                else
+                    [ "$first" == "1" ] || echo ","
+                    echo -n "  ${RECORD%\}}, \"analyzer_seconds\": $seconds, \"analyzer_lines_per_sec\": $rate}"
+                fi
+                first=0
+            done
+            done
+        done
+    done
+    [ "$FORMAT" == "json" ] && echo && echo "]"
+} > "$OUT"
+
+print_status "done"
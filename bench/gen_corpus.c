@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+/**
+ * Synthetic corpus generator - writes lines of random text to stdout,
+ * followed by <END>, for the analyzer and pipeline_bench
+ * The same seed always gives the same corpus
+ */
+
+// xorshift64* - fast, and the same on every platform
+static uint64_t next_random(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+// uniform double in [0, 1)
+static double next_unit(uint64_t* state) {
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// print the usage help
+static void print_usage(void) {
+    printf("Usage: ./output/gen_corpus [options]\n");
+    printf("Options:\n");
+    printf("    --lines N       Number of lines (default 100000)\n");
+    printf("    --min N         Shortest line (default 1)\n");
+    printf("    --max N         Longest line (default 128)\n");
+    printf("    --dist D        Line length distribution (default uniform):\n");
+    printf("                    fixed - every line --max long\n");
+    printf("                    uniform - evenly spread between --min and --max\n");
+    printf("                    exp - mostly short lines, mean a quarter of the way up, capped at --max\n");
+    printf("    --seed N        Random seed (default 1)\n");
+    printf("    --no-end        Do not write the final <END> line\n");
+}
+
+int main(int argc, char* argv[]) {
+    long lines = 100000, min = 1, max = 128, seed = 1;
+    const char* dist = "uniform";
+    int end = 1;
+    char* endptr;
+
+    for (int i = 1; i < argc; i++) {
+        long* value = NULL;
+        if (strcmp(argv[i], "--no-end") == 0) {
+            end = 0;
+            continue;
+        }
+        if (strcmp(argv[i], "--dist") == 0 && i + 1 < argc) {
+            dist = argv[++i];
+            if (strcmp(dist, "fixed") != 0 && strcmp(dist, "uniform") != 0 && strcmp(dist, "exp") != 0) {
+                fprintf(stderr, "error- unknown distribution %s\n", dist);
+                print_usage();
+                return 1;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--lines") == 0) value = &lines;
+        if (strcmp(argv[i], "--min") == 0) value = &min;
+        if (strcmp(argv[i], "--max") == 0) value = &max;
+        if (strcmp(argv[i], "--seed") == 0) value = &seed;
+        if (!value || i + 1 >= argc) {
+            fprintf(stderr, "error- unknown option %s\n", argv[i]);
+            print_usage();
+            return 1;
+        }
+        *value = strtol(argv[++i], &endptr, 10);
+        if (*endptr != '\0' || *value < 0) {
+            fprintf(stderr, "error- not a valid value for %s\n", argv[i - 1]);
+            print_usage();
+            return 1;
+        }
+    }
+    if (min > max) {
+        fprintf(stderr, "error- --min is larger than --max\n");
+        return 1;
+    }
+
+    // lowercase text with spaces, like the logs the plugins are meant for
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz      ";
+    uint64_t state = (uint64_t)seed * 0x9E3779B97F4A7C15ULL + 1;
+    char* line = (char*)malloc(max + 2);
+    if (!line) {
+        fprintf(stderr, "error- malloc has failed\n");
+        return 1;
+    }
+
+    for (long i = 0; i < lines; i++) {
+        long len = max;
+        if (strcmp(dist, "uniform") == 0) {
+            len = min + (long)(next_random(&state) % (uint64_t)(max - min + 1));
+        } else if (strcmp(dist, "exp") == 0) {
+            double mean = (max - min) / 4.0 + 1;
+            len = min + (long)(-log(1.0 - next_unit(&state)) * mean);
+            if (len > max) len = max;
+        }
+
+        for (long j = 0; j < len; j++) line[j] = alphabet[next_random(&state) % (sizeof(alphabet) - 1)];
+        line[len] = '\n';
+        fwrite(line, 1, len + 1, stdout);
+    }
+    if (end) fputs("<END>\n", stdout);
+
+    free(line);
+    return 0;
+}
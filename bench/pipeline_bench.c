@@ -0,0 +1,429 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include "../pipeline.h"
+#include "../line_reader.h"
+
+/**
+ * Pipeline benchmark - drives a chain of plugins directly (no stdin parsing)
+ * and measures
+ *   latency:    one line in flight at a time, time until it leaves the last stage
+ *   throughput: every corpus line in flight, lines and bytes per second through the chain
+ *   cpu:        cpu time of each stage's threads (named after the plugin)
+ * Run from the repository root, after ./build.sh
+ */
+
+#define MAX_STAGE_CPU 64        // distinct thread names reported
+#define MAX_WAITS 64            // entries of a --wait list
+
+// what the last stage hands its output to
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    long received;          // lines that left the chain
+    int ended;              // the end signal left the chain
+} bench_sink_t;
+
+// lines sent through the chain
+typedef struct {
+    char* text;             // every line, NUL-terminated, back to back
+    const char** lines;
+    size_t* lens;
+    long count;
+    size_t bytes;           // sum of the line lengths plus one newline each
+} bench_corpus_t;
+
+// cpu time of the threads sharing a name
+typedef struct {
+    char name[32];
+    double ms;
+} stage_cpu_t;
+
+// sink attached to the last stage - counts lines, the stage frees them
+static int bench_sink(plugin_instance_t* arg, plugin_msg_t** msgs, int count) {
+    bench_sink_t* s = (bench_sink_t*)arg;
+    int end = count > 0 && (msgs[count - 1]->flags & PLUGIN_MSG_END);
+
+    pthread_mutex_lock(&s->lock);
+    s->received += end ? count - 1 : count;
+    if (end) s->ended = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    return 0; // take nothing
+}
+
+// wait until the sink has received at least n lines
+static void bench_wait_received(bench_sink_t* s, long n) {
+    pthread_mutex_lock(&s->lock);
+    while (s->received < n) pthread_cond_wait(&s->cond, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// monotonic time in nanoseconds
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_ll(const void* a, const void* b) {
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+// index the lines of a corpus held in text (count lines, NUL-terminated)
+static int corpus_index(bench_corpus_t* c) {
+    c->lines = (const char**)malloc(sizeof(char*) * (c->count ? c->count : 1));
+    c->lens = (size_t*)malloc(sizeof(size_t) * (c->count ? c->count : 1));
+    if (!c->lines || !c->lens) return -1;
+
+    const char* p = c->text;
+    c->bytes = 0;
+    for (long i = 0; i < c->count; i++) {
+        c->lines[i] = p;
+        c->lens[i] = strlen(p);
+        c->bytes += c->lens[i] + 1;
+        p += c->lens[i] + 1;
+    }
+    return 0;
+}
+
+// load a corpus file, up to its <END> line
+static const char* corpus_load(bench_corpus_t* c, const char* path) {
+    line_reader_t reader;
+    const char* err = line_reader_open(&reader, path);
+    if (err) return err;
+
+    size_t cap = 1 << 20, used = 0;
+    c->text = (char*)malloc(cap);
+    c->count = 0;
+
+    const char* line;
+    size_t len;
+    while (c->text && (line = line_reader_next(&reader, &len))) {
+        if (len == 5 && memcmp(line, "<END>", 5) == 0) break;
+        while (used + len + 1 > cap) {
+            char* bigger = (char*)realloc(c->text, cap * 2);
+            if (!bigger) {
+                free(c->text);
+                c->text = NULL;
+                break;
+            }
+            c->text = bigger;
+            cap *= 2;
+        }
+        if (!c->text) break;
+        memcpy(c->text + used, line, len);
+        c->text[used + len] = '\0';
+        used += len + 1;
+        c->count++;
+    }
+    line_reader_close(&reader);
+
+    if (!c->text || corpus_index(c) != 0) return "malloc has failed";
+    if (c->count == 0) return "corpus is empty";
+    return NULL;
+}
+
+// make a corpus of random lines of one length
+static const char* corpus_random(bench_corpus_t* c, long lines, long len) {
+    c->count = lines;
+    c->text = (char*)malloc((size_t)lines * (len + 1));
+    if (!c->text) return "malloc has failed";
+
+    unsigned int seed = 1;
+    for (long i = 0; i < lines; i++) {
+        char* line = c->text + (size_t)i * (len + 1);
+        for (long j = 0; j < len; j++) line[j] = (char)('a' + rand_r(&seed) % 26);
+        line[len] = '\0';
+    }
+    return corpus_index(c) == 0 ? NULL : "malloc has failed";
+}
+
+// cpu time of one thread of this process, in milliseconds
+static double thread_cpu_ms(const char* tid_name) {
+    // the kernel's per-thread cpu clock id (what pthread_getcpuclockid returns)
+    pid_t tid = (pid_t)atoi(tid_name);
+    clockid_t clock = (clockid_t)((~(unsigned int)tid << 3) | 6);
+    struct timespec ts;
+    if (clock_gettime(clock, &ts) == 0) return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+
+    // fall back to the scheduler's tick counts
+    char path[64], buf[512];
+    snprintf(path, sizeof(path), "/proc/self/task/%s/stat", tid_name);
+    FILE* f = fopen(path, "r");
+    if (!f) return 0;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+
+    char* p = strrchr(buf, ')');
+    unsigned long utime = 0, stime = 0;
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) return 0;
+    return (utime + stime) * 1e3 / sysconf(_SC_CLK_TCK);
+}
+
+// sum the cpu time of every live thread by thread name - plugin threads are
+// named after their plugin, so this is the cpu time of each stage
+static int stage_cpu_collect(stage_cpu_t* out, int max) {
+    DIR* dir = opendir("/proc/self/task");
+    if (!dir) return 0;
+
+    int count = 0;
+    struct dirent* e;
+    while ((e = readdir(dir))) {
+        if (e->d_name[0] == '.') continue;
+
+        char path[64], name[32] = "";
+        snprintf(path, sizeof(path), "/proc/self/task/%s/comm", e->d_name);
+        FILE* f = fopen(path, "r");
+        if (!f) continue;
+        if (fgets(name, sizeof(name), f)) name[strcspn(name, "\n")] = '\0';
+        fclose(f);
+        if (atoi(e->d_name) == getpid()) snprintf(name, sizeof(name), "main");
+
+        double ms = thread_cpu_ms(e->d_name);
+        int i = 0;
+        while (i < count && strcmp(out[i].name, name) != 0) i++;
+        if (i == count) {
+            if (count == max) continue;
+            snprintf(out[count].name, sizeof(out[count].name), "%s", name);
+            out[count++].ms = 0;
+        }
+        out[i].ms += ms;
+    }
+    closedir(dir);
+    return count;
+}
+
+// print the usage help
+static void print_usage(void) {
+    printf("Usage: ./output/pipeline_bench [options] <queue_size> <plugin1> ... <pluginN>\n");
+    printf("Options:\n");
+    printf("    --fuse          Run consecutive stateless plugins in one thread\n");
+    printf("    --batch N       Max items each plugin drains and forwards per wakeup\n");
+    printf("    --input FILE    Send the lines of FILE (up to <END>) instead of random lines\n");
+    printf("    --lines N       Random lines sent in the throughput phase (default 1000000)\n");
+    printf("    --len N         Characters per random line (default 64)\n");
+    printf("    --rounds N      Lines timed one at a time in the latency phase (default 10000)\n");
+    printf("    --wait LIST     park (default), yield or spin - one for every queue or one per plugin\n");
+    printf("    --pool N        Run the stages as tasks on N threads instead of a thread each\n");
+    printf("    --format F      text, csv or json (default text)\n");
+    printf("    --header        With --format csv, print the column names first\n");
+    printf("Example:\n");
+    printf("    ./output/pipeline_bench --fuse 1024 uppercaser flipper rotator\n");
+}
+
+int main(int argc, char* argv[]) {
+    char* endptr;
+    int argi = 1;
+    long batch_size = 0, lines = 1000000, len = 64, rounds = 10000, pool = 0;
+    int fuse = 0, header = 0;
+    const char* input = NULL;
+    const char* format = "text";
+    const char* wait = "park";
+    int waits[MAX_WAITS];
+    int wait_count = 0;
+
+    // parse options, they all come before the queue size
+    while (argi < argc && strncmp(argv[argi], "--", 2) == 0) {
+        long* value = NULL;
+        if (strcmp(argv[argi], "--fuse") == 0 || strcmp(argv[argi], "--header") == 0) {
+            if (argv[argi][2] == 'f') fuse = 1;
+            else header = 1;
+            argi++;
+            continue;
+        }
+        if (strcmp(argv[argi], "--input") == 0 && argi + 1 < argc) {
+            input = argv[argi + 1];
+            argi += 2;
+            continue;
+        }
+        if (strcmp(argv[argi], "--wait") == 0 && argi + 1 < argc) {
+            wait = argv[argi + 1];
+            wait_count = pipeline_parse_waits(wait, waits, MAX_WAITS);
+            if (wait_count <= 0) {
+                fprintf(stderr, "error- not a valid wait strategy list\n");
+                print_usage();
+                return 1;
+            }
+            argi += 2;
+            continue;
+        }
+        if (strcmp(argv[argi], "--format") == 0 && argi + 1 < argc) {
+            format = argv[argi + 1];
+            if (strcmp(format, "text") != 0 && strcmp(format, "csv") != 0 && strcmp(format, "json") != 0) {
+                fprintf(stderr, "error- unknown format %s\n", format);
+                print_usage();
+                return 1;
+            }
+            argi += 2;
+            continue;
+        }
+        if (strcmp(argv[argi], "--batch") == 0) value = &batch_size;
+        if (strcmp(argv[argi], "--lines") == 0) value = &lines;
+        if (strcmp(argv[argi], "--len") == 0) value = &len;
+        if (strcmp(argv[argi], "--rounds") == 0) value = &rounds;
+        if (strcmp(argv[argi], "--pool") == 0) value = &pool;
+        if (!value || argi + 1 >= argc) {
+            fprintf(stderr, "error- unknown option %s\n", argv[argi]);
+            print_usage();
+            return 1;
+        }
+        *value = strtol(argv[argi + 1], &endptr, 10);
+        if (*endptr != '\0' || *value <= 0) {
+            fprintf(stderr, "error- not a valid value for %s\n", argv[argi]);
+            print_usage();
+            return 1;
+        }
+        argi += 2;
+    }
+
+    if (argc - argi < 2) {
+        fprintf(stderr, "error- there are missing arguments\n");
+        print_usage();
+        return 1;
+    }
+    long queue_size = strtol(argv[argi], &endptr, 10);
+    if (*endptr != '\0' || queue_size <= 0) {
+        fprintf(stderr, "error- not a valid queue size\n");
+        print_usage();
+        return 1;
+    }
+    // the lines to send - a corpus file, or random lines of one length
+    bench_corpus_t corpus = { 0 };
+    const char* err = input ? corpus_load(&corpus, input) : corpus_random(&corpus, lines, len);
+    if (err) {
+        fprintf(stderr, "error- failed to prepare the corpus: %s\n", err);
+        return 1;
+    }
+
+    pipeline_t pipeline;
+    if (pipeline_load(&pipeline, argv + argi + 1, argc - argi - 1, NULL, 0) != 0) {
+        print_usage();
+        return 1;
+    }
+    if (wait_count > 1 && wait_count != pipeline.count) { // brackets are not plugins
+        fprintf(stderr, "error- give one wait strategy, or one per plugin\n");
+        print_usage();
+        return 1;
+    }
+
+    bench_sink_t sink = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0 };
+    pipeline_options_t options = { (int)queue_size, (int)batch_size, fuse, bench_sink, (plugin_instance_t*)&sink,
+                                   0, NULL, 0, waits, wait_count, (int)pool };
+    int rc = pipeline_start(&pipeline, &options);
+    if (rc != 0) return rc;
+
+    // plugins such as logger print every line - keep that out of the results
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    if (devnull >= 0) {
+        dup2(devnull, STDOUT_FILENO);
+        close(devnull);
+    }
+
+    // latency - one line in flight at a time
+    long long* samples = (long long*)malloc(sizeof(long long) * rounds);
+    long sent = 0;
+    for (long i = 0; samples && i < rounds; i++) {
+        long k = i % corpus.count;
+        long long start = now_ns();
+        pipeline_place_line(&pipeline, corpus.lines[k], corpus.lens[k]);
+        sent++;
+        bench_wait_received(&sink, sent);
+        samples[i] = now_ns() - start;
+    }
+
+    // throughput - the whole corpus, as many lines in flight as the queues hold
+    stage_cpu_t cpu_before[MAX_STAGE_CPU], cpu[MAX_STAGE_CPU];
+    int cpu_before_count = stage_cpu_collect(cpu_before, MAX_STAGE_CPU);
+    long long start = now_ns();
+    for (long i = 0; i < corpus.count; i++) {
+        pipeline_place_line(&pipeline, corpus.lines[i], corpus.lens[i]);
+        sent++;
+    }
+    bench_wait_received(&sink, sent);
+    double seconds = (now_ns() - start) / 1e9;
+
+    // cpu of the throughput phase only - the threads exit after the end signal
+    int cpu_count = stage_cpu_collect(cpu, MAX_STAGE_CPU);
+    for (int i = 0; i < cpu_count; i++) {
+        for (int j = 0; j < cpu_before_count; j++) {
+            if (strcmp(cpu[i].name, cpu_before[j].name) == 0) cpu[i].ms -= cpu_before[j].ms;
+        }
+    }
+
+    pipeline_place_end(&pipeline);
+    pipeline_wait_finished(&pipeline);
+    pipeline_destroy(&pipeline);
+
+    fflush(stdout);
+    if (saved_stdout >= 0) {
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+    }
+
+    // results
+    double p50 = 0, p99 = 0, p999 = 0;
+    if (samples && rounds > 0) {
+        qsort(samples, rounds, sizeof(long long), compare_ll);
+        p50 = samples[rounds / 2] / 1e3;
+        p99 = samples[rounds * 99 / 100] / 1e3;
+        p999 = samples[rounds * 999 / 1000] / 1e3;
+    }
+    double lines_per_sec = corpus.count / seconds;
+    double mb_per_sec = corpus.bytes / seconds / 1e6;
+
+    char chain[1024] = "";
+    for (int i = argi + 1; i < argc; i++) {
+        snprintf(chain + strlen(chain), sizeof(chain) - strlen(chain), "%s%s", i > argi + 1 ? " " : "", argv[i]);
+    }
+
+    // a list of wait strategies keeps its entries apart with + in csv
+    char wait_csv[256];
+    snprintf(wait_csv, sizeof(wait_csv), "%s", wait);
+    for (char* c = wait_csv; *c; c++) {
+        if (*c == ',') *c = '+';
+    }
+
+    if (strcmp(format, "csv") == 0) {
+        if (header) {
+            printf("chain,fuse,queue_size,batch,wait,pool,lines,bytes,seconds,lines_per_sec,mb_per_sec,p50_us,p99_us,p999_us,cpu_ms\n");
+        }
+        printf("%s,%d,%ld,%ld,%s,%ld,%ld,%zu,%.6f,%.0f,%.2f,%.2f,%.2f,%.2f,", chain, fuse, queue_size, batch_size,
+               wait_csv, pool, corpus.count, corpus.bytes, seconds, lines_per_sec, mb_per_sec, p50, p99, p999);
+        for (int i = 0; i < cpu_count; i++) printf("%s%s=%.1f", i ? ";" : "", cpu[i].name, cpu[i].ms);
+        printf("\n");
+    } else if (strcmp(format, "json") == 0) {
+        printf("{\"chain\": \"%s\", \"fuse\": %d, \"queue_size\": %ld, \"batch\": %ld, \"wait\": \"%s\", \"pool\": %ld, \"lines\": %ld, \"bytes\": %zu, "
+               "\"seconds\": %.6f, \"lines_per_sec\": %.0f, \"mb_per_sec\": %.2f, "
+               "\"p50_us\": %.2f, \"p99_us\": %.2f, \"p999_us\": %.2f, \"cpu_ms\": {",
+               chain, fuse, queue_size, batch_size, wait, pool, corpus.count, corpus.bytes, seconds, lines_per_sec, mb_per_sec,
+               p50, p99, p999);
+        for (int i = 0; i < cpu_count; i++) printf("%s\"%s\": %.1f", i ? ", " : "", cpu[i].name, cpu[i].ms);
+        printf("}}\n");
+    } else {
+        printf("chain: %s%s (queue %ld, batch %ld, wait %s, pool %ld)\n", chain, fuse ? " fused" : "", queue_size,
+               batch_size, wait, pool);
+        printf("latency:    p50 %.1f us  p99 %.1f us  p999 %.1f us  (%ld round trips)\n", p50, p99, p999, rounds);
+        printf("throughput: %.0f lines/s  %.1f MB/s  (%ld lines, %zu bytes in %.3f s)\n",
+               lines_per_sec, mb_per_sec, corpus.count, corpus.bytes, seconds);
+        printf("cpu:       ");
+        for (int i = 0; i < cpu_count; i++) printf(" %s %.1f ms", cpu[i].name, cpu[i].ms);
+        printf("\n");
+    }
+
+    free(samples);
+    free(corpus.lines);
+    free(corpus.lens);
+    free(corpus.text);
+    return 0;
+}
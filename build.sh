@@ -17,25 +17,152 @@ print_warning() {
      echo -e "${YELLOW}[WARNING]${NC} $1";
       }
 
+# ./build.sh [--profile P] [--static-chain "a|b|c"]
+#   --profile default           no optimization, as for debugging (the default)
+#   --profile release           -O2 tuned for this cpu (MARCH=... for another),
+#                               link time optimization, only the plugin api exported
+#   --profile profile-generate  release, counting what runs - run ./bench.sh to
+#                               train it, then build profile-use
+#   --profile profile-use       release, optimized for what the training ran
+#   --static-chain "a|b|c"      also build output/analyzer_static, with that
+#                               chain compiled in (see static_chain.h)
+PROFILE=default
+STATIC_CHAIN=""
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --profile) PROFILE="$2"; shift 2 ;;
+        --static-chain)
+            STATIC_CHAIN="$2"
+            if [ -z "$STATIC_CHAIN" ]; then
+                print_error "--static-chain needs a chain, e.g. \"uppercaser|flipper|logger\""
+                exit 1
+            fi
+            shift 2 ;;
+        *) print_error "unknown option $1"; exit 1 ;;
+    esac
+done
+
+# compiler flags of the profile - the same for compiling and linking, so link
+# time optimization sees the sync code, plugin_common and each plugin together
+PGO_DIR="$(pwd)/output/pgo"
+RELEASE_FLAGS="-O2 -march=${MARCH:-native} -flto=auto -fvisibility=hidden"
+case "$PROFILE" in
+    default) CFLAGS="" ;;
+    release) CFLAGS="$RELEASE_FLAGS" ;;
+    profile-generate) CFLAGS="$RELEASE_FLAGS -fprofile-generate -fprofile-update=atomic -fprofile-dir=$PGO_DIR" ;;
+    profile-use)
+        if [ -z "$(find "$PGO_DIR" -name '*.gcda' 2>/dev/null | head -n 1)" ]; then
+            print_error "no profile in output/pgo - build profile-generate and run ./bench.sh first"
+            exit 1
+        fi
+        CFLAGS="$RELEASE_FLAGS -fprofile-use -fprofile-correction -Wno-missing-profile -fprofile-dir=$PGO_DIR" ;;
+    *) print_error "unknown profile $PROFILE"; exit 1 ;;
+esac
+
+# write output/static_chain_stages.h - every plugin of the chain compiled in
+# under names of its own, and the function running a message through them all
+gen_static_chain() {
+    local chain="$1" out="output/static_chain_stages.h"
+    local stages=() included=" "
+    IFS='|' read -ra stages <<< "$chain"
+    local last=$((${#stages[@]} - 1))
+    for i in "${!stages[@]}"; do
+        local plugin="${stages[$i]}"
+        if ! [[ "$plugin" =~ ^[a-z0-9_]+$ ]] || [ ! -f "plugins/$plugin.c" ]; then
+            print_error "no plugin named '$plugin' for the static chain"
+            exit 1
+        fi
+        if ! grep -q common_plugin_init_msg "plugins/$plugin.c"; then
+            print_error "$plugin has no message api, it cannot be compiled into a static chain"
+            exit 1
+        fi
+        if [ "$i" -lt "$last" ] && grep -q common_plugin_set_hook "plugins/$plugin.c"; then
+            print_error "$plugin has a hook, it can only end a static chain"
+            exit 1
+        fi
+    done
+
+    {
+        echo "// generated by build.sh --static-chain \"$chain\" - do not edit"
+        echo "#define STATIC_CHAIN \"$chain\""
+        for plugin in "${stages[@]}"; do
+            [[ "$included" == *" $plugin "* ]] && continue
+            included="$included$plugin "
+            echo ""
+            echo "#define plugin_transform ${plugin}_plugin_transform"
+            echo "#define plugin_get_name ${plugin}_plugin_get_name"
+            echo "#define plugin_init ${plugin}_plugin_init"
+            echo "#include \"../plugins/$plugin.c\""
+            echo "#undef plugin_transform"
+            echo "#undef plugin_get_name"
+            echo "#undef plugin_init"
+        done
+        echo ""
+        echo "#define STATIC_CHAIN_INITS { $(printf '%s_plugin_init, ' "${stages[@]}" | sed 's/, $//') }"
+        echo ""
+        echo "static plugin_msg_t* static_chain_transform(plugin_msg_t* msg) {"
+        echo "    char* first = msg->data;"
+        echo "    char* data;"
+        echo "    plugin_msg_t* processed;"
+        for plugin in "${stages[@]}"; do
+            echo "    STATIC_CHAIN_STAGE(${plugin}_plugin_transform)"
+        done
+        echo "    return msg;"
+        echo "}"
+    } > "$out"
+}
+
 # create output dirs
 mkdir -p output/plugins
+if [ "$PROFILE" == "profile-generate" ]; then
+    rm -rf "$PGO_DIR" # counts of the old code would not match
+    mkdir -p "$PGO_DIR"
+fi
+print_status "profile: $PROFILE"
 
 print_status "compiling the sync files"
-gcc -fPIC -c plugins/sync/monitor.c -o output/monitor.o
-gcc -fPIC -c plugins/sync/consumer_producer.c -o output/consumer_producer.o
+gcc $CFLAGS -fPIC -c plugins/sync/monitor.c -o output/monitor.o
+gcc $CFLAGS -fPIC -c plugins/sync/consumer_producer.c -o output/consumer_producer.o
+gcc $CFLAGS -fPIC -c plugins/sync/buffer_pool.c -o output/buffer_pool.o
+gcc $CFLAGS -fPIC -c plugins/sync/message.c -o output/message.o
+gcc $CFLAGS -fPIC -c plugins/sync/uring.c -o output/uring.o
 
 print_status "compiling plugin common"
-gcc -fPIC -c plugins/plugin_common.c -o output/plugin_common.o
+gcc $CFLAGS -fPIC -c plugins/plugin_common.c -o output/plugin_common.o
+gcc $CFLAGS -fPIC -c plugins/simd/text_kernels.c -o output/text_kernels.o
 
 # build plugins as .so
-for plugin in logger uppercaser flipper rotator expander typewriter; do
+for plugin in logger uppercaser flipper rotator expander typewriter sink; do
     print_status "building plugin: $plugin"
-    gcc -fPIC -shared plugins/$plugin.c output/plugin_common.o output/consumer_producer.o output/monitor.o -o output/plugins/$plugin.so -lpthread -ldl
+    gcc $CFLAGS -fPIC -shared plugins/$plugin.c output/plugin_common.o output/text_kernels.o output/consumer_producer.o output/monitor.o output/buffer_pool.o output/message.o output/uring.o -o output/plugins/$plugin.so -lpthread -ldl
 done
 
 # build main app
 print_status "building main application..."
-gcc main.c output/consumer_producer.o output/monitor.o -ldl -lpthread -o output/analyzer
+gcc $CFLAGS main.c pipeline.c line_reader.c placement.c config.c executor.c output/consumer_producer.o output/monitor.o output/buffer_pool.o output/message.o output/uring.o -ldl -lpthread -o output/analyzer
+
+# build the analyzer with a chain compiled in
+if [ -n "$STATIC_CHAIN" ]; then
+    print_status "building the static chain: $STATIC_CHAIN"
+    gen_static_chain "$STATIC_CHAIN"
+    gcc -O2 $CFLAGS -Ioutput -c static_chain.c -o output/static_chain.o # optimized, or nothing is inlined
+    gcc $CFLAGS -DSTATIC_CHAIN main.c pipeline.c line_reader.c placement.c config.c executor.c output/static_chain.o output/plugin_common.o output/text_kernels.o output/consumer_producer.o output/monitor.o output/buffer_pool.o output/message.o output/uring.o -ldl -lpthread -o output/analyzer_static
+fi
+
+# build the benchmark tools
+print_status "building benchmark tools..."
+gcc $CFLAGS bench/pipeline_bench.c pipeline.c line_reader.c executor.c output/buffer_pool.o output/message.o output/uring.o -ldl -lpthread -o output/pipeline_bench
+gcc $CFLAGS bench/gen_corpus.c -lm -o output/gen_corpus
+
+# build the unit tests - test.sh runs them
+print_status "building unit tests..."
+mkdir -p output/tests
+gcc $CFLAGS plugins/sync/test_consumer_producer.c output/consumer_producer.o output/monitor.o -lpthread -o output/tests/test_consumer_producer
+gcc $CFLAGS plugins/sync/monitor_test.c output/monitor.o output/consumer_producer.o -lpthread -o output/tests/monitor_test
+gcc $CFLAGS plugins/simd/test_text_kernels.c output/text_kernels.o -o output/tests/test_text_kernels
+gcc $CFLAGS plugins/sync/test_buffer_pool.c output/buffer_pool.o -lpthread -o output/tests/test_buffer_pool
+gcc $CFLAGS plugins/sync/test_message.c output/message.o output/buffer_pool.o -lpthread -o output/tests/test_message
 
 print_status "build complete!"
+[ "$PROFILE" == "profile-generate" ] && echo "train with ./bench.sh, then ./build.sh --profile profile-use"
 echo "run with: ./output/analyzer <queue_size> <plugins...>"
\ No newline at end of file
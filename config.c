@@ -0,0 +1,220 @@
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CONFIG_MAX_WORDS 16     // most words on a line
+
+// a growing list of words
+typedef struct {
+    char** words;
+    int count;
+    int capacity;
+} word_list_t;
+
+// settings and the options they stand for
+static const struct {
+    const char* key;
+    const char* option;
+    int has_value;
+} config_keys[] = {
+    { "path", "--plugin-path", 1 },
+    { "batch", "--batch", 1 },
+    { "adaptive", "--adaptive", 1 },
+    { "cpus", "--cpus", 1 },
+    { "wait", "--wait", 1 },
+    { "input", "--input", 1 },
+    { "mmap_input", "--mmap-input", 1 },
+    { "pool", "--pool", 1 },
+    { "fuse", "--fuse", 0 },
+    { "io_uring", "--io-uring", 0 },
+    { "no_end_marker", "--no-end-marker", 0 },
+};
+
+static int words_add(word_list_t* l, const char* word) {
+    if (l->count == l->capacity) {
+        int capacity = l->capacity ? l->capacity * 2 : 16;
+        char** words = (char**)realloc(l->words, sizeof(char*) * capacity);
+        if (!words) return -1;
+        l->words = words;
+        l->capacity = capacity;
+    }
+    l->words[l->count] = strdup(word);
+    if (!l->words[l->count]) return -1;
+    l->count++;
+    return 0;
+}
+
+static void words_free(word_list_t* l) {
+    for (int i = 0; i < l->count; i++) free(l->words[i]);
+    free(l->words);
+    l->words = NULL;
+    l->count = l->capacity = 0;
+}
+
+// check that a line is only brackets and commas
+static int is_branching(char** words, int count) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(words[i], "[") != 0 && strcmp(words[i], ",") != 0 && strcmp(words[i], "]") != 0) return 0;
+    }
+    return 1;
+}
+
+// turn "stage NAME [workers=N] [queue=C] [wait=W] [key=value...]" into a
+// stage spec followed by the plugin's settings, and its wait strategy
+static const char* parse_stage(char** words, int count, word_list_t* chain, word_list_t* waits) {
+    const char* workers = NULL;
+    const char* queue = NULL;
+    const char* wait = "";      // the pipeline's
+    int settings = 0;           // the words after the stage's options
+    if (count < 2) return "stage needs a plugin name";
+    for (int i = 2; i < count; i++) {
+        if (strncmp(words[i], "workers=", 8) == 0) workers = words[i] + 8;
+        else if (strncmp(words[i], "queue=", 6) == 0) queue = words[i] + 6;
+        else if (strncmp(words[i], "wait=", 5) == 0) wait = words[i] + 5;
+        else if (strchr(words[i], '=') && words[i][0] != '=') words[2 + settings++] = words[i]; // the plugin's
+        else return "unknown stage option, expected workers=, queue=, wait= or a plugin's key=value";
+        if (strpbrk(words[i], "[],")) return "a stage option cannot hold [ ] or ,"; // the chain's syntax
+    }
+    if ((workers && strchr(words[1], ':')) || (queue && strchr(words[1], '@'))) {
+        return "stage option given twice";
+    }
+
+    char spec[512];
+    int len = snprintf(spec, sizeof(spec), "%s%s%s%s%s", words[1], workers ? ":" : "", workers ? workers : "",
+                       queue ? "@" : "", queue ? queue : "");
+    if (len >= (int)sizeof(spec)) return "stage is too long";
+    if (words_add(chain, spec) != 0 || words_add(waits, wait) != 0) return "malloc has failed";
+    for (int i = 0; i < settings; i++) {
+        if (words_add(chain, words[2 + i]) != 0) return "malloc has failed";
+    }
+    return NULL;
+}
+
+// join the stages' wait strategies into one --wait list, the pipeline's
+// strategy (or park) standing in for the stages without one
+static const char* join_waits(word_list_t* waits, const char* fallback, word_list_t* args) {
+    int given = 0;
+    size_t size = 1;
+    for (int i = 0; i < waits->count; i++) {
+        if (*waits->words[i]) given = 1;
+        size += strlen(*waits->words[i] ? waits->words[i] : fallback) + 1;
+    }
+    if (!given) return NULL;
+
+    char* list = (char*)malloc(size);
+    if (!list) return "malloc has failed";
+    list[0] = '\0';
+    for (int i = 0; i < waits->count; i++) {
+        if (i > 0) strcat(list, ",");
+        strcat(list, *waits->words[i] ? waits->words[i] : fallback);
+    }
+    int rc = words_add(args, "--wait") != 0 || words_add(args, list) != 0;
+    free(list);
+    return rc ? "malloc has failed" : NULL;
+}
+
+// read the lines into the option and chain words
+static const char* parse_lines(FILE* f, config_t* config, word_list_t* args, word_list_t* chain,
+                               word_list_t* waits, char** queue_size, const char** wait) {
+    char* line = NULL;
+    size_t size = 0;
+    const char* err = NULL;
+
+    while (!err && getline(&line, &size, f) >= 0) {
+        config->line++;
+        line[strcspn(line, "#")] = '\0'; // comments
+        char* words[CONFIG_MAX_WORDS];
+        int count = 0;
+        char* save;
+        for (char* w = strtok_r(line, " \t\r\n", &save); w; w = strtok_r(NULL, " \t\r\n", &save)) {
+            if (count == CONFIG_MAX_WORDS) {
+                err = "too many words on the line";
+                break;
+            }
+            words[count++] = w;
+        }
+        if (err || count == 0) continue;
+
+        if (strcmp(words[0], "stage") == 0) {
+            err = parse_stage(words, count, chain, waits);
+            continue;
+        }
+        if (is_branching(words, count)) {
+            for (int i = 0; i < count && !err; i++) {
+                if (words_add(chain, words[i]) != 0) err = "malloc has failed";
+            }
+            continue;
+        }
+        if (strcmp(words[0], "queue_size") == 0) {
+            if (count != 2) {
+                err = "queue_size takes one value";
+                continue;
+            }
+            free(*queue_size);
+            *queue_size = strdup(words[1]);
+            if (!*queue_size) err = "malloc has failed";
+            continue;
+        }
+
+        int key = -1;
+        for (size_t i = 0; i < sizeof(config_keys) / sizeof(config_keys[0]); i++) {
+            if (strcmp(words[0], config_keys[i].key) == 0) key = (int)i;
+        }
+        if (key < 0) {
+            err = "unknown setting";
+        } else if (count != 1 + config_keys[key].has_value) {
+            err = config_keys[key].has_value ? "setting takes one value" : "setting takes no value";
+        } else if (words_add(args, config_keys[key].option) != 0 ||
+                   (count == 2 && words_add(args, words[1]) != 0)) {
+            err = "malloc has failed";
+        } else if (strcmp(words[0], "wait") == 0) {
+            *wait = args->words[args->count - 1];
+        }
+    }
+    free(line);
+    return err;
+}
+
+// read the file, then lay it out as command line words
+const char* config_load(const char* path, config_t* config) {
+    config->args = NULL;
+    config->arg_count = config->chain = config->line = 0;
+    FILE* f = fopen(path, "r");
+    if (!f) return "cannot open the config file";
+
+    word_list_t args = { 0 }, chain = { 0 }, waits = { 0 };
+    char* queue_size = NULL;
+    const char* wait = "park";
+    const char* err = parse_lines(f, config, &args, &chain, &waits, &queue_size, &wait);
+    fclose(f);
+
+    if (!err) config->line = 0; // the rest is about the whole file
+    if (!err && chain.count > 0 && !queue_size) err = "the stages need a queue_size";
+    if (!err) err = join_waits(&waits, wait, &args);
+    if (!err) {
+        config->chain = args.count;
+        if (queue_size && words_add(&args, queue_size) != 0) err = "malloc has failed";
+    }
+    for (int i = 0; !err && i < chain.count; i++) {
+        if (words_add(&args, chain.words[i]) != 0) err = "malloc has failed";
+    }
+    free(queue_size);
+    words_free(&chain);
+    words_free(&waits);
+    if (err) {
+        words_free(&args);
+        return err;
+    }
+    config->args = args.words;
+    config->arg_count = args.count;
+    return NULL;
+}
+
+void config_free(config_t* config) {
+    for (int i = 0; i < config->arg_count; i++) free(config->args[i]);
+    free(config->args);
+    config->args = NULL;
+    config->arg_count = config->chain = 0;
+}
@@ -0,0 +1,41 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/**
+ * Pipeline config files - what the command line says, for chains too long
+ * to type. A line holds one setting; # starts a comment:
+ *   queue_size 64                 queue capacity of every stage without its own
+ *   path /opt/analyzer/plugins    a directory plugins are searched in, in order
+ *   batch N | adaptive N | cpus LIST | wait LIST | pool N | input FILE |
+ *   mmap_input FILE | fuse | io_uring | no_end_marker
+ *                                 as the options of the same name
+ *   stage NAME [workers=N] [queue=C] [wait=W] [key=value...]
+ *                                 the next stage of the chain, and settings
+ *                                 for its plugin (e.g. sink output=FILE)
+ *   [ , ]                         open, separate and close branches
+ * The file is turned into command line words, so the analyzer checks it
+ * exactly as it checks its arguments.
+ */
+
+typedef struct {
+    char** args;            // options, then the queue size, then the chain
+    int arg_count;
+    int chain;              // index of the queue size in args, arg_count if the file gives none
+    int line;               // line of the error when loading fails, 0 if not on a line
+} config_t;
+
+/**
+ * Read a config file
+ * @param path The file
+ * @param config Receives the settings, free them with config_free
+ * @return NULL on success, error message on failure (config->line tells where)
+ */
+const char* config_load(const char* path, config_t* config);
+
+/**
+ * Free what config_load allocated
+ * @param config The config
+ */
+void config_free(config_t* config);
+
+#endif
@@ -0,0 +1,285 @@
+#define _GNU_SOURCE
+#include "executor.h"
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define EXECUTOR_HELP_WAIT_NS 200000   // longest a pool thread with nothing to run waits on a full queue
+
+// tasks in a ring - the owner works at the bottom, thieves take from the top
+typedef struct {
+    pthread_mutex_t lock;
+    plugin_task_t** tasks;
+    int head;                      // top
+    int count;
+    int capacity;
+} task_deque_t;
+
+typedef struct executor_thread {
+    struct executor* pool;
+    pthread_t thread;
+    task_deque_t deque;
+    plugin_task_t* running;        // task whose turn the thread is in, the innermost one
+    unsigned int seed;             // picks where stealing starts
+} executor_thread_t;
+
+typedef struct executor {
+    plugin_executor_t base;        // first, the plugins only see this
+    executor_thread_t* threads;
+    int count;
+    task_deque_t shared;           // tasks submitted from outside the pool
+    int queued;                    // tasks in all deques
+    int sleepers;                  // threads waiting on work
+    int stop;
+    pthread_mutex_t lock;          // guards the waits and exit_fns
+    pthread_cond_t work;           // signaled when a task is submitted
+    void (**exit_fns)(void);
+    int exit_count;
+} executor_t;
+
+static __thread executor_thread_t* self; // the pool thread this is, NULL for other threads
+
+static int deque_init(task_deque_t* d) {
+    d->capacity = 16;
+    d->head = d->count = 0;
+    d->tasks = (plugin_task_t**)malloc(sizeof(plugin_task_t*) * d->capacity);
+    if (!d->tasks) return -1;
+    pthread_mutex_init(&d->lock, NULL);
+    return 0;
+}
+
+static void deque_destroy(task_deque_t* d) {
+    pthread_mutex_destroy(&d->lock);
+    free(d->tasks);
+}
+
+// add at the bottom - a task is queued at most once, so the ring only grows
+// up to the number of stages
+static int deque_push(task_deque_t* d, plugin_task_t* task) {
+    pthread_mutex_lock(&d->lock);
+    if (d->count == d->capacity) {
+        plugin_task_t** tasks = (plugin_task_t**)malloc(sizeof(plugin_task_t*) * d->capacity * 2);
+        if (!tasks) {
+            pthread_mutex_unlock(&d->lock);
+            return -1;
+        }
+        for (int i = 0; i < d->count; i++) tasks[i] = d->tasks[(d->head + i) % d->capacity];
+        free(d->tasks);
+        d->tasks = tasks;
+        d->head = 0;
+        d->capacity *= 2;
+    }
+    d->tasks[(d->head + d->count) % d->capacity] = task;
+    d->count++;
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+// take the task nearest the bottom (or the top) whose stage comes after
+// order, closing the gap it leaves
+static plugin_task_t* deque_take(task_deque_t* d, int from_bottom, int order) {
+    plugin_task_t* task = NULL;
+    pthread_mutex_lock(&d->lock);
+    for (int k = 0; k < d->count && !task; k++) {
+        int i = from_bottom ? d->count - 1 - k : k;
+        plugin_task_t* t = d->tasks[(d->head + i) % d->capacity];
+        if (t->order <= order) continue;
+        task = t;
+        for (; i + 1 < d->count; i++) d->tasks[(d->head + i) % d->capacity] = d->tasks[(d->head + i + 1) % d->capacity];
+        d->count--;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return task;
+}
+
+// find a task of a stage after order - our own newest, then the oldest of
+// another thread, then the oldest from outside
+static plugin_task_t* executor_find(executor_t* pool, executor_thread_t* t, int order) {
+    if (__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) == 0) return NULL;
+    plugin_task_t* task = deque_take(&t->deque, 1, order);
+    int start = (int)(rand_r(&t->seed) % (unsigned int)pool->count);
+    for (int k = 0; k < pool->count && !task; k++) {
+        executor_thread_t* victim = &pool->threads[(start + k) % pool->count];
+        if (victim != t) task = deque_take(&victim->deque, 0, order);
+    }
+    if (!task) task = deque_take(&pool->shared, 0, order);
+    if (task) __atomic_fetch_sub(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    return task;
+}
+
+// run a task's turn on this thread
+static void executor_run(executor_thread_t* t, plugin_task_t* task) {
+    plugin_task_t* outer = t->running;
+    t->running = task;
+    task->run(task);
+    t->running = outer;
+}
+
+static void executor_submit(plugin_executor_t* base, plugin_task_t* task) {
+    executor_t* pool = (executor_t*)base;
+    task_deque_t* d = self && self->pool == pool ? &self->deque : &pool->shared;
+    while (deque_push(d, task) != 0) sched_yield(); // out of memory - it cannot be dropped
+    __atomic_fetch_add(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->work);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+// wait for a task to be submitted - until the deadline if there is one (0 for none)
+static void executor_wait(executor_t* pool, unsigned long long deadline) {
+    pthread_mutex_lock(&pool->lock);
+    __atomic_fetch_add(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+    if (deadline) {
+        struct timespec until = { (time_t)(deadline / 1000000000ULL), (long)(deadline % 1000000000ULL) };
+        pthread_cond_timedwait(&pool->work, &pool->lock, &until);
+    } else {
+        while (__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) == 0 && !pool->stop) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+    }
+    __atomic_fetch_sub(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// a thread would wait on a full queue - a pool thread runs a later stage
+// instead, or waits a little for one to be submitted
+static int executor_help(plugin_executor_t* base) {
+    executor_t* pool = (executor_t*)base;
+    executor_thread_t* t = self;
+    if (!t || t->pool != pool) return 0;
+
+    plugin_task_t* task = executor_find(pool, t, t->running ? t->running->order : INT_MIN);
+    if (task) {
+        executor_run(t, task);
+        return 1;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    executor_wait(pool, (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec +
+                            EXECUTOR_HELP_WAIT_NS);
+    return 1;
+}
+
+static void executor_at_thread_exit(plugin_executor_t* base, void (*fn)(void)) {
+    executor_t* pool = (executor_t*)base;
+    pthread_mutex_lock(&pool->lock);
+    int known = 0;
+    for (int i = 0; i < pool->exit_count; i++) known |= pool->exit_fns[i] == fn;
+    if (!known) {
+        void (**fns)(void) = (void (**)(void))realloc(pool->exit_fns, sizeof(*fns) * (pool->exit_count + 1));
+        if (fns) { // without memory the thread's caches are left behind
+            pool->exit_fns = fns;
+            pool->exit_fns[pool->exit_count++] = fn;
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// a pool thread - runs tasks until the pool is stopped and nothing is queued
+static void* executor_thread(void* arg) {
+    executor_thread_t* t = (executor_thread_t*)arg;
+    executor_t* pool = t->pool;
+    self = t;
+
+    while (1) {
+        plugin_task_t* task = executor_find(pool, t, INT_MIN);
+        if (task) {
+            executor_run(t, task);
+            continue;
+        }
+        if (__atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE) && __atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) == 0) break;
+        executor_wait(pool, 0);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    int count = pool->exit_count; // no plugin is initialized while the pool stops
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < count; i++) pool->exit_fns[i]();
+    return NULL;
+}
+
+int executor_default_threads(void) {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return 1;
+    int n = CPU_COUNT(&set);
+    return n > 0 ? n : 1;
+}
+
+// free a pool whose first started threads have exited
+static void executor_free(executor_t* pool, int started) {
+    for (int i = 0; i < started; i++) deque_destroy(&pool->threads[i].deque);
+    deque_destroy(&pool->shared);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    free(pool->exit_fns);
+    free(pool->threads);
+    free(pool);
+}
+
+plugin_executor_t* executor_start(int threads, const int* cpus, int cpu_count) {
+    if (threads <= 0) return NULL;
+    executor_t* pool = (executor_t*)calloc(1, sizeof(executor_t));
+    if (!pool) return NULL;
+    pool->base.submit = executor_submit;
+    pool->base.help = executor_help;
+    pool->base.at_thread_exit = executor_at_thread_exit;
+    pool->count = threads;
+    pool->threads = (executor_thread_t*)calloc((size_t)threads, sizeof(executor_thread_t));
+    if (!pool->threads || deque_init(&pool->shared) != 0) {
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+
+    // helpers time their waits on the monotonic clock
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pool->work, &attr);
+    pthread_condattr_destroy(&attr);
+
+    int started = 0;
+    for (; started < threads; started++) {
+        executor_thread_t* t = &pool->threads[started];
+        t->pool = pool;
+        t->seed = (unsigned int)started * 2654435761u + 1;
+        if (deque_init(&t->deque) != 0) break;
+        if (pthread_create(&t->thread, NULL, executor_thread, t) != 0) {
+            deque_destroy(&t->deque);
+            break;
+        }
+        char name[16];
+        snprintf(name, sizeof(name), "pool-%d", started);
+        pthread_setname_np(t->thread, name);
+        if (cpu_count > 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[started % cpu_count], &set);
+            pthread_setaffinity_np(t->thread, sizeof(set), &set); // best effort, the list was checked
+        }
+    }
+    if (started < threads) {
+        pool->count = started;
+        executor_stop(&pool->base); // frees it
+        return NULL;
+    }
+    return &pool->base;
+}
+
+void executor_stop(plugin_executor_t* base) {
+    executor_t* pool = (executor_t*)base;
+    if (!pool) return;
+    pthread_mutex_lock(&pool->lock);
+    __atomic_store_n(&pool->stop, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->count; i++) pthread_join(pool->threads[i].thread, NULL);
+    executor_free(pool, pool->count);
+}
@@ -0,0 +1,39 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include "plugins/plugin_sdk.h"
+
+/**
+ * A fixed pool of threads running the stages of a chain as tasks, instead of
+ * a thread per stage. Every thread has a deque of tasks: a task submitted by
+ * a pool thread goes to the bottom of its own deque and is run next (the
+ * stage it just fed), an idle thread steals from the top of the others', and
+ * tasks from other threads (the input, stages with threads of their own) go
+ * to a shared queue. A pool thread that finds the next stage's queue full
+ * runs tasks of later stages meanwhile, never earlier ones, so no stage ever
+ * waits on one whose turn is stuck under it.
+ */
+
+/**
+ * Start a pool
+ * @param threads Number of threads
+ * @param cpus Cpus to pin the threads to, handed out in turn (NULL for none)
+ * @param cpu_count Entries in cpus
+ * @return The pool, or NULL if it cannot be started
+ */
+plugin_executor_t* executor_start(int threads, const int* cpus, int cpu_count);
+
+/**
+ * Number of threads a pool sized to the machine gets - the cpus the process
+ * may run on
+ * @return At least 1
+ */
+int executor_default_threads(void);
+
+/**
+ * Stop a pool - its threads run what is still queued, then exit
+ * @param executor The pool (NULL is ignored)
+ */
+void executor_stop(plugin_executor_t* executor);
+
+#endif
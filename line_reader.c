@@ -0,0 +1,260 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "line_reader.h"
+
+#define LINE_READER_READ 1ULL          // io_uring user data of a read
+#define LINE_READER_CANCEL 2ULL        // of the poll on cancel_fd
+#define LINE_READER_STOP 3ULL          // of the cancellation of a read
+
+// open a reader on a file (mapped when possible) or on stdin
+const char* line_reader_open(line_reader_t* r, const char* path) {
+    if (!r) return "args are invalid";
+    memset(r, 0, sizeof(*r));
+    r->fd = STDIN_FILENO;
+    r->cancel_fd = -1;
+
+    if (path) {
+        r->fd = open(path, O_RDONLY);
+        if (r->fd < 0) return "cannot open input file";
+        r->owns_fd = 1;
+    }
+
+    // map regular files and scan them in place, with no copy into a buffer
+    struct stat st;
+    if (fstat(r->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, r->fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            madvise(map, (size_t)st.st_size, MADV_HUGEPAGE); // fewer tlb misses, where files can have huge pages
+            r->map = (const char*)map;
+            r->map_len = (size_t)st.st_size;
+            return NULL;
+        }
+    }
+
+    // everything else is read in chunks
+    posix_fadvise(r->fd, 0, 0, POSIX_FADV_SEQUENTIAL); // fails harmlessly on pipes
+    r->cap = LINE_READER_CHUNK + 1; // room for the terminating NUL of a line without newline
+    r->buf = (char*)malloc(r->cap);
+    if (!r->buf) {
+        if (r->owns_fd) close(r->fd);
+        return "malloc has failed";
+    }
+    return NULL;
+}
+
+// next line of a mapped file
+static const char* line_reader_next_mapped(line_reader_t* r, size_t* len) {
+    if (r->pos >= r->map_len) return NULL;
+
+    const char* line = r->map + r->pos;
+    const char* nl = (const char*)memchr(line, '\n', r->map_len - r->pos);
+    *len = nl ? (size_t)(nl - line) : r->map_len - r->pos;
+    r->pos += *len + (nl ? 1 : 0);
+    return line;
+}
+
+// wait until the input can be read without blocking, or the cancel
+// descriptor becomes readable - returns 1 if cancelled
+static int line_reader_wait(line_reader_t* r) {
+    struct pollfd fds[2] = { { r->fd, POLLIN, 0 }, { r->cancel_fd, POLLIN, 0 } };
+    while (poll(fds, 2, -1) < 0) {
+        if (errno != EINTR) return 0; // let read(2) report it
+    }
+    return fds[1].revents != 0;
+}
+
+// make room for at least one more read - drop consumed bytes, then grow
+static int line_reader_make_room(line_reader_t* r) {
+    if (r->start > 0) {
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->scan -= r->start;
+        r->start = 0;
+    }
+    if (r->end + 1 < r->cap) return 0;
+
+    // the line in the buffer is longer than the buffer
+    char* bigger = (char*)realloc(r->buf, r->cap * 2);
+    if (!bigger) return -1;
+    r->buf = bigger;
+    r->cap *= 2;
+    return 0;
+}
+
+// switch a stream to io_uring, with two chunks registered so the kernel
+// does not map their pages on every read
+int line_reader_use_uring(line_reader_t* r) {
+    if (!r || !r->buf || r->ring || r->end > 0 || r->eof) return -1; // mapped, or reading already
+    uring_t* ring = (uring_t*)malloc(sizeof(uring_t));
+    char* chunks = (char*)malloc(2 * (LINE_READER_CHUNK + 1)); // room for the NUL that replaces a newline
+    if (!ring || !chunks || uring_init(ring, 4) != NULL) {
+        free(ring);
+        free(chunks);
+        return -1;
+    }
+    r->chunks[0] = chunks;
+    r->chunks[1] = chunks + LINE_READER_CHUNK + 1;
+    struct iovec iov[2] = { { r->chunks[0], LINE_READER_CHUNK }, { r->chunks[1], LINE_READER_CHUNK } };
+    uring_register_buffers(ring, iov, 2); // plain reads if the locked memory limit is too low
+    r->ring = ring;
+    return 0;
+}
+
+// start reading into the chunk not being scanned
+static int line_reader_submit(line_reader_t* r) {
+    int other = !r->cur;
+    if (uring_prep_rw(r->ring, 0, r->fd, r->chunks[other], LINE_READER_CHUNK, other, LINE_READER_READ) != 0) return -1;
+    if (uring_submit(r->ring) != 0) return -1;
+    r->reading = 1;
+    return 0;
+}
+
+// wait for the read in flight and scan its chunk, starting the next read
+// into the one just scanned - 0 at the end of the input or when cancelled
+static int line_reader_fill(line_reader_t* r) {
+    if (r->cancel_fd >= 0 && !r->cancel_armed && uring_prep_poll(r->ring, r->cancel_fd, LINE_READER_CANCEL) == 0) {
+        r->cancel_armed = 1; // submitted with the read
+    }
+    if (!r->reading && line_reader_submit(r) != 0) return 0;
+    while (1) {
+        unsigned long long what;
+        int res;
+        if (uring_wait(r->ring, &what, &res) != 0) return 0;
+        if (what == LINE_READER_CANCEL) return 0; // the read stays in flight until close
+        r->reading = 0;
+        if (res == -EINTR || res == -EAGAIN) {
+            if (line_reader_submit(r) != 0) return 0;
+            continue;
+        }
+        if (res <= 0) return 0; // end of input, or a read error that ends it
+        r->cur = !r->cur;
+        r->start = 0;
+        r->end = (size_t)res;
+        line_reader_submit(r); // if it fails, the next fill tries again
+        return 1;
+    }
+}
+
+// add the start of a line that goes on in the next chunk
+static int line_reader_carry(line_reader_t* r, const char* data, size_t n) {
+    if (r->carry + n + 1 > r->cap) {
+        size_t cap = r->cap;
+        while (r->carry + n + 1 > cap) cap *= 2;
+        char* bigger = (char*)realloc(r->buf, cap);
+        if (!bigger) return -1;
+        r->buf = bigger;
+        r->cap = cap;
+    }
+    memcpy(r->buf + r->carry, data, n);
+    r->carry += n;
+    return 0;
+}
+
+// hand out the carried line
+static const char* line_reader_take_carry(line_reader_t* r, size_t* len) {
+    r->buf[r->carry] = '\0';
+    *len = r->carry;
+    r->carry = 0;
+    return r->buf;
+}
+
+// next line of a stream read through io_uring - in place in its chunk, or
+// put together in buf when it spans two
+static const char* line_reader_next_uring(line_reader_t* r, size_t* len) {
+    while (1) {
+        char* chunk = r->chunks[r->cur];
+        char* nl = r->start < r->end ? (char*)memchr(chunk + r->start, '\n', r->end - r->start) : NULL;
+        if (nl) {
+            char* line = chunk + r->start;
+            size_t n = (size_t)(nl - line);
+            r->start += n + 1;
+            if (r->carry == 0) {
+                *nl = '\0';
+                *len = n;
+                return line;
+            }
+            if (line_reader_carry(r, line, n) != 0) r->eof = 1; // out of memory, the line is cut short
+            return line_reader_take_carry(r, len);
+        }
+
+        if (line_reader_carry(r, chunk + r->start, r->end - r->start) != 0) r->eof = 1;
+        r->start = r->end;
+        if (r->eof || !line_reader_fill(r)) {
+            r->eof = 1; // hand out what is carried
+            if (r->carry == 0) return NULL;
+            return line_reader_take_carry(r, len);
+        }
+    }
+}
+
+// next line of a stream, NUL-terminated in place
+const char* line_reader_next(line_reader_t* r, size_t* len) {
+    if (!r || !len) return NULL;
+    if (r->map) return line_reader_next_mapped(r, len);
+    if (r->ring) return line_reader_next_uring(r, len);
+
+    while (1) {
+        // look for the newline only in bytes not scanned before
+        char* nl = (char*)memchr(r->buf + r->scan, '\n', r->end - r->scan);
+        if (nl) {
+            char* line = r->buf + r->start;
+            *nl = '\0';
+            *len = (size_t)(nl - line);
+            r->start = r->scan = (size_t)(nl - r->buf) + 1;
+            return line;
+        }
+        r->scan = r->end;
+
+        if (r->eof) {
+            if (r->start == r->end) return NULL;
+            char* line = r->buf + r->start; // last line, without a newline
+            r->buf[r->end] = '\0';          // make_room always leaves a byte for this
+            *len = r->end - r->start;
+            r->start = r->scan = r->end;
+            return line;
+        }
+
+        if (line_reader_make_room(r) != 0) {
+            r->eof = 1; // out of memory, hand out what is buffered
+            continue;
+        }
+        if (r->cancel_fd >= 0 && line_reader_wait(r)) {
+            r->eof = 1; // cancelled, hand out what is buffered
+            continue;
+        }
+        ssize_t n = read(r->fd, r->buf + r->end, r->cap - 1 - r->end);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            r->eof = 1; // end of input, or a read error that ends it
+        } else {
+            r->end += (size_t)n;
+        }
+    }
+}
+
+// close the reader
+void line_reader_close(line_reader_t* r) {
+    if (!r) return;
+    if (r->map) munmap((void*)r->map, r->map_len);
+    if (r->ring) {
+        // a read in flight would still fill its chunk after the ring is gone
+        unsigned long long what;
+        int res;
+        if (r->reading && uring_prep_cancel(r->ring, LINE_READER_READ, LINE_READER_STOP) == 0 && uring_submit(r->ring) == 0) {
+            while (uring_wait(r->ring, &what, &res) == 0 && what != LINE_READER_READ) {}
+        }
+        uring_exit(r->ring);
+        free(r->ring);
+        free(r->chunks[0]);
+    }
+    free(r->buf);
+    if (r->owns_fd) close(r->fd);
+    memset(r, 0, sizeof(*r));
+}
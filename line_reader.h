@@ -0,0 +1,79 @@
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+#include <stddef.h>
+#include "plugins/sync/uring.h"
+
+/**
+ * Streaming line reader - splits input into lines of any length
+ * A regular file is mapped and scanned in place; anything else (a pipe,
+ * a terminal, or a file that cannot be mapped) is read in large chunks
+ * into a buffer that grows to hold the longest line. With io_uring, a stream
+ * is read into two registered chunks in turn: the kernel fills one while
+ * the other is scanned, and only lines that span both are copied
+ */
+
+#define LINE_READER_CHUNK (1 << 20)    // bytes asked of each read(2)
+
+typedef struct {
+    int fd;                 // input file descriptor
+    int owns_fd;            // opened by line_reader_open, closed by line_reader_close
+    int eof;                // read(2) reported end of input (or an error)
+    int cancel_fd;          // the input ends once this is readable (-1 for none, set after line_reader_open)
+
+    // read mode - buf holds [start, end), scan is where the newline search resumes
+    char* buf;
+    size_t cap;
+    size_t start;
+    size_t end;
+    size_t scan;
+
+    // mmap mode - the whole file, pos is the start of the next line
+    const char* map;
+    size_t map_len;
+    size_t pos;
+
+    // io_uring mode - lines are scanned in chunks[cur] from start to end, a
+    // read into the other chunk is in flight, and buf collects a line that
+    // spans the two (carry bytes of it so far)
+    uring_t* ring;          // NULL in the other modes
+    char* chunks[2];
+    int cur;
+    int reading;            // a read into the other chunk is in flight
+    int cancel_armed;       // the ring polls cancel_fd
+    size_t carry;
+} line_reader_t;
+
+/**
+ * Open a reader on a file, or on stdin
+ * @param reader Pointer to reader structure
+ * @param path File to read, NULL for stdin
+ * @return NULL on success, error message on failure
+ */
+const char* line_reader_open(line_reader_t* reader, const char* path);
+
+/**
+ * Read a stream through io_uring instead of read(2) - a mapped file stays
+ * mapped, and a kernel without io_uring leaves the reader as it was
+ * @param reader Pointer to reader structure, opened and not read from yet
+ * @return 0 if the reader uses io_uring, -1 if it does not
+ */
+int line_reader_use_uring(line_reader_t* reader);
+
+/**
+ * Get the next line, without its newline. The last line may lack a newline.
+ * The line stays valid until the next call; it is not NUL-terminated when
+ * the input is mapped.
+ * @param reader Pointer to reader structure
+ * @param len Receives the line's length in bytes
+ * @return The line, or NULL at the end of the input
+ */
+const char* line_reader_next(line_reader_t* reader, size_t* len);
+
+/**
+ * Close the reader and free its buffer or mapping
+ * @param reader Pointer to reader structure
+ */
+void line_reader_close(line_reader_t* reader);
+
+#endif
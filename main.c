@@ -1,28 +1,89 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <dlfcn.h>
-#include "plugins/plugin_sdk.h"
-
-#define MAX_PLUGINS 10
-#define MAX_LINE 1024
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include "pipeline.h"
+#include "line_reader.h"
+#include "placement.h"
+#include "config.h"
+#include "executor.h"
+#ifdef STATIC_CHAIN
+#include "static_chain.h"
+#endif
 
+// takes the signals in one thread - every other thread blocks them, so the
+// plugins' threads are never interrupted. SIGUSR1 prints the stats table,
+// SIGINT and SIGTERM abort the pipeline and wake the reader; a second one
+// exits at once
 typedef struct {
-    const char* (*init)(int);
-    const char* (*fini)(void);
-    const char* (*place_work)(const char*);
-    void (*attach)(const char* (*)(const char*));
-    const char* (*wait_finished)(void);
-    const char* (*get_name)(void);
-    void* handle;
-} plugin_handle_t;
+    pipeline_t* pipeline;
+    int stop;               // set before the last SIGUSR1, which ends the thread
+    int aborted;            // signal that aborted the run, 0 if none
+    int cancel[2];          // pipe the reader polls, written to on abort
+} signal_watch_t;
+
+static void* signal_thread(void* arg) {
+    signal_watch_t* w = (signal_watch_t*)arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+
+    while (1) {
+        int sig;
+        if (sigwait(&set, &sig) != 0) continue;
+        if (sig == SIGUSR1) {
+            if (__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE)) break;
+            pipeline_print_stats(w->pipeline, stderr);
+            continue;
+        }
+        if (__atomic_load_n(&w->aborted, __ATOMIC_ACQUIRE)) _exit(128 + sig); // still stuck after an abort
+        __atomic_store_n(&w->aborted, sig, __ATOMIC_RELEASE);
+        pipeline_abort(w->pipeline);
+        if (w->cancel[1] >= 0) {
+            ssize_t n = write(w->cancel[1], "x", 1); // wakes a reader blocked on the input
+            (void)n; // if it fails the reader still stops at the next line
+        }
+    }
+    return NULL;
+}
 
 // print the usage help
 void print_usage() {
-    printf("Usage: ./analyzer <queue_size> <plugin1> <plugin2> ... <pluginN>\n");
+    printf("Usage: ./analyzer [options] <queue_size> <plugin1> <plugin2> ... <pluginN>\n");
+    printf("       ./analyzer --config FILE [options] [<queue_size> <plugin1> ... <pluginN>]\n");
+    printf("Options:\n");
+    printf("    --adaptive N    Resize the queues while running, N items in all queues at most\n");
+    printf("    --batch N       Max items each plugin drains and forwards per wakeup\n");
+    printf("    --config FILE   Take options, the queue size and the chain from FILE (see config.h); options\n");
+    printf("                    after it and a chain on the command line take precedence\n");
+    printf("    --cpus LIST     Pin the stages' threads to cpus (\"0,2,4-7\"), in chain order; \"auto\" orders\n");
+    printf("                    the allowed cpus so neighbouring stages share caches\n");
+    printf("    --fuse          Run consecutive stateless plugins in one thread, without queues between them\n");
+    printf("    --input FILE    Read lines from FILE instead of stdin (ends at <END> or end of file)\n");
+    printf("    --mmap-input FILE  Map FILE and hand its lines to the plugins without copying them; a\n");
+    printf("                    plugin copies a line only when it changes it\n");
+    printf("    --io-uring      Read piped input through io_uring, falling back to read(2) without it\n");
+    printf("    --no-end-marker Pass <END> lines on as data, only the end of the input ends it\n");
+    printf("    --plugin-path DIR  Search plugins in DIR, in the order given (default %s)\n", PIPELINE_PLUGIN_PATH);
+    printf("    --pool N        Run the stages as tasks on N threads instead of a thread each (\"auto\" for\n");
+    printf("                    one per cpu); stages with extra workers keep their own, --cpus pins the pool\n");
+    printf("    --wait LIST     How the queues wait when empty or full: park (default), yield or spin,\n");
+    printf("                    one for every queue or one per plugin, separated by commas\n");
     printf("Arguments:\n");
     printf("    queue_size      Maximum number of items in each plugin's queue\n");
     printf("    plugin1..N      Names of plugins to load (without .so extension)\n");
+    printf("                    name:N runs N workers on a stateless stage, keeping line order\n");
+    printf("                    name@C gives the stage a queue of C items (name:N@C for both)\n");
+    printf("                    [ a b , c ] sends every line down both branches, and a plugin after\n");
+    printf("                    the brackets takes the lines of both (space separated)\n");
+    printf("                    key=value after a plugin is a setting of that stage (sink output=FILE)\n");
+    printf("Notes:\n");
+    printf("    Per-stage counters are printed to stderr at shutdown and on SIGUSR1\n");
+    printf("    SIGINT or SIGTERM stops at once, dropping queued lines (a second one exits)\n");
     printf("Available plugins:\n");
     printf("    logger       - Logs all strings that pass through\n");
     printf("    typewriter   - Simulates typewriter effect with delays\n");
@@ -30,21 +91,160 @@ void print_usage() {
     printf("    rotator      - Move every character right; last moves to start\n");
     printf("    flipper      - Reverses order of characters\n");
     printf("    expander     - Expands each character with spaces\n");
+    printf("    sink         - Writes lines through a large buffer (settings output=file,\n");
+    printf("                   flush=size[:bytes]|line|time:ms, direct=1 for O_DIRECT, uring=1 to\n");
+    printf("                   write through io_uring; SINK_OUTPUT, SINK_FLUSH, SINK_DIRECT and\n");
+    printf("                   SINK_URING give the ones a stage leaves out)\n");
     printf("Example:\n");
     printf("    ./analyzer 20 uppercaser rotator logger\n");
+    printf("    ./analyzer 20 uppercaser expander:4 logger\n");
+    printf("    ./analyzer 20 uppercaser [ logger , flipper sink ]\n");
 }
 
 int main(int argc, char* argv[]) {
+    char* endptr;
+    int argi = 1;           // first non-option argument
+    long batch_size = 0;    // 0 keeps the plugins' default
+    long queue_budget = 0;  // 0 keeps the queue sizes fixed
+    static int cpus[PLACEMENT_MAX_CPUS];
+    int cpu_count = 0;      // 0 leaves the threads unpinned
+    int* waits = NULL;
+    int wait_count = 0;     // 0 keeps the queues' default
+    int fuse = 0;
+    long pool = 0;          // 0 gives every stage its threads
+    const char* input = NULL; // NULL reads stdin
+    int end_marker = 1;     // an <END> line ends the input
+    int io_uring = 0;       // read a piped input through io_uring
+    int borrow = 0;         // hand out the lines of the mapped input itself
+    config_t config = { 0 };
+    char** args = NULL;     // the config file's options and the command line's
+
+    // a config file stands for the arguments it holds - its options go first,
+    // so the ones after it on the command line win
+    if (argc > 2 && strcmp(argv[1], "--config") == 0) {
+        const char* err = config_load(argv[2], &config);
+        if (err && config.line > 0) {
+            fprintf(stderr, "error- %s:%d: %s\n", argv[2], config.line, err);
+            return 1;
+        } else if (err) {
+            fprintf(stderr, "error- %s: %s\n", argv[2], err);
+            return 1;
+        }
+        args = (char**)malloc(sizeof(char*) * (config.chain + argc - 2));
+        if (!args) {
+            fprintf(stderr, "error- malloc has failed\n");
+            return 1;
+        }
+        args[0] = argv[0];
+        memcpy(args + 1, config.args, sizeof(char*) * config.chain);
+        memcpy(args + 1 + config.chain, argv + 3, sizeof(char*) * (argc - 3));
+        argc = config.chain + argc - 2;
+        argv = args;
+    }
+    char** paths = (char**)malloc(sizeof(char*) * argc); // never more than the arguments
+    int path_count = 0;     // 0 searches PIPELINE_PLUGIN_PATH
+    if (!paths) {
+        fprintf(stderr, "error- malloc has failed\n");
+        return 1;
+    }
+
+    // parse options, they all come before the queue size
+    while (argi < argc && strncmp(argv[argi], "--", 2) == 0) {
+        if (strcmp(argv[argi], "--batch") == 0 && argi + 1 < argc) {
+            batch_size = strtol(argv[argi + 1], &endptr, 10);
+            if (*endptr != '\0' || batch_size <= 0) {
+                fprintf(stderr, "error- not a valid batch size\n");
+                print_usage();
+                return 1;
+            }
+            argi += 2;
+        } else if (strcmp(argv[argi], "--adaptive") == 0 && argi + 1 < argc) {
+            queue_budget = strtol(argv[argi + 1], &endptr, 10);
+            if (*endptr != '\0' || queue_budget <= 0 || queue_budget > 0x7fffffffL) {
+                fprintf(stderr, "error- not a valid queue budget\n");
+                print_usage();
+                return 1;
+            }
+            argi += 2;
+        } else if (strcmp(argv[argi], "--cpus") == 0 && argi + 1 < argc) {
+            const char* list = argv[argi + 1];
+            cpu_count = strcmp(list, "auto") == 0 ? placement_auto(cpus, PLACEMENT_MAX_CPUS)
+                                                  : placement_parse(list, cpus, PLACEMENT_MAX_CPUS);
+            if (cpu_count <= 0) {
+                fprintf(stderr, "error- not a valid cpu list\n");
+                print_usage();
+                return 1;
+            }
+            for (int i = 0; i < cpu_count; i++) {
+                if (!placement_allowed(cpus[i])) {
+                    fprintf(stderr, "error- cpu %d is not available\n", cpus[i]);
+                    return 1;
+                }
+            }
+            argi += 2;
+        } else if (strcmp(argv[argi], "--pool") == 0 && argi + 1 < argc) {
+            pool = strcmp(argv[argi + 1], "auto") == 0 ? executor_default_threads()
+                                                       : strtol(argv[argi + 1], &endptr, 10);
+            if ((strcmp(argv[argi + 1], "auto") != 0 && *endptr != '\0') || pool <= 0 || pool > 1024) {
+                fprintf(stderr, "error- not a valid pool size\n");
+                print_usage();
+                return 1;
+            }
+            argi += 2;
+        } else if (strcmp(argv[argi], "--wait") == 0 && argi + 1 < argc) {
+            int max = 1;
+            for (const char* c = argv[argi + 1]; *c; c++) max += *c == ',';
+            free(waits);
+            waits = (int*)malloc(sizeof(int) * max);
+            wait_count = waits ? pipeline_parse_waits(argv[argi + 1], waits, max) : -1;
+            if (wait_count <= 0) {
+                fprintf(stderr, "error- not a valid wait strategy list\n");
+                print_usage();
+                return 1;
+            }
+            argi += 2;
+        } else if (strcmp(argv[argi], "--input") == 0 && argi + 1 < argc) {
+            input = argv[argi + 1];
+            argi += 2;
+        } else if (strcmp(argv[argi], "--mmap-input") == 0 && argi + 1 < argc) {
+            input = argv[argi + 1];
+            borrow = 1;
+            argi += 2;
+        } else if (strcmp(argv[argi], "--plugin-path") == 0 && argi + 1 < argc) {
+            paths[path_count++] = argv[argi + 1];
+            argi += 2;
+        } else if (strcmp(argv[argi], "--fuse") == 0) {
+            fuse = 1;
+            argi++;
+        } else if (strcmp(argv[argi], "--io-uring") == 0) {
+            io_uring = 1;
+            argi++;
+        } else if (strcmp(argv[argi], "--no-end-marker") == 0) {
+            end_marker = 0;
+            argi++;
+        } else {
+            fprintf(stderr, "error- unknown option %s\n", argv[argi]);
+            print_usage();
+            return 1;
+        }
+    }
+
+    // the config file's queue size and chain, unless the command line gives them
+    if (argi == argc && config.chain < config.arg_count) {
+        argv = config.args + config.chain;
+        argc = config.arg_count - config.chain;
+        argi = 0;
+    }
+
     // check if there are enough args
-    if (argc < 3) {
+    if (argc - argi < 2) {
         fprintf(stderr, "error- there are missing arguments\n");
         print_usage();
         return 1;
     }
 
     // parse queue size with validation
-    char* endptr;
-    long queue_size = strtol(argv[1], &endptr, 10);
+    long queue_size = strtol(argv[argi], &endptr, 10);
 
     // if theres invalid characters return error
     if (*endptr != '\0') { 
@@ -60,79 +260,123 @@ int main(int argc, char* argv[]) {
         return 1;
     }
     
-    int plugin_count = argc - 2; // number of plugins specified
-    plugin_handle_t plugins[MAX_PLUGINS];
+    int word_count = argc - argi - 1; // plugins, and the brackets and commas of branches
+    int plugin_count = 0;             // number of plugins specified
+    for (int i = argi + 1; i < argc; i++) {
+        if (strcmp(argv[i], "[") != 0 && strcmp(argv[i], "]") != 0 && strcmp(argv[i], ",") != 0) plugin_count++;
+    }
+    if (wait_count > 1 && wait_count != plugin_count) {
+        fprintf(stderr, "error- give one wait strategy, or one per plugin\n");
+        print_usage();
+        return 1;
+    }
 
     // load plugins
-    for (int i = 0; i < plugin_count; i++) {
-        char filename[256];
-        snprintf(filename, sizeof(filename), "output/plugins/%s.so", argv[i + 2]); // build so path
+    pipeline_t pipeline;
+#ifdef STATIC_CHAIN
+    pipeline_set_builtin(&static_chain); // built by ./build.sh --static-chain
+#endif
+    if (pipeline_load(&pipeline, argv + argi + 1, word_count, paths, path_count) != 0) {
+        print_usage();
+        return 1;
+    }
 
-        plugins[i].handle = dlopen(filename, RTLD_NOW | RTLD_LOCAL); 
-        if (!plugins[i].handle) {
-            fprintf(stderr, "error- failed to load %s: %s\n", filename, dlerror());
-            print_usage();
-            return 1;
-        }
+    // SIGUSR1, SIGINT and SIGTERM are only taken by the signal thread - block
+    // them before any plugin thread starts, they inherit the mask
+    sigset_t handled;
+    sigemptyset(&handled);
+    sigaddset(&handled, SIGUSR1);
+    sigaddset(&handled, SIGINT);
+    sigaddset(&handled, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &handled, NULL);
 
-        // resolve the functions of each plugin 
-        plugins[i].init = dlsym(plugins[i].handle, "plugin_init");
-        plugins[i].fini = dlsym(plugins[i].handle, "plugin_fini");
-        plugins[i].place_work = dlsym(plugins[i].handle, "plugin_place_work");
-        plugins[i].attach = dlsym(plugins[i].handle, "plugin_attach");
-        plugins[i].wait_finished = dlsym(plugins[i].handle, "plugin_wait_finished");
-        plugins[i].get_name = dlsym(plugins[i].handle, "plugin_get_name");
-
-        // check if all functions are resolved
-        if (!plugins[i].init || !plugins[i].fini || !plugins[i].place_work || !plugins[i].attach || !plugins[i].wait_finished || !plugins[i].get_name) {
-            fprintf(stderr, "error- missing function in plugin %s\n", filename);
-            print_usage();
-            return 1;
-        }
-    }
+    // initialaize, fuse and attach the plugins
+    pipeline_options_t options = { (int)queue_size, (int)batch_size, fuse, NULL, NULL, (int)queue_budget, cpus, cpu_count,
+                                   waits, wait_count, (int)pool };
+    int rc = pipeline_start(&pipeline, &options);
+    if (rc != 0) return rc;
 
-    // initialaize the plugins
-    for (int i = 0; i < plugin_count; i++) {
-        const char* err = plugins[i].init(queue_size);
-        // if a plugin fails to initialize, print error and clean
-        if (err) {
-            fprintf(stderr, "error- failed to init plugin %s: %s\n", plugins[i].get_name(), err);
-            for (int j = 0; j <= i; j++) {
-                dlclose(plugins[j].handle);
-            }
-            return 2;
-        }
+    signal_watch_t watch = { &pipeline, 0, 0, { -1, -1 } };
+    if (pipe(watch.cancel) != 0) watch.cancel[0] = watch.cancel[1] = -1; // an abort then waits for the next line
+    pthread_t watcher;
+    int watching = pthread_create(&watcher, NULL, signal_thread, &watch) == 0;
+    if (!watching) { // let the signals kill the process as usual
+        sigdelset(&handled, SIGUSR1);
+        pthread_sigmask(SIG_UNBLOCK, &handled, NULL);
     }
 
-    // attach the plugins to each other
-    for (int i = 0; i < plugin_count - 1; i++) {
-        plugins[i].attach(plugins[i + 1].place_work);
+    // read input from stdin or the input file, in large chunks
+    line_reader_t reader;
+    const char* err = line_reader_open(&reader, input);
+    if (err) {
+        fprintf(stderr, "error- failed to read %s: %s\n", input ? input : "stdin", err);
+        pipeline_place_end(&pipeline); // still shut the plugins down
+    } else if (borrow && !reader.map) {
+        fprintf(stderr, "error- cannot map %s, --mmap-input takes a regular file that is not empty\n", input);
+        line_reader_close(&reader);
+        err = "not mapped";
+        pipeline_place_end(&pipeline);
+    } else {
+        reader.cancel_fd = watch.cancel[0];
+        if (io_uring) line_reader_use_uring(&reader); // read(2) where io_uring is not there
     }
 
-    // read input from stdin
-    char line[MAX_LINE];
-
-    // while there is input, read it line by line
-    while (fgets(line, sizeof(line), stdin)) {
-        line[strcspn(line, "\n")] = '\0'; // strip newline
-        if (strcmp(line, "<END>") == 0) { // if "<END>" is received, signal all plugins to finish
-            plugins[0].place_work("<END>");
+    // while there is input, send it line by line - a line may have any length
+    const char* line = NULL;
+    const char* place_err = NULL;
+    size_t len;
+    while (!err && (line = line_reader_next(&reader, &len))) {
+        if (__atomic_load_n(&watch.aborted, __ATOMIC_RELAXED)) break; // the plugins are gone already
+        if (end_marker && len == 5 && memcmp(line, "<END>", 5) == 0) { // if "<END>" is received, signal all plugins to finish
+            pipeline_place_end(&pipeline);
+            break;
+        }
+        if (borrow) {
+            place_err = pipeline_place_borrowed(&pipeline, line, len); // the mapping outlives the plugins
+        } else {
+            place_err = pipeline_place_line(&pipeline, line, len); // send to first plugin
+        }
+        if (place_err) { // stop as a signal would, the line is lost
+            fprintf(stderr, "error- failed to pass a line to the plugins: %s\n", place_err);
+            if (pipeline_abort(&pipeline)) pipeline_place_end(&pipeline); // a stage without the control api ends instead
             break;
         }
-        plugins[0].place_work(line); // send to first plugin
     }
+    int aborted = __atomic_load_n(&watch.aborted, __ATOMIC_ACQUIRE);
+    if (!err && !line && !aborted) pipeline_place_end(&pipeline); // input ended without <END>
 
     // wait for all plugins to finish
-    for (int i = 0; i < plugin_count; i++) {
-        plugins[i].wait_finished();
-    }
+    pipeline_wait_finished(&pipeline);
 
-    // cleanup and unload
-    for (int i = 0; i < plugin_count; i++) {
-        plugins[i].fini();
-        dlclose(plugins[i].handle);
+    // stop the signal thread and print the final counters
+    if (watching) {
+        __atomic_store_n(&watch.stop, 1, __ATOMIC_RELEASE);
+        pthread_kill(watcher, SIGUSR1);
+        pthread_join(watcher, NULL);
     }
+    if (watch.cancel[0] >= 0) {
+        close(watch.cancel[0]);
+        close(watch.cancel[1]);
+    }
+    aborted = watch.aborted; // one may have come in while waiting
+    pipeline_print_stats(&pipeline, stderr);
+
+    // cleanup and unload - the plugins may hold lines of a mapped input until they are gone
+    pipeline_destroy(&pipeline);
+    if (!err) line_reader_close(&reader);
+    config_free(&config);
+    free(args);
+    free(paths);
+    free(waits);
 
+    if (aborted) {
+        printf("Pipeline aborted\n");
+        return 128 + aborted;
+    }
+    if (place_err) {
+        printf("Pipeline aborted\n");
+        return 1;
+    }
     printf("Pipeline shutdown complete\n");
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,1112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "executor.h"
+#include "pipeline.h"
+#include "plugins/sync/buffer_pool.h"
+#include "plugins/sync/message.h"
+
+#define PIPELINE_ADAPT_MS 100      // how often the queue sizes are looked at
+#define PIPELINE_ADAPT_MIN 64      // items per worker a queue keeps room for, unless it started smaller
+#define PIPELINE_ADAPT_IDLE 10     // looks without backpressure before room grown earlier is given back
+
+// a queue the adaptive thread resizes
+typedef struct {
+    int stage;                             // index in the pipeline's stages
+    int base;                              // capacity it started with
+    int floor;                             // it is never shrunk below this
+    unsigned long long put_wait_ns;        // its counters at the last look
+    unsigned long long get_wait_ns;
+    int idle;                              // looks in a row without backpressure
+} adapt_queue_t;
+
+// the thread resizing the queues, and what it looks at
+struct pipeline_adapt {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;                   // signaled to stop it
+    int stop;
+    int budget;                            // most items all queues may hold together
+    pipeline_t* pipeline;
+    int count;
+    adapt_queue_t queues[];
+};
+
+// where a link sends what it gets
+typedef struct {
+    int (*place_msgs)(plugin_instance_t*, plugin_msg_t**, int);
+    const char* (*control)(plugin_instance_t*, int);
+    plugin_instance_t* instance;
+} link_target_t;
+
+// a joint between branches, run by the threads of the stages feeding it: it
+// sends every message to several stages, each holding it instead of a copy
+// (fan-out), or takes the output of several stages for one (fan-in), passing
+// the end of the stream on once every one of them has ended
+struct pipeline_link {
+    struct pipeline_link* next;            // the pipeline's links, to free them
+    int inputs;                            // stages feeding it
+    int ended;                             // of those, the ones whose stream ended
+    int count;
+    link_target_t targets[];
+};
+
+// check that the plugin exports the whole instance api
+static int has_instance_api(const plugin_handle_t* p) {
+    return p->instance_init && p->instance_fini && p->instance_place_work && p->instance_place_work_batch &&
+           p->instance_set_batch_size && p->instance_attach && p->instance_wait_finished;
+}
+
+// check that the plugin can be fused into another stage's thread
+static int has_fuse_api(const plugin_handle_t* p) {
+    return p->instance_process && p->instance_fuse && p->instance_get_flags;
+}
+
+// check that the plugin moves messages (v2 abi)
+static int has_msg_api(const plugin_handle_t* p) {
+    return p->instance_place_msgs && p->instance_attach_msgs;
+}
+
+// check that the plugin can be fused through the message api
+static int has_fuse_msg_api(const plugin_handle_t* p) {
+    return p->instance_process_msg && p->instance_fuse_msg;
+}
+
+// check that the plugin takes control tokens
+static int has_control_api(const plugin_handle_t* p) {
+    return p->instance_control && p->instance_attach_control;
+}
+
+// place work into a stage, whichever api drives it
+static const char* stage_place_work(plugin_handle_t* p, const char* str) {
+    return p->instance ? p->instance_place_work(p->instance, str) : p->place_work(str);
+}
+
+// wait for a stage to finish
+static const char* stage_wait_finished(plugin_handle_t* p) {
+    return p->instance ? p->instance_wait_finished(p->instance) : p->wait_finished();
+}
+
+// finalize a stage
+static const char* stage_fini(plugin_handle_t* p) {
+    return p->instance ? p->instance_fini(p->instance) : p->fini();
+}
+
+// try to run stage i in the thread of the group headed by stage head - only
+// works if the plugin turns out to be stateless, otherwise it gets its own queue
+static int stage_fuse(pipeline_t* pl, int head, int i, int queue_size) {
+    plugin_handle_t* p = &pl->stages[i];
+    plugin_config_t config = { queue_size, 1, 1, 1, NULL, 0, p->options, p->option_count };
+
+    if (p->instance_init(&config, &p->instance)) {
+        p->instance = NULL;
+        return 0;
+    }
+    if (!(p->instance_get_flags(p->instance) & PLUGIN_STATELESS)) {
+        p->instance_fini(p->instance);
+        p->instance = NULL;
+        return 0;
+    }
+
+    if (has_fuse_msg_api(&pl->stages[head]) && has_fuse_msg_api(p)) {
+        pl->stages[head].instance_fuse_msg(pl->stages[head].instance, p->instance_process_msg, p->instance);
+    } else {
+        pl->stages[head].instance_fuse(pl->stages[head].instance, p->instance_process, p->instance);
+    }
+    p->fused_into = head;
+    return 1;
+}
+
+// unload the plugins and free the stages
+static void pipeline_unload(pipeline_t* pl) {
+    executor_stop(pl->executor); // its threads run plugin code until they exit
+    pl->executor = NULL;
+    while (pl->links) {
+        struct pipeline_link* next = pl->links->next;
+        free(pl->links);
+        pl->links = next;
+    }
+    for (int i = 0; i < pl->count; i++) {
+        if (pl->stages[i].handle) dlclose(pl->stages[i].handle); // none for the builtin chain
+        free(pl->stages[i].spec);
+        for (int o = 0; o < pl->stages[i].option_count; o++) free(pl->stages[i].options[o]);
+        free(pl->stages[i].options);
+    }
+    free(pl->stages);
+    free(pl->edges);
+    pl->stages = NULL;
+    pl->edges = NULL;
+    pl->count = 0;
+    pl->edge_count = 0;
+}
+
+// the chain compiled into the program, if there is one
+static const pipeline_builtin_t* builtin;
+
+void pipeline_set_builtin(const pipeline_builtin_t* chain) {
+    builtin = chain;
+}
+
+// resolve a function of a stage's plugin - the builtin chain's stage has no handle
+static void* stage_symbol(plugin_handle_t* p, const char* symbol) {
+    return p->handle ? dlsym(p->handle, symbol) : builtin->lookup(symbol);
+}
+
+// check if the stage list is the builtin chain, stage for stage
+static int builtin_matches(char** tokens, int count) {
+    if (!builtin || count == 0) return 0;
+    const char* chain = builtin->chain;
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(tokens[i]);
+        if (strncmp(chain, tokens[i], len) != 0) return 0;
+        chain += len;
+        if (i + 1 < count && *chain++ != '|') return 0;
+    }
+    return *chain == '\0';
+}
+
+// load the plugin of one stage, as the next stage of the pipeline - from
+// the first directory of the search path that has it, or the builtin chain
+static int stage_load(pipeline_t* pl, const char* spec, char** paths, int path_count) {
+    char* endptr;
+    int i = pl->count;
+    plugin_handle_t* p = &pl->stages[i];
+    p->fused_into = -1;
+
+    // split "name:N@C" into the plugin name, its worker count and its queue size
+    char name[256];
+    snprintf(name, sizeof(name), "%s", spec);
+    p->workers = 1;
+    p->queue_size = 0;
+    char* at = strchr(name, '@');
+    if (at) {
+        *at = '\0';
+        long queue_size = strtol(at + 1, &endptr, 10);
+        if (*endptr != '\0' || queue_size <= 0 || queue_size > 0x7fffffffL) {
+            fprintf(stderr, "error- not a valid queue size for %s\n", name);
+            return -1;
+        }
+        p->queue_size = (int)queue_size;
+    }
+    char* colon = strchr(name, ':');
+    if (colon) {
+        *colon = '\0';
+        long workers = strtol(colon + 1, &endptr, 10);
+        if (*endptr != '\0' || workers <= 0) {
+            fprintf(stderr, "error- not a valid worker count for %s\n", name);
+            return -1;
+        }
+        p->workers = (int)workers;
+    }
+
+    char filename[4096];
+    int is_builtin = builtin && strcmp(name, builtin->chain) == 0;
+    int found = is_builtin;
+    if (is_builtin) snprintf(filename, sizeof(filename), "builtin chain %s", name);
+    for (int d = 0; d < path_count && !found; d++) {
+        snprintf(filename, sizeof(filename), "%s/%s.so", paths[d], name); // build so path
+        found = access(filename, F_OK) == 0;
+    }
+    if (!found) snprintf(filename, sizeof(filename), "%s/%s.so", paths[0], name); // dlopen tells why
+
+    p->handle = is_builtin ? NULL : dlopen(filename, RTLD_NOW | RTLD_LOCAL);
+    if (!p->handle && !is_builtin) {
+        fprintf(stderr, "error- failed to load %s: %s\n", filename, dlerror());
+        return -1;
+    }
+    pl->count = i + 1; // unloaded on failure from now on
+    p->spec = strdup(spec);
+    if (!p->spec) {
+        fprintf(stderr, "error- malloc has failed\n");
+        return -1;
+    }
+
+    // resolve the functions of each plugin
+    p->init = stage_symbol(p, "plugin_init");
+    p->fini = stage_symbol(p, "plugin_fini");
+    p->place_work = stage_symbol(p, "plugin_place_work");
+    p->attach = stage_symbol(p, "plugin_attach");
+    p->wait_finished = stage_symbol(p, "plugin_wait_finished");
+    p->get_name = stage_symbol(p, "plugin_get_name");
+    p->get_stats = stage_symbol(p, "plugin_get_stats"); // optional
+
+    // ownership transfer functions are optional (older plugins copy instead)
+    p->place_work_owned = stage_symbol(p, "plugin_place_work_owned");
+    p->attach_owned = stage_symbol(p, "plugin_attach_owned");
+    p->place_work_batch = stage_symbol(p, "plugin_place_work_batch");
+    p->attach_batch = stage_symbol(p, "plugin_attach_batch");
+    p->set_batch_size = stage_symbol(p, "plugin_set_batch_size");
+
+    // instance functions are optional too (older plugins have a single instance)
+    p->instance_init = stage_symbol(p, "plugin_instance_init");
+    p->instance_fini = stage_symbol(p, "plugin_instance_fini");
+    p->instance_place_work = stage_symbol(p, "plugin_instance_place_work");
+    p->instance_place_work_owned = stage_symbol(p, "plugin_instance_place_work_owned");
+    p->instance_place_work_batch = stage_symbol(p, "plugin_instance_place_work_batch");
+    p->instance_set_batch_size = stage_symbol(p, "plugin_instance_set_batch_size");
+    p->instance_set_queue_capacity = stage_symbol(p, "plugin_instance_set_queue_capacity"); // optional
+    p->instance_set_cpus = stage_symbol(p, "plugin_instance_set_cpus"); // optional
+    p->instance_set_wait = stage_symbol(p, "plugin_instance_set_wait"); // optional
+    p->instance_attach = stage_symbol(p, "plugin_instance_attach");
+    p->instance_wait_finished = stage_symbol(p, "plugin_instance_wait_finished");
+    p->instance_get_stats = stage_symbol(p, "plugin_instance_get_stats");
+
+    // and so are the fusion functions
+    p->instance_process = stage_symbol(p, "plugin_instance_process");
+    p->instance_fuse = stage_symbol(p, "plugin_instance_fuse");
+    p->instance_get_flags = stage_symbol(p, "plugin_instance_get_flags");
+
+    // and the message functions
+    p->instance_place_msgs = stage_symbol(p, "plugin_instance_place_msgs");
+    p->instance_attach_msgs = stage_symbol(p, "plugin_instance_attach_msgs");
+    p->instance_process_msg = stage_symbol(p, "plugin_instance_process_msg");
+    p->instance_fuse_msg = stage_symbol(p, "plugin_instance_fuse_msg");
+
+    // and the control functions
+    p->instance_control = stage_symbol(p, "plugin_instance_control");
+    p->instance_attach_control = stage_symbol(p, "plugin_instance_attach_control");
+
+    // check if all functions are resolved
+    if (!p->init || !p->fini || !p->place_work || !p->attach || !p->wait_finished || !p->get_name) {
+        fprintf(stderr, "error- missing function in plugin %s\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+// how the stage list is read - tokens are stage specs, "[", "," and "]"
+typedef struct {
+    pipeline_t* pl;
+    char** tokens;
+    int count;
+    int pos;
+    int edge_capacity;
+    char** paths;           // plugin search path
+    int path_count;
+} topology_parser_t;
+
+// split the words of the stage list around brackets and commas
+static char** topology_tokens(char** words, int count, int* token_count) {
+    size_t chars = 0;
+    for (int i = 0; i < count; i++) chars += strlen(words[i]) + 1;
+    char** tokens = (char**)malloc(sizeof(char*) * (chars + 1)); // never more tokens than characters
+    if (!tokens) return NULL;
+
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        const char* w = words[i];
+        while (*w) {
+            size_t len = strchr("[],", *w) ? 1 : strcspn(w, "[],");
+            tokens[n] = strndup(w, len);
+            if (!tokens[n]) break;
+            n++;
+            w += len;
+        }
+        if (*w) break; // out of memory
+    }
+    *token_count = n;
+    return tokens;
+}
+
+// add a "key=value" setting to a stage
+static int stage_option(plugin_handle_t* p, const char* option) {
+    char** options = (char**)realloc(p->options, sizeof(char*) * (p->option_count + 1));
+    if (!options) {
+        fprintf(stderr, "error- malloc has failed\n");
+        return -1;
+    }
+    p->options = options;
+    p->options[p->option_count] = strdup(option);
+    if (!p->options[p->option_count]) {
+        fprintf(stderr, "error- malloc has failed\n");
+        return -1;
+    }
+    p->option_count++;
+    return 0;
+}
+
+// check the token under the parser
+static int topology_at(topology_parser_t* tp, const char* token) {
+    return tp->pos < tp->count && strcmp(tp->tokens[tp->pos], token) == 0;
+}
+
+// add an edge between two stages
+static int topology_edge(topology_parser_t* tp, int from, int to) {
+    pipeline_t* pl = tp->pl;
+    if (pl->edge_count == tp->edge_capacity) {
+        int capacity = tp->edge_capacity ? tp->edge_capacity * 2 : 16;
+        pipeline_edge_t* edges = (pipeline_edge_t*)realloc(pl->edges, sizeof(pipeline_edge_t) * capacity);
+        if (!edges) {
+            fprintf(stderr, "error- malloc has failed\n");
+            return -1;
+        }
+        pl->edges = edges;
+        tp->edge_capacity = capacity;
+    }
+    pl->edges[pl->edge_count++] = (pipeline_edge_t){ from, to };
+    pl->stages[from].outputs++;
+    pl->stages[to].inputs++;
+    return 0;
+}
+
+static int topology_chain(topology_parser_t* tp, int* heads, int* head_count, int* tails, int* tail_count);
+
+// read one stage, or a group of branches - its heads take its input, its
+// tails give its output
+static int topology_element(topology_parser_t* tp, int* heads, int* head_count, int* tails, int* tail_count) {
+    if (!topology_at(tp, "[")) {
+        if (topology_at(tp, ",") || topology_at(tp, "]") || strchr(tp->tokens[tp->pos], '=')) {
+            fprintf(stderr, "error- unexpected %s in the chain\n", tp->tokens[tp->pos]);
+            return -1;
+        }
+        if (stage_load(tp->pl, tp->tokens[tp->pos++], tp->paths, tp->path_count) != 0) return -1;
+        while (tp->pos < tp->count && strchr(tp->tokens[tp->pos], '=')) { // its settings
+            if (stage_option(&tp->pl->stages[tp->pl->count - 1], tp->tokens[tp->pos++]) != 0) return -1;
+        }
+        heads[0] = tails[0] = tp->pl->count - 1;
+        *head_count = *tail_count = 1;
+        return 0;
+    }
+
+    // a group - its heads and tails are its branches' together
+    tp->pos++;
+    *head_count = *tail_count = 0;
+    while (1) {
+        int branch_heads, branch_tails;
+        if (topology_chain(tp, heads + *head_count, &branch_heads, tails + *tail_count, &branch_tails) != 0) return -1;
+        *head_count += branch_heads;
+        *tail_count += branch_tails;
+        if (topology_at(tp, "]")) {
+            tp->pos++;
+            return 0;
+        }
+        if (!topology_at(tp, ",")) {
+            fprintf(stderr, "error- a group of branches is missing its ]\n");
+            return -1;
+        }
+        tp->pos++;
+    }
+}
+
+// read elements up to the end of a branch - every tail of one feeds every
+// head of the next
+static int topology_chain(topology_parser_t* tp, int* heads, int* head_count, int* tails, int* tail_count) {
+    int* element = (int*)malloc(sizeof(int) * tp->count * 2); // heads, then tails
+    if (!element) {
+        fprintf(stderr, "error- malloc has failed\n");
+        return -1;
+    }
+    int rc = 0;
+    *head_count = *tail_count = 0;
+    while (rc == 0 && tp->pos < tp->count && !topology_at(tp, ",") && !topology_at(tp, "]")) {
+        int element_heads, element_tails;
+        int* element_tail = element + tp->count;
+        rc = topology_element(tp, element, &element_heads, element_tail, &element_tails);
+        if (rc != 0) break;
+        if (*head_count == 0) { // the first element
+            memcpy(heads, element, sizeof(int) * element_heads);
+            *head_count = element_heads;
+        }
+        for (int t = 0; rc == 0 && t < *tail_count; t++) {
+            for (int h = 0; rc == 0 && h < element_heads; h++) rc = topology_edge(tp, tails[t], element[h]);
+        }
+        memcpy(tails, element_tail, sizeof(int) * element_tails);
+        *tail_count = element_tails;
+    }
+    if (rc == 0 && *head_count == 0) {
+        fprintf(stderr, "error- empty branch in the chain\n");
+        rc = -1;
+    }
+    free(element);
+    return rc;
+}
+
+// load every plugin of the chain, and how they feed each other
+int pipeline_load(pipeline_t* pl, char** specs, int count, char** paths, int path_count) {
+    static char* default_paths[] = { PIPELINE_PLUGIN_PATH };
+    if (path_count == 0) {
+        paths = default_paths;
+        path_count = 1;
+    }
+    pl->count = 0;
+    pl->use_instances = 0;
+    pl->adapt = NULL;
+    pl->links = NULL;
+    pl->executor = NULL;
+    pl->edges = NULL;
+    pl->edge_count = 0;
+
+    int token_count = 0;
+    char** tokens = topology_tokens(specs, count, &token_count);
+    pl->stages = (plugin_handle_t*)calloc(token_count ? token_count : 1, sizeof(plugin_handle_t));
+    if (!tokens || !pl->stages) {
+        fprintf(stderr, "error- malloc has failed\n");
+        for (int i = 0; tokens && i < token_count; i++) free(tokens[i]);
+        free(tokens);
+        free(pl->stages);
+        pl->stages = NULL;
+        return -1;
+    }
+
+    topology_parser_t tp = { pl, tokens, token_count, 0, 0, paths, path_count };
+    int heads[1], head_count, tail_count;
+    int* tails = (int*)malloc(sizeof(int) * token_count);
+    int rc = 0;
+    if (token_count == 0 || strcmp(tokens[0], "[") == 0) {
+        fprintf(stderr, "error- the chain must start with a plugin\n");
+        rc = -1;
+    }
+    // the first token is a stage, so the chain has a single head
+    if (rc == 0 && !tails) rc = -1;
+    if (rc == 0 && builtin_matches(tokens, token_count)) {
+        // the whole chain is compiled in - one stage runs it
+        rc = stage_load(pl, builtin->chain, paths, path_count);
+        tp.pos = token_count;
+    } else if (rc == 0) {
+        rc = topology_chain(&tp, heads, &head_count, tails, &tail_count);
+    }
+    if (rc == 0 && tp.pos < token_count) {
+        fprintf(stderr, "error- unexpected %s in the chain\n", tokens[tp.pos]);
+        rc = -1;
+    }
+    free(tails);
+    for (int i = 0; i < token_count; i++) free(tokens[i]);
+    free(tokens);
+    if (rc != 0) {
+        pipeline_unload(pl);
+        return -1;
+    }
+
+    // use instances when every plugin supports them, otherwise each plugin
+    // has one shared context and may only appear once in the chain
+    pl->use_instances = 1;
+    for (int i = 0; i < pl->count; i++) {
+        if (!has_instance_api(&pl->stages[i])) pl->use_instances = 0;
+    }
+    return 0;
+}
+
+// parse a list of wait strategies
+int pipeline_parse_waits(const char* list, int* waits, int max) {
+    static const char* names[] = { "park", "yield", "spin" }; // PLUGIN_WAIT_* order
+    int n = 0;
+    while (list && n < max) {
+        size_t len = strcspn(list, ",");
+        int wait = -1;
+        for (int i = 0; i < 3; i++) {
+            if (strlen(names[i]) == len && strncmp(list, names[i], len) == 0) wait = i;
+        }
+        if (wait < 0) return -1;
+        waits[n++] = wait;
+        if (list[len] == '\0') return n;
+        list += len + 1;
+    }
+    return -1;
+}
+
+// pin every stage that owns threads, a worker at a time in chain order -
+// plugins without the call keep their threads unpinned
+static int pipeline_place(pipeline_t* pl, const pipeline_options_t* options) {
+    int next = 0;
+    for (int i = 0; i < pl->count; i++) {
+        plugin_handle_t* p = &pl->stages[i];
+        if (!p->instance || p->fused_into >= 0 || !p->instance_set_cpus) continue;
+        int cpus[p->workers];
+        for (int j = 0; j < p->workers; j++) cpus[j] = options->cpus[(next + j) % options->cpu_count];
+        next += p->workers;
+        const char* err = p->instance_set_cpus(p->instance, cpus, p->workers);
+        if (err) {
+            fprintf(stderr, "error- failed to pin plugin %s: %s\n", p->get_name(), err);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// monotonic time in nanoseconds
+static unsigned long long adapt_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+// a queue's next capacity, from how long its producer was blocked on it and
+// its workers waited on it since the last look: blocked while the workers
+// also sat idle, the stage keeps up but bursts overflow the queue - double
+// it; blocked while the workers never waited, the stage is the bottleneck
+// and a full queue in front of it only holds memory - halve it. Room grown
+// earlier is given back once the backpressure is gone for a while
+static int adapt_capacity(adapt_queue_t* a, const plugin_stats_t* stats, unsigned long long interval_ns, int workers) {
+    unsigned long long blocked = stats->put_wait_ns - a->put_wait_ns;
+    unsigned long long starved = (stats->get_wait_ns - a->get_wait_ns) / (unsigned long long)workers;
+    a->put_wait_ns = stats->put_wait_ns;
+    a->get_wait_ns = stats->get_wait_ns;
+    int capacity = (int)stats->queue_capacity;
+
+    if (blocked > interval_ns / 20) {
+        a->idle = 0;
+        if (starved > interval_ns / 20) return capacity * 2;
+        if (starved < interval_ns / 100) return capacity / 2 > a->floor ? capacity / 2 : a->floor;
+        return capacity;
+    }
+    if (++a->idle >= PIPELINE_ADAPT_IDLE && capacity > a->base) {
+        a->idle = 0;
+        return capacity / 2 > a->base ? capacity / 2 : a->base;
+    }
+    return capacity;
+}
+
+// look at every queue once - growth comes out of what the budget has left
+static void adapt_step(struct pipeline_adapt* ad, unsigned long long interval_ns) {
+    plugin_stats_t stats[ad->count];
+    int total = 0;
+    for (int i = 0; i < ad->count; i++) {
+        plugin_handle_t* p = &ad->pipeline->stages[ad->queues[i].stage];
+        if (p->instance_get_stats(p->instance, &stats[i])) stats[i].queue_capacity = 0; // not resized this time
+        total += (int)stats[i].queue_capacity;
+    }
+
+    for (int i = 0; i < ad->count; i++) {
+        if (stats[i].queue_capacity == 0) continue;
+        plugin_handle_t* p = &ad->pipeline->stages[ad->queues[i].stage];
+        int capacity = (int)stats[i].queue_capacity;
+        int want = adapt_capacity(&ad->queues[i], &stats[i], interval_ns, p->workers);
+        if (want > capacity && want - capacity > ad->budget - total) want = capacity + (ad->budget > total ? ad->budget - total : 0);
+        if (want == capacity || want <= 0) continue;
+        if (!p->instance_set_queue_capacity(p->instance, want)) total += want - capacity;
+    }
+}
+
+// look at the queues every PIPELINE_ADAPT_MS until stopped
+static void* adapt_thread(void* arg) {
+    struct pipeline_adapt* ad = (struct pipeline_adapt*)arg;
+    unsigned long long last = adapt_now_ns();
+
+    pthread_mutex_lock(&ad->lock);
+    while (!ad->stop) {
+        struct timespec until;
+        clock_gettime(CLOCK_MONOTONIC, &until);
+        until.tv_nsec += PIPELINE_ADAPT_MS * 1000000L;
+        until.tv_sec += until.tv_nsec / 1000000000L;
+        until.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&ad->wake, &ad->lock, &until);
+        if (ad->stop) break;
+        pthread_mutex_unlock(&ad->lock);
+
+        unsigned long long now = adapt_now_ns();
+        adapt_step(ad, now - last);
+        last = now;
+
+        pthread_mutex_lock(&ad->lock);
+    }
+    pthread_mutex_unlock(&ad->lock);
+    return NULL;
+}
+
+// start resizing every queue that can be resized - the stages must fit the budget to begin with
+static int adapt_start(pipeline_t* pl, const pipeline_options_t* options) {
+    int count = 0;
+    int total = 0;
+    for (int i = 0; i < pl->count; i++) {
+        plugin_handle_t* p = &pl->stages[i];
+        if (p->instance && p->fused_into < 0 && p->instance_set_queue_capacity && p->instance_get_stats) count++;
+    }
+    struct pipeline_adapt* ad = (struct pipeline_adapt*)calloc(1, sizeof(struct pipeline_adapt) + sizeof(adapt_queue_t) * count);
+    if (!ad) {
+        fprintf(stderr, "error- malloc has failed\n");
+        return 1;
+    }
+
+    for (int i = 0; i < pl->count; i++) {
+        plugin_handle_t* p = &pl->stages[i];
+        if (!p->instance || p->fused_into >= 0 || !p->instance_set_queue_capacity || !p->instance_get_stats) continue;
+        adapt_queue_t* a = &ad->queues[ad->count++];
+        a->stage = i;
+        a->base = p->queue_size > 0 ? p->queue_size : options->queue_size;
+        a->floor = PIPELINE_ADAPT_MIN * p->workers < a->base ? PIPELINE_ADAPT_MIN * p->workers : a->base;
+        total += a->base;
+    }
+    if (total > options->queue_budget) {
+        fprintf(stderr, "error- queue budget %d is smaller than the queues (%d items)\n", options->queue_budget, total);
+        free(ad);
+        return 1;
+    }
+
+    ad->budget = options->queue_budget;
+    ad->pipeline = pl;
+    pthread_mutex_init(&ad->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ad->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&ad->thread, NULL, adapt_thread, ad) != 0) {
+        fprintf(stderr, "error- failed to start resizing the queues\n");
+        pthread_mutex_destroy(&ad->lock);
+        pthread_cond_destroy(&ad->wake);
+        free(ad);
+        return 1;
+    }
+    pl->adapt = ad;
+    return 0;
+}
+
+// stop resizing the queues
+static void adapt_stop(pipeline_t* pl) {
+    struct pipeline_adapt* ad = pl->adapt;
+    if (!ad) return;
+    pthread_mutex_lock(&ad->lock);
+    ad->stop = 1;
+    pthread_cond_signal(&ad->wake);
+    pthread_mutex_unlock(&ad->lock);
+    pthread_join(ad->thread, NULL);
+    pthread_mutex_destroy(&ad->lock);
+    pthread_cond_destroy(&ad->wake);
+    free(ad);
+    pl->adapt = NULL;
+}
+
+// pass a token on - the end of the stream only once every input has ended
+static const char* link_control(plugin_instance_t* arg, int control) {
+    struct pipeline_link* link = (struct pipeline_link*)arg;
+    if (control == PLUGIN_CONTROL_EOS && __atomic_add_fetch(&link->ended, 1, __ATOMIC_ACQ_REL) < link->inputs) {
+        return NULL; // the others' lines are still on their way
+    }
+    const char* err = NULL;
+    for (int t = 0; t < link->count; t++) {
+        const char* e = link->targets[t].control(link->targets[t].instance, control);
+        if (e) err = e;
+    }
+    return err;
+}
+
+// send messages on to every target - each target holds them, and drops its
+// hold on the ones it does not take. An end message is the end of the stream
+static int link_place_msgs(plugin_instance_t* arg, plugin_msg_t** msgs, int count) {
+    struct pipeline_link* link = (struct pipeline_link*)arg;
+    int n = 0;
+    while (n < count && !(msgs[n]->flags & PLUGIN_MSG_END)) n++;
+
+    for (int i = 0; i < n; i++) {
+        for (int t = 1; t < link->count; t++) message_share(msgs[i]);
+    }
+    for (int t = 0; t < link->count; t++) {
+        int moved = link->targets[t].place_msgs(link->targets[t].instance, msgs, n);
+        for (int i = moved; i < n; i++) message_free(msgs[i]); // the target has finished
+    }
+    if (n < count) {
+        for (int i = n; i < count; i++) message_free(msgs[i]); // nothing follows the end
+        link_control(arg, PLUGIN_CONTROL_EOS);
+    }
+    return count;
+}
+
+// add a link to the pipeline
+static struct pipeline_link* link_new(pipeline_t* pl, int inputs, int count) {
+    struct pipeline_link* link = (struct pipeline_link*)calloc(1, sizeof(struct pipeline_link) + sizeof(link_target_t) * count);
+    if (!link) return NULL;
+    link->inputs = inputs;
+    link->count = count;
+    link->next = pl->links;
+    pl->links = link;
+    return link;
+}
+
+// check that stage i takes only the output of stage i - 1, which feeds
+// nothing else - only then can it run in that stage's thread
+static int stage_follows(const pipeline_t* pl, int i) {
+    if (i == 0 || pl->stages[i].inputs != 1 || pl->stages[i - 1].outputs != 1) return 0;
+    for (int e = 0; e < pl->edge_count; e++) {
+        if (pl->edges[e].to == i) return pl->edges[e].from == i - 1;
+    }
+    return 0;
+}
+
+// the last stage of the group stage i heads (i itself unless stages are fused into it)
+static int stage_tail(const pipeline_t* pl, int i) {
+    int tail = i;
+    while (tail + 1 < pl->count && pl->stages[tail + 1].fused_into == i) tail++;
+    return tail;
+}
+
+// the one stage the group headed by stage i feeds, if it feeds exactly one
+// and nothing else feeds that one - otherwise -1
+static int stage_next(const pipeline_t* pl, int i) {
+    int tail = stage_tail(pl, i);
+    if (pl->stages[tail].outputs != 1) return -1;
+    for (int e = 0; e < pl->edge_count; e++) {
+        if (pl->edges[e].from == tail) return pl->stages[pl->edges[e].to].inputs == 1 ? pl->edges[e].to : -1;
+    }
+    return -1;
+}
+
+// attach the group headed by stage i to the links of a branched chain - a
+// merge where several stages feed one, a fan-out where it feeds several
+static int stage_link(pipeline_t* pl, int i, struct pipeline_link** merges) {
+    plugin_handle_t* p = &pl->stages[i];
+    int tail = stage_tail(pl, i);
+    int count = pl->stages[tail].outputs;
+    struct pipeline_link* link = NULL;
+
+    if (count == 1) { // into a merge
+        for (int e = 0; e < pl->edge_count; e++) {
+            if (pl->edges[e].from == tail) link = merges[pl->edges[e].to];
+        }
+    } else {
+        link = link_new(pl, 1, count);
+        if (!link) return -1;
+        int t = 0;
+        for (int e = 0; e < pl->edge_count; e++) {
+            if (pl->edges[e].from != tail) continue;
+            int to = pl->edges[e].to;
+            if (merges[to]) {
+                link->targets[t++] = (link_target_t){ link_place_msgs, link_control, (plugin_instance_t*)merges[to] };
+            } else {
+                plugin_handle_t* target = &pl->stages[to];
+                link->targets[t++] = (link_target_t){ target->instance_place_msgs, target->instance_control, target->instance };
+            }
+        }
+    }
+    p->instance_attach_msgs(p->instance, link_place_msgs, (plugin_instance_t*)link);
+    p->instance_attach_control(p->instance, link_control);
+    return 0;
+}
+
+// finalize the first count stages - fused ones only once the stage running
+// them is, and before any plugin is unloaded
+static void stages_fini(pipeline_t* pl, int count) {
+    executor_stop(pl->executor); // no stage's turn may run while it is finalized
+    pl->executor = NULL;
+    for (int i = 0; i < count; i++) {
+        if (pl->stages[i].fused_into < 0 && (pl->stages[i].instance || !pl->use_instances)) stage_fini(&pl->stages[i]);
+    }
+    for (int i = 0; i < count; i++) {
+        if (pl->stages[i].fused_into >= 0) stage_fini(&pl->stages[i]);
+    }
+}
+
+// undo a start that failed part way - abort the first count stages, which
+// were initialized and may be running, finalize them and unload the plugins.
+// A stage without the control api is ended with an end marker instead
+static int pipeline_start_failed(pipeline_t* pl, int count, int rc) {
+    for (int i = 0; i < count; i++) {
+        plugin_handle_t* p = &pl->stages[i];
+        if (p->fused_into >= 0 || (pl->use_instances && !p->instance)) continue;
+        if (p->instance && has_control_api(p)) {
+            p->instance_control(p->instance, PLUGIN_CONTROL_ABORT);
+        } else {
+            stage_place_work(p, "<END>"); // may have been passed on already, then it is refused
+        }
+    }
+    stages_fini(pl, count);
+    pipeline_unload(pl);
+    return rc;
+}
+
+// initialize, fuse and attach the stages
+int pipeline_start(pipeline_t* pl, const pipeline_options_t* options) {
+    plugin_handle_t* plugins = pl->stages;
+
+    for (int i = 0; !pl->use_instances && i < pl->count; i++) {
+        if (plugins[i].workers > 1) {
+            fprintf(stderr, "error- plugin %s does not support several workers\n", plugins[i].get_name());
+            return pipeline_start_failed(pl, 0, 1);
+        }
+        if (plugins[i].option_count > 0) {
+            fprintf(stderr, "error- plugin %s takes no settings, it has no instance api\n", plugins[i].get_name());
+            return pipeline_start_failed(pl, 0, 1);
+        }
+        for (int j = 0; j < i; j++) {
+            if (plugins[j].handle == plugins[i].handle) {
+                fprintf(stderr, "error- plugin %s appears twice but does not support multiple instances\n", plugins[i].spec);
+                return pipeline_start_failed(pl, 0, 1);
+            }
+        }
+    }
+    for (int i = 0; options->sink && i < pl->count; i++) {
+        if (!pl->use_instances || !has_msg_api(&plugins[i])) { // any of them may end up feeding it
+            fprintf(stderr, "error- a sink needs plugins with the message api\n");
+            return pipeline_start_failed(pl, 0, 1);
+        }
+    }
+
+    // branches are joined by links, which move messages and tokens
+    int branched = 0, ends = 0;
+    for (int i = 0; i < pl->count; i++) {
+        if (plugins[i].inputs > 1 || plugins[i].outputs > 1) branched = 1;
+        if (plugins[i].outputs == 0) ends++;
+    }
+    if (options->sink && ends > 1) {
+        fprintf(stderr, "error- a sink takes the lines of one stage, merge the branches first\n");
+        return pipeline_start_failed(pl, 0, 1);
+    }
+    for (int i = 0; branched && i < pl->count; i++) {
+        if (!pl->use_instances || !has_msg_api(&plugins[i]) || !has_control_api(&plugins[i])) {
+            fprintf(stderr, "error- plugin %s cannot be used in branches, it has no message and control api\n",
+                    plugins[i].spec);
+            return pipeline_start_failed(pl, 0, 1);
+        }
+    }
+
+    // the pool, pinned where the stages' threads would have been
+    if (options->pool > 0 && pl->use_instances) {
+        pl->executor = executor_start(options->pool, options->cpus, options->cpu_count);
+        if (!pl->executor) {
+            fprintf(stderr, "error- failed to start the pool\n");
+            return pipeline_start_failed(pl, 0, 1);
+        }
+    }
+
+    // initialaize the plugins - with fusion, a single worker stateless stage
+    // that follows another one runs in that stage's thread instead of its own
+    int head = -1; // stage heading the current fused group
+    for (int i = 0; i < pl->count; i++) {
+        if (options->fuse && pl->use_instances && head >= 0 && stage_follows(pl, i) && plugins[i].workers == 1 &&
+            has_fuse_api(&plugins[i]) && stage_fuse(pl, head, i, options->queue_size)) {
+            continue;
+        }
+
+        int queue_size = plugins[i].queue_size > 0 ? plugins[i].queue_size : options->queue_size;
+        plugin_config_t config = { queue_size, plugins[i].workers, 0, plugins[i].inputs, pl->executor, i,
+                                   plugins[i].options, plugins[i].option_count };
+        const char* err = pl->use_instances ? plugins[i].instance_init(&config, &plugins[i].instance)
+                                            : plugins[i].init(queue_size);
+        // if a plugin fails to initialize, print error and clean
+        if (err) {
+            fprintf(stderr, "error- failed to init plugin %s: %s\n", plugins[i].get_name(), err);
+            return pipeline_start_failed(pl, i, 2);
+        }
+
+        // apply the batch size where the plugin supports batching
+        if (options->batch_size > 0 && plugins[i].instance) {
+            err = plugins[i].instance_set_batch_size(plugins[i].instance, options->batch_size);
+        } else if (options->batch_size > 0 && plugins[i].set_batch_size) {
+            err = plugins[i].set_batch_size(options->batch_size);
+        }
+        if (err) {
+            fprintf(stderr, "error- failed to set batch size for %s: %s\n", plugins[i].get_name(), err);
+            return pipeline_start_failed(pl, i + 1, 1);
+        }
+
+        // a stage can head a fused group if it is stateless and runs one worker
+        int can_head = options->fuse && plugins[i].instance && plugins[i].workers == 1 && has_fuse_api(&plugins[i]) &&
+                       (plugins[i].instance_get_flags(plugins[i].instance) & PLUGIN_STATELESS);
+        head = can_head ? i : -1;
+    }
+
+    // a stage several branches merge into is fed through a link
+    struct pipeline_link* merges[pl->count];
+    for (int i = 0; i < pl->count; i++) {
+        merges[i] = NULL;
+        if (plugins[i].inputs <= 1) continue;
+        merges[i] = link_new(pl, plugins[i].inputs, 1);
+        if (!merges[i]) {
+            fprintf(stderr, "error- malloc has failed\n");
+            return pipeline_start_failed(pl, pl->count, 1);
+        }
+        merges[i]->targets[0] = (link_target_t){ plugins[i].instance_place_msgs, plugins[i].instance_control, plugins[i].instance };
+    }
+
+    // attach each stage that owns a queue to the next one, moving batches or
+    // single buffers between stages when both sides support it
+    for (int i = 0; i < pl->count; i++) {
+        if (plugins[i].fused_into >= 0) continue;
+        int tail = stage_tail(pl, i);
+        int next = stage_next(pl, i);
+        if (plugins[tail].outputs > 0 && next < 0) { // it branches, or merges into another
+            if (stage_link(pl, i, merges) != 0) {
+                fprintf(stderr, "error- malloc has failed\n");
+                return pipeline_start_failed(pl, pl->count, 1);
+            }
+            continue;
+        }
+
+        if (next < 0) {
+            if (options->sink) plugins[i].instance_attach_msgs(plugins[i].instance, options->sink, options->sink_arg);
+        } else if (pl->use_instances && has_msg_api(&plugins[i]) && has_msg_api(&plugins[next])) {
+            plugins[i].instance_attach_msgs(plugins[i].instance, plugins[next].instance_place_msgs, plugins[next].instance);
+        } else if (pl->use_instances) {
+            plugins[i].instance_attach(plugins[i].instance, plugins[next].instance_place_work_batch, plugins[next].instance);
+        } else if (plugins[i].attach_batch && plugins[next].place_work_batch) {
+            plugins[i].attach_batch(plugins[next].place_work_batch);
+        } else if (plugins[i].attach_owned && plugins[next].place_work_owned) {
+            plugins[i].attach_owned(plugins[next].place_work_owned);
+        } else {
+            plugins[i].attach(plugins[next].place_work);
+        }
+
+        // tokens go beside the items when both sides take them, otherwise
+        // only the end of stream is passed on, in band
+        if (next >= 0 && pl->use_instances && has_control_api(&plugins[i]) && has_control_api(&plugins[next])) {
+            plugins[i].instance_attach_control(plugins[i].instance, plugins[next].instance_control);
+        }
+    }
+    if (options->cpu_count > 0 && !pl->executor && pipeline_place(pl, options) != 0) {
+        return pipeline_start_failed(pl, pl->count, 1);
+    }
+
+    // wait strategies - one for every queue, or one per stage
+    for (int i = 0; options->wait_count > 0 && i < pl->count; i++) {
+        plugin_handle_t* p = &plugins[i];
+        if (!p->instance || p->fused_into >= 0 || !p->instance_set_wait) continue;
+        const char* err = p->instance_set_wait(p->instance, options->waits[options->wait_count == 1 ? 0 : i]);
+        if (err) {
+            fprintf(stderr, "error- failed to set the wait strategy of %s: %s\n", p->get_name(), err);
+            return pipeline_start_failed(pl, pl->count, 1);
+        }
+    }
+    if (options->queue_budget > 0 && adapt_start(pl, options) != 0) return pipeline_start_failed(pl, pl->count, 1);
+    return 0;
+}
+
+// place work into the first stage
+const char* pipeline_place_work(pipeline_t* pl, const char* str) {
+    return stage_place_work(&pl->stages[0], str);
+}
+
+// place a line into the first stage, moving the copy when the stage takes buffers
+const char* pipeline_place_line(pipeline_t* pl, const char* line, size_t len) {
+    plugin_handle_t* p = &pl->stages[0];
+    if (p->instance && has_msg_api(p)) {
+        plugin_msg_t* msg = message_from(line, len);
+        if (!msg) return "malloc has failed";
+        if (p->instance_place_msgs(p->instance, &msg, 1) == 1) return NULL;
+        message_free(msg);
+        return "queue finished";
+    }
+
+    char* copy = buffer_pool_strndup(line, len);
+    if (!copy) return "malloc has failed";
+
+    const char* err;
+    if (p->instance && p->instance_place_work_owned) {
+        err = p->instance_place_work_owned(p->instance, copy);
+    } else if (!p->instance && p->place_work_owned) {
+        err = p->place_work_owned(copy);
+    } else {
+        err = stage_place_work(p, copy); // the stage keeps its own copy
+        buffer_pool_free(copy);
+        return err;
+    }
+    if (err) buffer_pool_free(copy); // not taken
+    return err;
+}
+
+// place a line the host keeps - only its message is allocated
+const char* pipeline_place_borrowed(pipeline_t* pl, const char* line, size_t len) {
+    plugin_handle_t* p = &pl->stages[0];
+    if (!p->instance || !has_msg_api(p)) return pipeline_place_line(pl, line, len);
+    plugin_msg_t* msg = message_borrow(line, len);
+    if (!msg) return "malloc has failed";
+    if (p->instance_place_msgs(p->instance, &msg, 1) == 1) return NULL;
+    message_free(msg);
+    return "queue finished";
+}
+
+// signal the end of the input - as a token when the stage takes them, else
+// as an end message or the v1 "<END>" string
+const char* pipeline_place_end(pipeline_t* pl) {
+    plugin_handle_t* p = &pl->stages[0];
+    if (p->instance && has_control_api(p)) return p->instance_control(p->instance, PLUGIN_CONTROL_EOS);
+    if (p->instance && has_msg_api(p)) {
+        plugin_msg_t* msg = message_end();
+        if (!msg) return "malloc has failed";
+        if (p->instance_place_msgs(p->instance, &msg, 1) == 1) return NULL;
+        message_free(msg);
+        return "queue finished";
+    }
+    return stage_place_work(p, MESSAGE_END_STRING);
+}
+
+// flush the first stage, which passes it on
+const char* pipeline_flush(pipeline_t* pl) {
+    plugin_handle_t* p = &pl->stages[0];
+    if (!p->instance || !has_control_api(p)) return "stage has no control api";
+    return p->instance_control(p->instance, PLUGIN_CONTROL_FLUSH);
+}
+
+// abort every stage that owns a queue directly, so none waits for the one
+// before it to notice
+const char* pipeline_abort(pipeline_t* pl) {
+    const char* err = NULL;
+    for (int i = 0; i < pl->count; i++) {
+        plugin_handle_t* p = &pl->stages[i];
+        if (p->fused_into >= 0) continue;
+        if (!p->instance || !has_control_api(p)) {
+            err = "stage has no control api";
+            continue;
+        }
+        const char* e = p->instance_control(p->instance, PLUGIN_CONTROL_ABORT);
+        if (e) err = e;
+    }
+    return err;
+}
+
+// wait for all plugins to finish
+void pipeline_wait_finished(pipeline_t* pl) {
+    for (int i = 0; i < pl->count; i++) {
+        stage_wait_finished(&pl->stages[i]);
+    }
+    adapt_stop(pl);
+}
+
+// read a stage's counters, whichever api drives it
+static const char* stage_get_stats(plugin_handle_t* p, plugin_stats_t* stats) {
+    if (p->instance) return p->instance_get_stats ? p->instance_get_stats(p->instance, stats) : "no stats";
+    return p->get_stats ? p->get_stats(stats) : "no stats";
+}
+
+// print every stage's counters - the time a stage was blocked forwarding is
+// the time its producer side waited on the next stage's queue
+void pipeline_print_stats(pipeline_t* pl, FILE* out) {
+    plugin_stats_t stats[pl->count];
+    int have[pl->count];
+    for (int i = 0; i < pl->count; i++) {
+        have[i] = stage_get_stats(&pl->stages[i], &stats[i]) == NULL;
+    }
+
+    fprintf(out, "%-16s %12s %12s %14s %11s %11s %11s %15s\n", "stage", "items in", "items out", "bytes in",
+            "process ms", "put wait ms", "get wait ms", "queue hwm/cap");
+    for (int i = 0; i < pl->count; i++) {
+        plugin_handle_t* p = &pl->stages[i];
+        if (!have[i]) {
+            fprintf(out, "%-16s %12s\n", p->spec, "n/a");
+            continue;
+        }
+        if (p->fused_into >= 0) { // its time and waits are its group head's
+            fprintf(out, "%-16s %12llu %12llu %14llu %11s %11s %11s %15s\n", p->spec, stats[i].items_in,
+                    stats[i].items_out, stats[i].bytes_in, "-", "-", "-", "fused");
+            continue;
+        }
+
+        // a stage feeding several, or a merge, shares the queue it waits on
+        char put_wait[32] = "-";
+        int next = stage_next(pl, i);
+        if (pl->stages[stage_tail(pl, i)].outputs == 0) {
+            snprintf(put_wait, sizeof(put_wait), "%.1f", 0.0);
+        } else if (next >= 0 && have[next]) {
+            snprintf(put_wait, sizeof(put_wait), "%.1f", stats[next].put_wait_ns / 1e6);
+        }
+
+        char queue[32];
+        snprintf(queue, sizeof(queue), "%llu/%llu", stats[i].queue_high_water, stats[i].queue_capacity);
+        fprintf(out, "%-16s %12llu %12llu %14llu %11.1f %11s %11.1f %15s\n", p->spec, stats[i].items_in,
+                stats[i].items_out, stats[i].bytes_in, stats[i].process_ns / 1e6, put_wait,
+                stats[i].get_wait_ns / 1e6, queue);
+    }
+    if (pl->count > 0 && have[0]) {
+        fprintf(out, "input blocked on the first stage: %.1f ms\n", stats[0].put_wait_ns / 1e6);
+    }
+    fflush(out);
+}
+
+// cleanup and unload
+void pipeline_destroy(pipeline_t* pl) {
+    adapt_stop(pl);
+    stages_fini(pl, pl->count);
+    pipeline_unload(pl);
+}
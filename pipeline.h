@@ -0,0 +1,223 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "plugins/plugin_sdk.h"
+
+/**
+ * Loading, wiring and running a chain of plugins - shared by the analyzer
+ * and the benchmark driver. The chain may branch: a stage can send its
+ * output down several branches, and branches can merge into one stage.
+ */
+
+// One stage of the chain and the plugin functions that drive it
+typedef struct {
+    const char* (*init)(int);
+    const char* (*fini)(void);
+    const char* (*place_work)(const char*);
+    const char* (*place_work_owned)(char*);           // optional, moves instead of copying
+    void (*attach)(const char* (*)(const char*));
+    void (*attach_owned)(const char* (*)(char*));     // optional, pairs with place_work_owned
+    int (*place_work_batch)(char**, int);             // optional, moves a batch
+    void (*attach_batch)(int (*)(char**, int));       // optional, pairs with place_work_batch
+    const char* (*set_batch_size)(int);               // optional
+    const char* (*wait_finished)(void);
+    const char* (*get_name)(void);
+    const char* (*get_stats)(plugin_stats_t*);        // optional
+
+    // instance api - optional, lets one plugin appear several times in the chain
+    const char* (*instance_init)(const plugin_config_t*, plugin_instance_t**);
+    const char* (*instance_fini)(plugin_instance_t*);
+    const char* (*instance_place_work)(plugin_instance_t*, const char*);
+    const char* (*instance_place_work_owned)(plugin_instance_t*, char*);
+    int (*instance_place_work_batch)(plugin_instance_t*, char**, int);
+    const char* (*instance_set_batch_size)(plugin_instance_t*, int);
+    const char* (*instance_set_queue_capacity)(plugin_instance_t*, int);  // optional, resizes a running queue
+    const char* (*instance_set_cpus)(plugin_instance_t*, const int*, int); // optional, pins the threads
+    const char* (*instance_set_wait)(plugin_instance_t*, int);             // optional, PLUGIN_WAIT_*
+    void (*instance_attach)(plugin_instance_t*, int (*)(plugin_instance_t*, char**, int), plugin_instance_t*);
+    const char* (*instance_wait_finished)(plugin_instance_t*);
+    const char* (*instance_get_stats)(plugin_instance_t*, plugin_stats_t*);  // optional
+
+    // fusion api - optional, runs stateless stages inside the previous stage's thread
+    char* (*instance_process)(plugin_instance_t*, char*);
+    void (*instance_fuse)(plugin_instance_t*, char* (*)(plugin_instance_t*, char*), plugin_instance_t*);
+    int (*instance_get_flags)(plugin_instance_t*);
+
+    // message api (v2) - optional, moves length-prefixed messages instead of strings
+    int (*instance_place_msgs)(plugin_instance_t*, plugin_msg_t**, int);
+    void (*instance_attach_msgs)(plugin_instance_t*, int (*)(plugin_instance_t*, plugin_msg_t**, int), plugin_instance_t*);
+    plugin_msg_t* (*instance_process_msg)(plugin_instance_t*, plugin_msg_t*);
+    void (*instance_fuse_msg)(plugin_instance_t*, plugin_msg_t* (*)(plugin_instance_t*, plugin_msg_t*), plugin_instance_t*);
+
+    // control api - optional, end of stream, flush and abort travel beside the items
+    const char* (*instance_control)(plugin_instance_t*, int);
+    void (*instance_attach_control)(plugin_instance_t*, const char* (*)(plugin_instance_t*, int));
+
+    plugin_instance_t* instance;                      // NULL when driving the plugin's single instance
+    int workers;                                      // threads running this stage ("name:N")
+    int queue_size;                                   // its queue's capacity ("name@N"), 0 for the pipeline's
+    int fused_into;                                   // index of the stage whose thread runs this one, or -1
+    int inputs;                                       // stages feeding this one (0 for the first)
+    int outputs;                                      // stages it feeds (0 at the end of a branch)
+    char* spec;                                       // stage as given on the command line
+    char** options;                                   // "key=value" settings after it, for its plugin
+    int option_count;
+
+    void* handle;
+} plugin_handle_t;
+
+// How to build and run the chain
+typedef struct {
+    int queue_size;                                   // Maximum number of items in each stage's queue
+    int batch_size;                                   // Items per wakeup, 0 keeps the plugins' default
+    int fuse;                                         // Run consecutive stateless stages in one thread
+    int (*sink)(plugin_instance_t*, plugin_msg_t**, int); // Optional consumer fed by the last stage (message api only),
+                                                      // returns how many it kept - free those with message_free
+    plugin_instance_t* sink_arg;                      // First argument passed to sink
+    int queue_budget;                                 // Resize the queues while running, keeping their capacities
+                                                      // within this many items in total (0 keeps them fixed)
+    const int* cpus;                                  // Cpus to pin the stages' threads to, handed out in chain order
+    int cpu_count;                                    // Entries in cpus, 0 leaves the threads to the scheduler
+    const int* waits;                                 // PLUGIN_WAIT_* of the stages' queues, one for all or one per stage
+    int wait_count;                                   // Entries in waits, 0 keeps the default
+    int pool;                                         // Threads running the single worker stages as tasks (see
+                                                      // executor.h), 0 for a thread per stage
+} pipeline_options_t;
+
+// One stage feeding another
+typedef struct {
+    int from;
+    int to;
+} pipeline_edge_t;
+
+// A loaded chain of stages
+typedef struct {
+    plugin_handle_t* stages;                          // in the order given, the first takes the input
+    int count;
+    pipeline_edge_t* edges;
+    int edge_count;
+    int use_instances;                                // every plugin has the instance api
+    struct pipeline_adapt* adapt;                     // thread resizing the queues, NULL when they keep their size
+    struct pipeline_link* links;                      // joints of the branches, NULL for a straight chain
+    plugin_executor_t* executor;                      // pool running the stages, NULL when each has its threads
+} pipeline_t;
+
+#define PIPELINE_PLUGIN_PATH "output/plugins"       // where plugins are searched when no path is given
+
+// A chain of plugins compiled into the program (see static_chain.h), which
+// stands in for the stages it names
+typedef struct {
+    const char* chain;                                // the stage names, "a|b|c"
+    void* (*lookup)(const char* symbol);              // its plugin functions, by the names dlsym takes
+} pipeline_builtin_t;
+
+/**
+ * Give pipeline_load a builtin chain: a chain of exactly its stages (plain
+ * names, no workers, queue sizes or branches) then loads as one stage
+ * running them all, with no plugin to open
+ * @param builtin The chain (NULL for none)
+ */
+void pipeline_set_builtin(const pipeline_builtin_t* builtin);
+
+/**
+ * Load the plugins named by specs ("name", "name:N" for N workers, and
+ * "@C" after either for a queue of C items instead of the pipeline's);
+ * "key=value" words after a stage are settings for its plugin.
+ * Each stage feeds the next. "[ a b , c ]" is a group of branches: the
+ * stage before it feeds the first stage of every branch (each gets every
+ * line, shared rather than copied), and the end of every branch feeds the
+ * stage after it. Groups nest; the chain starts with a stage, and brackets
+ * and commas may be written apart or attached to the names.
+ * Every plugin is resolved once, here: "name" is name.so in the first
+ * directory of paths that has it, unless the chain is the builtin one
+ * Prints the reason to stderr on failure
+ * @param paths Plugin search path, in order (NULL with 0 for PIPELINE_PLUGIN_PATH)
+ * @return 0 on success, -1 on failure
+ */
+int pipeline_load(pipeline_t* pipeline, char** specs, int count, char** paths, int path_count);
+
+/**
+ * Parse a list of wait strategies, "park", "yield" or "spin" separated by commas
+ * @param list The list
+ * @param waits Receives the PLUGIN_WAIT_* values
+ * @param max Capacity of waits
+ * @return Number of entries, or -1 if the list is not valid or too long
+ */
+int pipeline_parse_waits(const char* list, int* waits, int max);
+
+/**
+ * Initialize every stage, fuse and attach them - with cpus, each stage's
+ * workers are pinned to the next entries of the list (wrapping around), so
+ * neighbouring stages share the caches neighbouring entries share; with a queue budget, a
+ * thread then grows the queues that overflow in bursts and shrinks the ones
+ * in front of a bottleneck (see pipeline.c); with a pool, the stages without
+ * ticks or extra workers run on its threads, and cpus pins those instead
+ * Prints the reason to stderr on failure, after stopping and finalizing the
+ * stages started so far and unloading the plugins
+ * @return 0 on success, 1 on invalid setup, 2 if a plugin failed to initialize
+ */
+int pipeline_start(pipeline_t* pipeline, const pipeline_options_t* options);
+
+/**
+ * Place work (a string, copied) into the first stage
+ * @return NULL on success, error message on failure
+ */
+const char* pipeline_place_work(pipeline_t* pipeline, const char* str);
+
+/**
+ * Place a line (len bytes, need not be NUL-terminated) into the first stage,
+ * copying it once into a buffer the stage takes over
+ * @return NULL on success, error message on failure
+ */
+const char* pipeline_place_line(pipeline_t* pipeline, const char* line, size_t len);
+
+/**
+ * Place a line without copying it - the stages read it where it is, and the
+ * first one that changes it takes a copy. Without the message api in the
+ * first stage it is copied as by pipeline_place_line
+ * @param line The line, unchanged and readable until pipeline_destroy
+ * @return NULL on success, error message on failure
+ */
+const char* pipeline_place_borrowed(pipeline_t* pipeline, const char* line, size_t len);
+
+/**
+ * Signal the end of the input to the first stage (it passes it on) - every
+ * line placed before it is processed first
+ * @return NULL on success, error message on failure
+ */
+const char* pipeline_place_end(pipeline_t* pipeline);
+
+/**
+ * Ask the first stage to pass on everything placed so far, ahead of anything
+ * placed later - only from the thread placing lines
+ * @return NULL on success, error message if a stage has no control api
+ */
+const char* pipeline_flush(pipeline_t* pipeline);
+
+/**
+ * Stop every stage at once, dropping the lines still queued - safe from any
+ * thread; pipeline_wait_finished then returns without waiting for a drain
+ * @return NULL on success, error message if a stage has no control api
+ */
+const char* pipeline_abort(pipeline_t* pipeline);
+
+/**
+ * Wait until every stage has finished, then stop resizing the queues
+ */
+void pipeline_wait_finished(pipeline_t* pipeline);
+
+/**
+ * Print a table of every stage's counters - reads them without locks, so it
+ * may run in any thread while the pipeline runs (not after pipeline_destroy)
+ * @param out Where to print
+ */
+void pipeline_print_stats(pipeline_t* pipeline, FILE* out);
+
+/**
+ * Finalize every stage, unload the plugins and free the pipeline's memory
+ */
+void pipeline_destroy(pipeline_t* pipeline);
+
+#endif
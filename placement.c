@@ -0,0 +1,109 @@
+#define _GNU_SOURCE
+#include "placement.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// where a cpu sits - cpus with the same values share that level
+typedef struct {
+    int cpu;
+    int package;
+    int l3;                 // first cpu sharing the cache, -1 if unknown
+    int l2;
+} cpu_place_t;
+
+// parse a cpu list
+int placement_parse(const char* list, int* cpus, int max) {
+    char* end;
+    int n = 0;
+    if (!list || !*list) return -1;
+
+    while (1) {
+        long first = strtol(list, &end, 10);
+        if (end == list || first < 0 || first >= PLACEMENT_MAX_CPUS) return -1;
+        long last = first;
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list || last < first || last >= PLACEMENT_MAX_CPUS) return -1;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (n == max) return -1;
+            cpus[n++] = (int)cpu;
+        }
+        if (*end == '\0') return n;
+        if (*end != ',') return -1;
+        list = end + 1;
+    }
+}
+
+// check the affinity mask
+int placement_allowed(int cpu) {
+    cpu_set_t set;
+    if (cpu < 0 || cpu >= CPU_SETSIZE) return 0;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return 0;
+    return CPU_ISSET(cpu, &set);
+}
+
+// read a small sysfs file of a cpu
+static int read_cpu_file(int cpu, const char* file, char* buf, size_t size) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, file);
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+    int ok = fgets(buf, (int)size, f) != NULL;
+    fclose(f);
+    if (!ok) return -1;
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+// the first cpu sharing the cpu's cache of a level, -1 if the system does not say
+static int cache_group(int cpu, int level) {
+    char buf[4096];
+    for (int index = 0; index < 8; index++) {
+        char file[64];
+        snprintf(file, sizeof(file), "cache/index%d/level", index);
+        if (read_cpu_file(cpu, file, buf, sizeof(buf)) != 0) break;
+        if (atoi(buf) != level) continue;
+        snprintf(file, sizeof(file), "cache/index%d/shared_cpu_list", index);
+        int shared[PLACEMENT_MAX_CPUS];
+        if (read_cpu_file(cpu, file, buf, sizeof(buf)) != 0) return -1;
+        return placement_parse(buf, shared, PLACEMENT_MAX_CPUS) > 0 ? shared[0] : -1;
+    }
+    return -1;
+}
+
+// order by package, last level cache, L2, then cpu number
+static int compare_place(const void* a, const void* b) {
+    const cpu_place_t* x = (const cpu_place_t*)a;
+    const cpu_place_t* y = (const cpu_place_t*)b;
+    if (x->package != y->package) return x->package < y->package ? -1 : 1;
+    if (x->l3 != y->l3) return x->l3 < y->l3 ? -1 : 1;
+    if (x->l2 != y->l2) return x->l2 < y->l2 ? -1 : 1;
+    return x->cpu < y->cpu ? -1 : x->cpu > y->cpu;
+}
+
+// list the allowed cpus, neighbours in cache first
+int placement_auto(int* cpus, int max) {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return 0;
+
+    cpu_place_t* places = (cpu_place_t*)malloc(sizeof(cpu_place_t) * CPU_SETSIZE);
+    if (!places) return 0;
+    int n = 0;
+    char buf[64];
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < max; cpu++) {
+        if (!CPU_ISSET(cpu, &set)) continue;
+        cpu_place_t* p = &places[n++];
+        p->cpu = cpu;
+        p->package = read_cpu_file(cpu, "topology/physical_package_id", buf, sizeof(buf)) == 0 ? atoi(buf) : 0;
+        p->l3 = cache_group(cpu, 3);
+        p->l2 = cache_group(cpu, 2);
+    }
+    qsort(places, (size_t)n, sizeof(cpu_place_t), compare_place);
+    for (int i = 0; i < n; i++) cpus[i] = places[i].cpu;
+    free(places);
+    return n;
+}
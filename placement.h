@@ -0,0 +1,38 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+/**
+ * Choosing the cpus the stages' threads are pinned to
+ * The pipeline hands out the cpus in chain order, a worker at a time, so
+ * neighbouring stages get neighbouring entries of the list
+ */
+
+#define PLACEMENT_MAX_CPUS 1024        // most cpus a list may name
+
+/**
+ * Parse a cpu list such as "0,2,4-7", as the kernel prints them
+ * @param list The list
+ * @param cpus Receives the cpus, in the order given
+ * @param max Capacity of cpus
+ * @return Number of cpus, or -1 if the list is not valid or too long
+ */
+int placement_parse(const char* list, int* cpus, int max);
+
+/**
+ * Check that the process may run on a cpu (it is in the affinity mask)
+ * @param cpu The cpu
+ * @return 1 if it may, 0 otherwise
+ */
+int placement_allowed(int cpu);
+
+/**
+ * List the cpus the process may run on, ordered so that cpus sharing caches
+ * are next to each other: by package, then last level cache, then L2 (so
+ * SMT siblings come in pairs)
+ * @param cpus Receives the cpus
+ * @param max Capacity of cpus
+ * @return Number of cpus, 0 if none could be found
+ */
+int placement_auto(int* cpus, int max);
+
+#endif
@@ -1,27 +1,20 @@
 #include "plugin_common.h"
-#include <stdlib.h>
-#include <string.h>
+#include "simd/text_kernels.h"
 
-// add spaces between characters in the input string
-static const char* plugin_transform(const char* input) {
-    if (input) {
-        size_t len = strlen(input);
-        if (len > 0) {
-            char* out = malloc(len * 2); // space for chars + spaces
-            if (out) {
-                size_t idx = 0;
-                for (size_t i = 0; i < len; i++) {
-                    out[idx++] = input[i];
-                    if (i < len - 1) {
-                        out[idx++] = ' '; // add space
-                    }
-                }
-                out[idx] = '\0';
-                return out;
-            }
-        }
-    }
-    return NULL;
+// add spaces between characters in the message - an empty one is dropped
+static plugin_msg_t* plugin_transform(plugin_msg_t* msg) {
+    size_t len = msg->len;
+    if (len == 0) return NULL;
+
+    char* out = plugin_alloc_output(len * 2); // space for chars + spaces
+    if (!out) return NULL;
+    text_kernels->expand(out, msg->data, len);
+
+    // the stage frees the old payload
+    msg->data = out;
+    msg->len = len * 2 - 1;
+    msg->capacity = len * 2 - 1;
+    return msg;
 }
 
 const char* plugin_get_name(void) {
@@ -29,5 +22,5 @@ const char* plugin_get_name(void) {
 }
 
 const char* plugin_init(int queue_size) {
-    return common_plugin_init(plugin_transform, "expander", queue_size);
+    return common_plugin_init_msg(plugin_transform, "expander", queue_size, PLUGIN_STATELESS);
 }
\ No newline at end of file
@@ -1,25 +1,11 @@
 #include "plugin_common.h"
-#include <stdlib.h>
-#include <string.h>
+#include "simd/text_kernels.h"
 
-//reverse tjhe input string
-static const char* plugin_transform(const char* input) {
-
-    // check if input is valid allocating memory for output
-    if (input) {
-        size_t len = strlen(input);
-        char* out = malloc(len + 1);
-        if (out) {
-
-            // reverse the string
-            for (size_t i = 0; i < len; i++) {
-                out[i] = input[len - i - 1]; 
-            }
-            out[len] = '\0'; // adding null terminator
-            return out;
-        }
-    }
-    return NULL;
+//reverse tjhe message in place
+static plugin_msg_t* plugin_transform(plugin_msg_t* msg) {
+    // reverse the string by swapping blocks from both ends
+    text_kernels->reverse(msg->data, msg->len);
+    return msg;
 }
 
 const char* plugin_get_name(void) {
@@ -27,5 +13,5 @@ const char* plugin_get_name(void) {
 }
 
 const char* plugin_init(int queue_size) {
-    return common_plugin_init(plugin_transform, "flipper", queue_size);
-}
\ No newline at end of file
+    return common_plugin_init_msg(plugin_transform, "flipper", queue_size, PLUGIN_STATELESS);
+}
@@ -1,13 +1,25 @@
 #include "plugin_common.h"
-#include <stdio.h>
+#include <unistd.h>
 
-// log the input string to stdout
-static const char* plugin_transform(const char* input) {
-    if (input) {
-        printf("[logger] %s\n", input); // print the string
-        fflush(stdout);
+// log a whole batch to stdout in one writev - a line per message, all bytes
+// of it, and no stdio buffer to lock and flush per line
+static int logger_hook(void* state, int event, plugin_msg_t** msgs, int count) {
+    (void)state;
+    if (event != PLUGIN_HOOK_BATCH) return 0;
+    struct iovec iov[PLUGIN_MAX_BATCH * 3];
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        iov[n++] = (struct iovec){ (char*)"[logger] ", 9 };
+        iov[n++] = (struct iovec){ msgs[i]->data, msgs[i]->len };
+        iov[n++] = (struct iovec){ (char*)"\n", 1 };
     }
-    return input; // pass unchanged
+    common_write_all(STDOUT_FILENO, iov, n);
+    return 0;
+}
+
+// pass the message unchanged - the hook logs it
+static plugin_msg_t* plugin_transform(plugin_msg_t* msg) {
+    return msg;
 }
 
 /* get plugin name */
@@ -17,5 +29,7 @@ const char* plugin_get_name(void) {
 
 /* init plugin */
 const char* plugin_init(int queue_size) {
-    return common_plugin_init(plugin_transform, "logger", queue_size);
-}
\ No newline at end of file
+    const char* err = common_plugin_set_hook(logger_hook, NULL, 0);
+    if (err) return err;
+    return common_plugin_init_msg(plugin_transform, "logger", queue_size, PLUGIN_READ_ONLY);
+}
@@ -1,42 +1,420 @@
+#define _GNU_SOURCE
 #include "plugin_common.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stddef.h>
+#include <unistd.h>
 
-static plugin_context_t pg; 
+static plugin_context_t pg;             // default instance, used by plugin_init and friends
+static plugin_context_t* creating;      // instance plugin_instance_init is building, if any
+static __thread char* last_output;      // buffer this thread last got from plugin_alloc_output
+static __thread plugin_context_t* current; // instance whose consumer thread this is, for plugin_cancelled
 
-// generic consumer thread
-void* plugin_consumer_thread(void* arg) {
-    plugin_context_t* c = (plugin_context_t*)arg;
-    while (1) {
-        char* item = consumer_producer_get(c->queue); // get next item
-        if (!item) break; // finished signal
+// a pooled stage's task is idle (the queue is empty), queued on the executor,
+// running, running and told there is more (it queues itself again when its
+// turn ends), or done for good
+enum { TASK_IDLE, TASK_QUEUED, TASK_RUNNING, TASK_AGAIN, TASK_DONE };
+
+// the sdk's control tokens are the queue's, so they pass through unchanged
+_Static_assert(PLUGIN_CONTROL_FLUSH == CP_CONTROL_FLUSH && PLUGIN_CONTROL_EOS == CP_CONTROL_EOS &&
+               PLUGIN_CONTROL_ABORT == CP_CONTROL_ABORT, "control tokens differ from the queue's");
+_Static_assert(PLUGIN_WAIT_PARK == CP_WAIT_PARK && PLUGIN_WAIT_YIELD == CP_WAIT_YIELD &&
+               PLUGIN_WAIT_SPIN == CP_WAIT_SPIN, "wait strategies differ from the queue's");
 
-        if (strcmp(item, "<END>") == 0) { // check end signal
-            free(item);
+// hand a batch of owned messages to the next stage in order - as they are
+// when it takes messages, otherwise as v1 strings: in one call when the next
+// stage takes batches, one by one when it takes single buffers, and as copies
+// for a next stage that only has the copying place_work
+static void plugin_forward_batch(plugin_context_t* c, plugin_msg_t** msgs, int count) {
+    int moved = 0; // items the next stage now owns
 
-            // if next plugin exists, send end signal 
-            if (c->next_place_work){
+    if (c->next_instance_place_msgs) {
+        moved = c->next_instance_place_msgs(c->next_instance, msgs, count);
+        for (int i = moved; i < count; i++) message_free(msgs[i]);
+        return;
+    }
+    if (!c->next_instance_place_work_batch && !c->next_place_work_batch && !c->next_place_work_owned && !c->next_place_work) {
+        for (int i = 0; i < count; i++) message_free(msgs[i]); // end of the chain
+        return;
+    }
 
-                c->next_place_work("<END>");
-            }  
+    char* items[PLUGIN_MAX_BATCH];
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        char* item = message_unwrap(msgs[i]);
+        if (item) items[n++] = item; // out of memory drops it
+    }
+    count = n;
 
-            // signal finished
-            consumer_producer_signal_finished(c->queue);
-            c->finished = 1;
-            break;
+    if (c->next_instance_place_work_batch) {
+        moved = c->next_instance_place_work_batch(c->next_instance, items, count);
+    } else if (c->next_place_work_batch) {
+        moved = c->next_place_work_batch(items, count);
+    } else if (c->next_place_work_owned) {
+        while (moved < count && !c->next_place_work_owned(items[moved])) moved++;
+    } else if (c->next_place_work) {
+        for (int i = 0; i < count; i++) c->next_place_work(items[i]); // next stage keeps its own copy
+    }
+
+    // free what the next stage did not take (everything at the end of the chain)
+    for (int i = moved; i < count; i++) buffer_pool_free(items[i]);
+}
+
+// pass a control token on to the next stage - one without a control function
+// only learns about the end of the stream, in band (an end message, or the v1
+// "<END>" string)
+static void plugin_forward_control(plugin_context_t* c, int control) {
+    if (c->next_instance_control) {
+        c->next_instance_control(c->next_instance, control);
+        return;
+    }
+    if (control != PLUGIN_CONTROL_EOS) return;
+    plugin_msg_t* end = message_end();
+    if (end) plugin_forward_batch(c, &end, 1);
+}
+
+// a processed batch parked until every earlier batch has been forwarded
+typedef struct reorder_batch {
+    size_t first;                 // sequence number of its first input item
+    int span;                     // input items it covers (some may have been dropped)
+    int count;                    // processed items to forward
+    cp_control_t control;         // flush marker that follows the items, if any
+    struct reorder_batch* next;   // next parked batch, by sequence number
+    plugin_msg_t* items[];
+} reorder_batch_t;
+
+// monotonic time in nanoseconds, for the stats and the hook's ticks
+static unsigned long long plugin_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+// run the hook's tick and schedule the next one - a tick whole intervals
+// late runs once for all the ticks due by now, so the hook catches up in one
+// go and the schedule is kept without ticks bunching up
+static int plugin_run_tick(plugin_context_t* c) {
+    unsigned long long interval = (unsigned long long)c->tick_ms * 1000000ULL;
+    unsigned long long now = plugin_now_ns();
+    unsigned long long due = now >= c->next_tick ? (now - c->next_tick) / interval + 1 : 1;
+    if (due > INT_MAX) due = INT_MAX;
+    c->next_tick += due * interval;
+    if (c->next_tick <= now) c->next_tick = now + interval; // only after INT_MAX ticks
+    return c->hook(c->hook_state, PLUGIN_HOOK_TICK, NULL, (int)due);
+}
+
+// input is held while the hook asks for it - only its ticks run, until one
+// lets go or the stage is aborted (noticed within a tick)
+static void plugin_hold(plugin_context_t* c) {
+    int hold = 1;
+    while (hold && !consumer_producer_aborted(c->queue)) {
+        struct timespec until = { (time_t)(c->next_tick / 1000000000ULL), (long)(c->next_tick % 1000000000ULL) };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR) {
         }
+        hold = plugin_run_tick(c);
+    }
+}
+
+// tell the stage's hook about an event
+static void plugin_run_hook(plugin_context_t* c, int event, plugin_msg_t** msgs, int count) {
+    if (!c->hook) return;
+    if (c->hook(c->hook_state, event, msgs, count) && c->tick_ms > 0) plugin_hold(c);
+}
+
+// forward a processed batch, and the flush marker that ended it
+static void plugin_emit(plugin_context_t* c, plugin_msg_t** items, int count, cp_control_t control) {
+    plugin_forward_batch(c, items, count);
+    if (control == CP_CONTROL_FLUSH) {
+        plugin_run_hook(c, PLUGIN_CONTROL_FLUSH, NULL, 0); // only single worker stages have one
+        plugin_forward_control(c, PLUGIN_CONTROL_FLUSH);
+    }
+}
+
+// forward a processed batch in input order when several workers share the
+// stage - a batch finished early is parked, and whoever forwards the batch
+// the next stage is waiting for also forwards the parked ones that follow
+static void plugin_reorder_emit(plugin_context_t* c, size_t first, int span, plugin_msg_t** items, int count,
+                                cp_control_t control) {
+    pthread_mutex_lock(&c->reorder_lock);
+
+    if (first != c->next_seq) {
+        reorder_batch_t* b = (reorder_batch_t*)malloc(sizeof(reorder_batch_t) + sizeof(plugin_msg_t*) * count);
+        if (b) {
+            b->first = first;
+            b->span = span;
+            b->count = count;
+            b->control = control;
+            memcpy(b->items, items, sizeof(plugin_msg_t*) * count);
 
-        const char* processed = c->process_function(item); // process item
-        free(item); // free original string
+            // keep the parked list sorted by sequence number - a lone flush
+            // marker (span 0) goes before the batch starting where it sits
+            reorder_batch_t** pos = &c->reorder_pending;
+            while (*pos && ((*pos)->first < first || ((*pos)->first == first && (*pos)->span == 0 && span > 0))) {
+                pos = &(*pos)->next;
+            }
+            b->next = *pos;
+            *pos = b;
+            c->reorder_items += count;
 
-        if (c->next_place_work && processed) {
-            c->next_place_work(processed); // send to next plugin
+            pthread_mutex_unlock(&c->reorder_lock);
+            return;
         }
+
+        // no memory to park it - wait for our turn instead
+        while (first != c->next_seq) pthread_cond_wait(&c->reorder_cond, &c->reorder_lock);
+    }
+
+    plugin_emit(c, items, count, control);
+    c->next_seq += span;
+
+    while (c->reorder_pending && c->reorder_pending->first == c->next_seq) {
+        reorder_batch_t* b = c->reorder_pending;
+        c->reorder_pending = b->next;
+        plugin_emit(c, b->items, b->count, b->control);
+        c->next_seq += b->span;
+        c->reorder_items -= b->count;
+        free(b);
+    }
+
+    pthread_cond_broadcast(&c->reorder_cond);
+    pthread_mutex_unlock(&c->reorder_lock);
+}
+
+// a worker got the end of stream or the abort - the end is passed on by the
+// last worker to get it, when every batch has been forwarded; an abort is
+// passed on at once, without waiting for a worker that is forwarding (the
+// next stage ignores repeats)
+static void plugin_stop(plugin_context_t* c, cp_control_t control) {
+    if (control == CP_CONTROL_EOS && c->hook) {
+        plugin_run_hook(c, PLUGIN_CONTROL_EOS, NULL, 0); // the hook's stage has one worker, so this is the last
+        if (consumer_producer_aborted(c->queue)) control = CP_CONTROL_ABORT; // aborted while it finished up
+    }
+    if (control == CP_CONTROL_ABORT) {
+        plugin_run_hook(c, PLUGIN_CONTROL_ABORT, NULL, 0);
+        plugin_forward_control(c, PLUGIN_CONTROL_ABORT);
+    }
+    pthread_mutex_lock(&c->reorder_lock);
+    if (++c->stopped_workers == c->workers) {
+        if (control == CP_CONTROL_EOS) plugin_forward_control(c, PLUGIN_CONTROL_EOS);
+        consumer_producer_signal_finished(c->queue); // the stage is done
+        c->finished = 1;
+    }
+    pthread_cond_broadcast(&c->reorder_cond);
+    pthread_mutex_unlock(&c->reorder_lock);
+}
+
+// keep workers from running arbitrarily far ahead of a slow one
+static void plugin_reorder_wait_room(plugin_context_t* c) {
+    int limit = c->workers * __atomic_load_n(&c->batch_size, __ATOMIC_RELAXED) * 4;
+
+    pthread_mutex_lock(&c->reorder_lock);
+    while (c->reorder_items > limit && !c->finished) {
+        pthread_cond_wait(&c->reorder_cond, &c->reorder_lock);
+    }
+    pthread_mutex_unlock(&c->reorder_lock);
+}
+
+// add to a counter several workers may share - relaxed, it is only read for stats
+static void plugin_stat_add(unsigned long long* counter, unsigned long long n) {
+    if (n) __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+// get a buffer for a transform's output
+char* plugin_alloc_output(size_t size) {
+    last_output = buffer_pool_alloc(size);
+    return last_output;
+}
+
+// run the transform on an owned item - it either returns the item (possibly
+// modified in place), returns a new buffer, or NULL to drop it. A new buffer
+// that did not come from plugin_alloc_output is malloc'd, so it is moved into
+// the pool - every buffer between stages is a pool buffer
+static char* plugin_transform_item(plugin_context_t* c, char* item) {
+    char* processed = (char*)c->process_function(item);
+    if (processed == item) return processed;
+    buffer_pool_free(item);
+
+    if (processed && processed != last_output) {
+        char* copy = buffer_pool_strndup(processed, strlen(processed));
+        free(processed);
+        processed = copy; // out of memory drops the item
+    }
+    last_output = NULL;
+    return processed;
+}
+
+// run the transform on an owned message - a v2 transform works on the
+// message itself, a v1 transform on its payload as a NUL-terminated string
+static plugin_msg_t* plugin_transform_msg(plugin_context_t* c, plugin_msg_t* msg) {
+    // a message other branches hold too is copied before it is changed
+    if (!(c->flags & PLUGIN_READ_ONLY) && !(msg = message_own(msg))) return NULL;
+    char* data = msg->data;
+
+    if (c->process_msg) {
+        plugin_msg_t* processed = c->process_msg(msg);
+        if (msg->data != data) message_free_data(msg, data); // payload was replaced
+        if (!processed) message_free(msg);
+        return processed;
+    }
+
+    // a v1 transform may free or keep its input, so it gets a string of its own
+    data = message_take_data(msg);
+    msg->data = data ? plugin_transform_item(c, data) : NULL;
+    if (!msg->data) {
+        message_free(msg);
+        return NULL;
     }
+    msg->len = strlen(msg->data); // a v1 transform only says where its output ends with the NUL
+    msg->capacity = msg->len;
+    return msg;
+}
+
+// run one owned message through the stage's transform and then through every
+// stage fused into it
+static plugin_msg_t* plugin_process_item(plugin_context_t* c, plugin_msg_t* msg) {
+    msg = plugin_transform_msg(c, msg);
+
+    plugin_context_t* fused = c->fused_next;
+    char* (*process)(plugin_context_t*, char*) = c->fused_next_process;
+    plugin_msg_t* (*process_msg)(plugin_context_t*, plugin_msg_t*) = c->fused_next_process_msg;
+    while (msg && fused) {
+        if (process_msg) {
+            msg = process_msg(fused, msg); // may live in another plugin
+        } else {
+            // fused through the v1 api - hand it a string
+            char* item = message_unwrap(msg);
+            item = item ? process(fused, item) : NULL;
+            msg = item ? message_wrap(item) : NULL;
+            if (item && !msg) buffer_pool_free(item);
+        }
+        process = fused->fused_next_process;
+        process_msg = fused->fused_next_process_msg;
+        fused = fused->fused_next;
+    }
+    return msg;
+}
+
+// take one batch off the queue, process it and pass it on, waiting at most
+// timeout_ms for it - returns 1 if something came, 0 if nothing did, -1 once
+// the stage got the end of stream or the abort
+static int plugin_consume(plugin_context_t* c, int timeout_ms) {
+    char* queued[PLUGIN_MAX_BATCH];
+    plugin_msg_t* batch[PLUGIN_MAX_BATCH];
+
+    // drain whatever is queued, up to the batch size, in one wakeup
+    int size = __atomic_load_n(&c->batch_size, __ATOMIC_RELAXED);
+    size_t first;
+    cp_control_t control;
+    int n = consumer_producer_get_batch_timed(c->queue, queued, size, &first, &control, timeout_ms);
+    if (control == CP_CONTROL_EOS || control == CP_CONTROL_ABORT) {
+        plugin_stop(c, control);
+        return -1;
+    }
+    if (n == 0 && control == CP_CONTROL_NONE) return 0; // nothing came before the tick
+
+    int out = 0; // processed items are compacted to the front of batch
+    size_t bytes = 0;
+    unsigned long long start = plugin_now_ns();
+    for (int i = 0; i < n; i++) {
+        plugin_msg_t* msg = (plugin_msg_t*)queued[i]; // the queue holds messages
+        bytes += msg->len;
+        plugin_msg_t* processed = plugin_process_item(c, msg); // the stage owns msg until it is processed
+        if (processed) batch[out++] = processed;
+    }
+
+    // counters are added once per batch, never per item
+    plugin_stat_add(&c->stats.process_ns, plugin_now_ns() - start);
+    plugin_stat_add(&c->stats.items_in, (unsigned long long)n);
+    plugin_stat_add(&c->stats.items_out, (unsigned long long)out);
+    plugin_stat_add(&c->stats.bytes_in, bytes);
+
+    // the hook sees the batch before it moves on
+    if (c->hook && out > 0) plugin_run_hook(c, PLUGIN_HOOK_BATCH, batch, out);
+
+    // send to next plugin as one batch, with the flush marker that ended it
+    if (c->workers > 1) {
+        plugin_reorder_emit(c, first, n, batch, out, control);
+    } else {
+        plugin_emit(c, batch, out, control);
+    }
+    return 1;
+}
+
+// generic consumer thread - a stage runs one per worker
+void* plugin_consumer_thread(void* arg) {
+    plugin_context_t* c = (plugin_context_t*)arg;
+    current = c;
+    if (c->tick_ms > 0) c->next_tick = plugin_now_ns() + (unsigned long long)c->tick_ms * 1000000ULL;
+
+    while (1) {
+        if (c->workers > 1) plugin_reorder_wait_room(c);
+
+        // a stage with ticks waits for input only until the next one is due
+        int timeout_ms = -1;
+        if (c->tick_ms > 0) {
+            if (plugin_now_ns() >= c->next_tick && plugin_run_tick(c)) plugin_hold(c);
+            unsigned long long now = plugin_now_ns();
+            timeout_ms = c->next_tick > now ? (int)((c->next_tick - now + 999999) / 1000000) : 0;
+        }
+        if (plugin_consume(c, timeout_ms) < 0) break;
+    }
+    buffer_pool_thread_flush(); // buffers cached by this thread go back before it exits
     return NULL;
 }
 
+// tell a pooled stage its queue has something - the task is queued unless it
+// already is, or is running, when it runs again at the end of its turn
+static void plugin_task_notify(plugin_context_t* c) {
+    int state = __atomic_load_n(&c->task_state, __ATOMIC_SEQ_CST);
+    while (state != TASK_QUEUED && state != TASK_AGAIN && state != TASK_DONE) {
+        int next = state == TASK_IDLE ? TASK_QUEUED : TASK_AGAIN;
+        if (__atomic_compare_exchange_n(&c->task_state, &state, next, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            if (next == TASK_QUEUED) c->executor->submit(c->executor, &c->task);
+            return;
+        }
+    }
+}
+
+// a turn of a pooled stage - batches until the queue is found empty, or
+// PLUGIN_TASK_ROUNDS of them. Only an empty queue lets the task go idle: items
+// put while it was queued did not notify it again
+static void plugin_run_task(plugin_task_t* task) {
+    plugin_context_t* c = (plugin_context_t*)((char*)task - offsetof(plugin_context_t, task));
+    __atomic_store_n(&c->task_state, TASK_RUNNING, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST); // a put after this is seen, or its notify sees RUNNING
+
+    plugin_context_t* caller = current; // a pool thread may run a turn while another waits on a full queue
+    current = c;
+    int result = 1;
+    for (int round = 0; round < PLUGIN_TASK_ROUNDS && result > 0; round++) result = plugin_consume(c, 0);
+    current = caller;
+
+    if (result < 0) {
+        __atomic_store_n(&c->task_state, TASK_DONE, __ATOMIC_SEQ_CST);
+        return;
+    }
+    int state = TASK_RUNNING;
+    if (result > 0 || !__atomic_compare_exchange_n(&c->task_state, &state, TASK_IDLE, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&c->task_state, TASK_QUEUED, __ATOMIC_SEQ_CST); // more to do, after the others
+        c->executor->submit(c->executor, task);
+    }
+}
+
+// a producer found the stage's queue full - a pooled stage is told there is
+// work (the producer may have filled the queue in this very put), and a pool
+// thread runs other work meanwhile
+static int plugin_queue_full(void* arg) {
+    plugin_context_t* c = (plugin_context_t*)arg;
+    if (c->pooled) plugin_task_notify(c);
+    return c->executor->help(c->executor);
+}
+
 // log error
 void log_error(plugin_context_t* c, const char* msg) {
     if (!c || !msg) return;
@@ -55,33 +433,174 @@ const char* plugin_get_name(void) {
 }
 
 */
-// init common plugin
-const char* common_plugin_init(const char* (*proc)(const char*), const char* name, int queue_size) {
-    if (!proc || !name || queue_size <= 0) return "args are invalid";
+// set up the instance being initialized - exactly one of proc and proc_msg is set
+static const char* common_plugin_start(const char* (*proc)(const char*), plugin_msg_t* (*proc_msg)(plugin_msg_t*),
+                                       const char* name, int queue_size, int flags) {
+    if (!name || queue_size <= 0) return "args are invalid";
+    plugin_context_t* c = creating ? creating : &pg;
+
+    // a setting nothing read is most likely misspelt
+    unsigned long long given = c->option_count == PLUGIN_MAX_OPTIONS ? ~0ULL : (1ULL << c->option_count) - 1;
+    if (c->options_read != given) return "the plugin takes no such stage setting";
 
     // initialize the plugin context
-    pg.name = name;
-    pg.process_function = proc;
-    pg.initialized = 0;
-    pg.finished = 0;
+    c->name = name;
+    c->process_function = proc;
+    c->process_msg = proc_msg;
+    c->flags = flags;
+    c->initialized = 0;
+    c->finished = 0;
+    memset(&c->stats, 0, sizeof(c->stats));
+    if (c->batch_size <= 0) c->batch_size = PLUGIN_DEFAULT_BATCH; // may have been set already
+    if (c->workers <= 0) c->workers = 1; // plugin_instance_init may ask for more
+
+    // items may only be processed out of order if the plugin keeps no state between them
+    if (c->workers > 1 && !(flags & PLUGIN_STATELESS)) return "plugin is not stateless, cannot run several workers";
+
+    // a hook is run by the stage's own, single thread
+    if (c->hook && c->fused) return "plugin has a hook, cannot be fused";
+    if (c->hook && c->workers > 1) return "plugin has a hook, cannot run several workers";
+
+    // a fused instance is run by another instance's thread - it needs no queue or threads
+    if (c->fused) {
+        c->initialized = 1;
+        return NULL;
+    }
 
     // create the queue by allocating memory for the queue structure
-    pg.queue = (consumer_producer_t*)malloc(sizeof(consumer_producer_t));
-    if (!pg.queue) return "malloc has failed";
+    // (cache line aligned so the ring's producer and consumer indices do not share a line)
+    c->queue = (consumer_producer_t*)aligned_alloc(CP_CACHE_LINE, sizeof(consumer_producer_t));
+    if (!c->queue) return "malloc has failed";
+
+    // initialize the queue - a stage usually has exactly one producer (the
+    // previous stage or main), then with a single worker use the lock-free
+    // ring; branches merging into it need the locked queue
+    cp_mode_t mode = c->workers == 1 && c->producers <= 1 ? CP_MODE_SPSC : CP_MODE_LOCKED;
+    const char* er = consumer_producer_init_mode(c->queue, queue_size, mode);
+    if (er) { //return error if queue init failed
+        free(c->queue);
+        return er;
+    }
 
-    // initialize the queue
-    const char* er = consumer_producer_init(pg.queue, queue_size);
-    if (er) return er; //return error if queue init failed
+    // state used to put the workers' output back in input order
+    pthread_mutex_init(&c->reorder_lock, NULL);
+    pthread_cond_init(&c->reorder_cond, NULL);
+    c->next_seq = 0;
+    c->reorder_pending = NULL;
+    c->reorder_items = 0;
+    c->stopped_workers = 0;
 
-    // create the consumer thread and return error if it failed
-    if (pthread_create(&pg.consumer_thread, NULL, plugin_consumer_thread, &pg) != 0) {
-        return "thread creation failed";
+    // with a thread pool a single worker stage is a task, run whenever its
+    // queue has something - a stage with ticks or several workers still waits
+    // in threads of its own. Pool threads filling its queue run other work
+    c->pooled = c->executor && c->workers == 1 && c->tick_ms == 0;
+    if (c->executor) consumer_producer_set_full_hook(c->queue, plugin_queue_full, c);
+    if (c->pooled) {
+        c->task.run = plugin_run_task;
+        c->task_state = TASK_IDLE;
+        c->consumer_threads = NULL;
+        c->executor->at_thread_exit(c->executor, buffer_pool_thread_flush);
+        c->initialized = 1;
+        return NULL;
+    }
+
+    // create the consumer threads and return error if it failed
+    c->consumer_threads = (pthread_t*)malloc(sizeof(pthread_t) * c->workers);
+    er = c->consumer_threads ? NULL : "malloc has failed";
+    int started = 0;
+    while (!er && started < c->workers) {
+        if (pthread_create(&c->consumer_threads[started], NULL, plugin_consumer_thread, c) != 0) {
+            er = "thread creation failed";
+        } else {
+            // name the thread after the plugin, so tools can tell the stages apart
+            char thread_name[16];
+            snprintf(thread_name, sizeof(thread_name), "%s", name);
+            pthread_setname_np(c->consumer_threads[started], thread_name);
+            started++;
+        }
+    }
+    if (er) {
+        // stop the workers that did start
+        consumer_producer_signal_finished(c->queue);
+        for (int i = 0; i < started; i++) pthread_join(c->consumer_threads[i], NULL);
+        free(c->consumer_threads);
+        pthread_mutex_destroy(&c->reorder_lock);
+        pthread_cond_destroy(&c->reorder_cond);
+        consumer_producer_destroy(c->queue);
+        free(c->queue);
+        return er;
     }
 
-    pg.initialized = 1;
+    c->initialized = 1;
     return NULL;
 }
 
+// give the instance being initialized a hook - before common_plugin_init*,
+// which starts the threads that run it
+const char* common_plugin_set_hook(plugin_hook_t hook, void* state, int tick_ms) {
+    if (!hook || tick_ms < 0) return "args are invalid";
+    plugin_context_t* c = creating ? creating : &pg;
+    c->hook = hook;
+    c->hook_state = state;
+    c->tick_ms = tick_ms;
+    return NULL;
+}
+
+// look a setting up in the stage being initialized, and note that it was read
+const char* common_plugin_option(const char* key) {
+    if (!key) return NULL;
+    plugin_context_t* c = creating ? creating : &pg;
+    size_t len = strlen(key);
+    for (int i = 0; i < c->option_count; i++) {
+        if (strncmp(c->options[i], key, len) == 0 && c->options[i][len] == '=') {
+            c->options_read |= 1ULL << i;
+            return c->options[i] + len + 1;
+        }
+    }
+    return NULL;
+}
+
+// write all of an iovec array - a short write resumes where it stopped, and
+// arrays longer than the system allows go in several calls
+int common_write_all(int fd, struct iovec* iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count < IOV_MAX ? count : IOV_MAX);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        // skip what was written
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return 0;
+}
+
+// init common plugin - fills the instance plugin_instance_init is building,
+// or the default instance when called through plain plugin_init
+const char* common_plugin_init(const char* (*proc)(const char*), const char* name, int queue_size) {
+    return common_plugin_init_flags(proc, name, queue_size, 0);
+}
+
+// init common plugin with behaviour flags
+const char* common_plugin_init_flags(const char* (*proc)(const char*), const char* name, int queue_size, int flags) {
+    if (!proc) return "args are invalid";
+    return common_plugin_start(proc, NULL, name, queue_size, flags);
+}
+
+// init common plugin with a message processing function
+const char* common_plugin_init_msg(plugin_msg_t* (*proc_msg)(plugin_msg_t*), const char* name, int queue_size, int flags) {
+    if (!proc_msg) return "args are invalid";
+    return common_plugin_start(NULL, proc_msg, name, queue_size, flags);
+}
+
 /*
 // plugin init 
 const char* plugin_init(int queue_size) {
@@ -89,20 +608,361 @@ const char* plugin_init(int queue_size) {
 }
 */
 
+// create a new instance - runs the plugin's own plugin_init, whose call to
+// common_plugin_init then fills this instance instead of the default one
+const char* plugin_instance_init(const plugin_config_t* config, plugin_context_t** out) {
+    if (!config || !out) return "args are invalid";
+    if (!config->fused && (config->workers <= 0 || config->workers > PLUGIN_MAX_WORKERS)) return "worker count out of range";
+
+    plugin_context_t* c = (plugin_context_t*)calloc(1, sizeof(plugin_context_t));
+    if (!c) return "malloc has failed";
+    c->fused = config->fused;
+    c->workers = config->fused ? 1 : config->workers;
+    c->producers = config->producers;
+    c->executor = config->executor;
+    c->task.order = config->order;
+    if (config->option_count < 0 || config->option_count > PLUGIN_MAX_OPTIONS) {
+        free(c);
+        return "too many stage settings";
+    }
+    c->options = config->options;
+    c->option_count = config->option_count;
+
+    creating = c;
+    const char* err = plugin_init(config->queue_size);
+    creating = NULL;
+    c->options = NULL; // the host's, only lent for plugin_init
+    c->option_count = 0;
+
+    if (!err && !c->initialized) err = "plugin did not initialize"; // plugin_init skipped common_plugin_init
+    if (err) {
+        free(c);
+        return err;
+    }
+    *out = c;
+    return NULL;
+}
+
+// finalize instance
+const char* plugin_instance_fini(plugin_context_t* c) {
+    if (!c || !c->initialized) return "plugin wanst initialized";
+    if (c->fused) { // nothing but the context itself
+        free(c);
+        return NULL;
+    }
+    for (int i = 0; !c->pooled && i < c->workers; i++) {
+        pthread_join(c->consumer_threads[i], NULL); // wait for threads (the pool's are the host's to stop)
+    }
+    free(c->consumer_threads);
+
+    // parked batches only remain if the stage was aborted
+    while (c->reorder_pending) {
+        reorder_batch_t* b = c->reorder_pending;
+        c->reorder_pending = b->next;
+        for (int i = 0; i < b->count; i++) message_free(b->items[i]);
+        free(b);
+    }
+    pthread_mutex_destroy(&c->reorder_lock);
+    pthread_cond_destroy(&c->reorder_cond);
+
+    // items still queued are messages, which the queue cannot free itself
+    char* left[PLUGIN_MAX_BATCH];
+    int n;
+    while ((n = consumer_producer_drain(c->queue, left, PLUGIN_MAX_BATCH)) > 0) {
+        for (int i = 0; i < n; i++) message_free((plugin_msg_t*)left[i]);
+    }
+    consumer_producer_destroy(c->queue); // destroy queue
+    free(c->queue); // free struct
+    if (c->hook) c->hook(c->hook_state, PLUGIN_HOOK_FINI, NULL, 0);
+    c->hook = NULL;
+    c->initialized = 0;
+    if (c != &pg) free(c); // the default instance is static
+    return NULL;
+}
+
+// place work into an instance
+const char* plugin_instance_place_work(plugin_context_t* c, const char* str) {
+    if (!c || !c->initialized) return "plugin wanst initialized";
+    if (c->fused) return "plugin is fused, it has no queue";
+    if (!str) return "args are invalid";
+
+    char* copy = buffer_pool_strndup(str, strlen(str));
+    if (!copy) return "malloc has failed";
+    const char* err = plugin_instance_place_work_owned(c, copy);
+    if (err) buffer_pool_free(copy); // queue did not take it
+    return err;
+}
+
+// place work into an instance, taking ownership of the buffer
+const char* plugin_instance_place_work_owned(plugin_context_t* c, char* str) {
+    if (!c || !c->initialized) return "plugin wanst initialized";
+    if (c->fused) return "plugin is fused, it has no queue";
+    if (!str) return "args are invalid";
+
+    plugin_msg_t* msg = message_wrap(str);
+    if (!msg) return "malloc has failed";
+    if (plugin_instance_place_msgs(c, &msg, 1) == 1) return NULL;
+    message_unwrap(msg); // the caller keeps str
+    return "queue finished";
+}
+
+// place a batch of work into an instance, taking ownership of the buffers that were queued
+int plugin_instance_place_work_batch(plugin_context_t* c, char** items, int count) {
+    if (!c || !c->initialized || c->fused || !items) return 0;
+    plugin_msg_t* msgs[PLUGIN_MAX_BATCH];
+    int placed = 0;
+
+    while (placed < count) {
+        int n = 0;
+        while (n < PLUGIN_MAX_BATCH && placed + n < count && (msgs[n] = message_wrap(items[placed + n]))) n++;
+        if (n == 0) break; // out of memory
+
+        int moved = plugin_instance_place_msgs(c, msgs, n);
+        for (int i = moved; i < n; i++) message_unwrap(msgs[i]); // the caller keeps these
+        placed += moved;
+        if (moved < n) break;
+    }
+    return placed;
+}
+
+// place messages into an instance, taking ownership of the ones that were queued -
+// an end message (from a v1 "<END>" string or a host without control tokens)
+// becomes the end of stream token, and nothing after it is taken
+int plugin_instance_place_msgs(plugin_context_t* c, plugin_msg_t** msgs, int count) {
+    if (!c || !c->initialized || c->fused || !msgs) return 0;
+    char* items[PLUGIN_MAX_BATCH]; // the queue stores them as plain pointers
+    int placed = 0;
+
+    while (placed < count) {
+        int n = 0;
+        int end = 0;
+        while (n < PLUGIN_MAX_BATCH && placed + n < count) {
+            if (msgs[placed + n]->flags & PLUGIN_MSG_END) {
+                end = 1;
+                break;
+            }
+            items[n] = (char*)msgs[placed + n];
+            n++;
+        }
+        int moved = n ? consumer_producer_put_batch(c->queue, items, n) : 0;
+        placed += moved;
+        if (moved < n) break;
+        if (end) {
+            consumer_producer_control(c->queue, CP_CONTROL_EOS);
+            message_free(msgs[placed++]);
+            break;
+        }
+    }
+    if (c->pooled && placed > 0) plugin_task_notify(c);
+    return placed;
+}
+
+// send a control token into an instance's queue
+const char* plugin_instance_control(plugin_context_t* c, int control) {
+    if (!c || !c->initialized) return "plugin wanst initialized";
+    if (c->fused) return "plugin is fused, it has no queue";
+    if (control != PLUGIN_CONTROL_FLUSH && control != PLUGIN_CONTROL_EOS && control != PLUGIN_CONTROL_ABORT) return "args are invalid";
+    consumer_producer_control(c->queue, (cp_control_t)control);
+    if (c->pooled) plugin_task_notify(c);
+    return NULL;
+}
+
+// check whether the instance running this thread was aborted
+int plugin_cancelled(void) {
+    return current && consumer_producer_aborted(current->queue);
+}
+
+// resize the instance's queue
+const char* plugin_instance_set_queue_capacity(plugin_context_t* c, int capacity) {
+    if (!c || !c->initialized) return "args are invalid";
+    if (c->fused) return "a fused instance has no queue";
+    return consumer_producer_set_capacity(c->queue, capacity);
+}
+
+// choose how the instance's queue waits
+const char* plugin_instance_set_wait(plugin_context_t* c, int wait) {
+    if (!c || !c->initialized) return "args are invalid";
+    if (c->fused) return "a fused instance has no queue";
+    return consumer_producer_set_wait(c->queue, (cp_wait_t)wait);
+}
+
+// the numa node of a cpu, -1 if the system does not say
+static int plugin_cpu_node(int cpu) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR* dir = opendir(path);
+    if (!dir) return -1;
+    int node = -1;
+    struct dirent* entry;
+    while (node < 0 && (entry = readdir(dir))) {
+        if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+            node = atoi(entry->d_name + 4);
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+// pin the instance's threads - the queue goes to the node its consumers run
+// on, so what they read on every wakeup is local (best effort)
+const char* plugin_instance_set_cpus(plugin_context_t* c, const int* cpus, int count) {
+    if (!c || !cpus || count <= 0 || !c->initialized) return "args are invalid";
+    if (c->fused) return "a fused instance has no threads";
+    if (c->pooled) return "a pooled instance has no threads";
+    for (int i = 0; i < c->workers; i++) {
+        int cpu = cpus[i % count];
+        if (cpu < 0 || cpu >= CPU_SETSIZE) return "cpu out of range";
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(c->consumer_threads[i], sizeof(set), &set) != 0) return "cannot pin the thread";
+    }
+    int node = plugin_cpu_node(cpus[0]);
+    if (node >= 0) consumer_producer_move_to_node(c->queue, node); // pinned either way
+    return NULL;
+}
+
+// set how many items the instance's consumer thread drains per wakeup
+const char* plugin_instance_set_batch_size(plugin_context_t* c, int batch_size) {
+    if (!c) return "args are invalid";
+    if (batch_size <= 0 || batch_size > PLUGIN_MAX_BATCH) return "batch size out of range";
+    __atomic_store_n(&c->batch_size, batch_size, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+// attach next instance (which may live in another plugin)
+void plugin_instance_attach(plugin_context_t* c, int (*next)(plugin_context_t*, char**, int), plugin_context_t* next_instance) {
+    if (!c) return;
+    c->next_instance_place_work_batch = next;
+    c->next_instance_place_msgs = NULL;
+    c->next_instance_control = NULL;
+    c->next_instance = next_instance;
+}
+
+// attach next instance, moving messages to it
+void plugin_instance_attach_msgs(plugin_context_t* c, int (*next)(plugin_context_t*, plugin_msg_t**, int), plugin_context_t* next_instance) {
+    if (!c) return;
+    c->next_instance_place_msgs = next;
+    c->next_instance_place_work_batch = NULL;
+    c->next_instance_control = NULL;
+    c->next_instance = next_instance;
+}
+
+// pass control tokens on to the attached next instance
+void plugin_instance_attach_control(plugin_context_t* c, const char* (*next)(plugin_context_t*, int)) {
+    if (!c) return;
+    c->next_instance_control = next;
+}
+
+// wait for an instance to finish
+const char* plugin_instance_wait_finished(plugin_context_t* c) {
+    if (!c || !c->initialized) return "plugin wanst initialized";
+    if (c->fused) return NULL; // done when the instance running it is done
+    consumer_producer_wait_finished(c->queue); // wait for queue to finish processing
+    return NULL;
+}
+
+// get an instance's behaviour flags
+int plugin_instance_get_flags(plugin_context_t* c) {
+    if (!c || !c->initialized) return 0;
+    return c->flags;
+}
+
+// run a fused instance's transform on one owned message - only the thread of
+// the instance it is fused into calls this, so its counters have a single
+// writer and need no atomic add
+plugin_msg_t* plugin_instance_process_msg(plugin_context_t* c, plugin_msg_t* msg) {
+    if (!c || !msg || (msg->flags & PLUGIN_MSG_END)) return msg; // an end message is not processed
+    unsigned long long len = msg->len;
+    plugin_msg_t* processed = plugin_transform_msg(c, msg);
+
+    __atomic_store_n(&c->stats.items_in, c->stats.items_in + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->stats.bytes_in, c->stats.bytes_in + len, __ATOMIC_RELAXED);
+    if (processed) __atomic_store_n(&c->stats.items_out, c->stats.items_out + 1, __ATOMIC_RELAXED);
+    return processed;
+}
+
+// run a fused instance's transform on one owned string
+char* plugin_instance_process(plugin_context_t* c, char* item) {
+    if (!item) return NULL;
+    plugin_msg_t* msg = message_wrap(item);
+    if (!msg) {
+        buffer_pool_free(item);
+        return NULL;
+    }
+    msg = plugin_instance_process_msg(c, msg);
+    return msg ? message_unwrap(msg) : NULL;
+}
+
+// read an instance's counters
+const char* plugin_instance_get_stats(plugin_context_t* c, plugin_stats_t* stats) {
+    if (!c || !stats) return "args are invalid";
+    if (!c->initialized) return "plugin wanst initialized";
+
+    stats->items_in = __atomic_load_n(&c->stats.items_in, __ATOMIC_RELAXED);
+    stats->items_out = __atomic_load_n(&c->stats.items_out, __ATOMIC_RELAXED);
+    stats->bytes_in = __atomic_load_n(&c->stats.bytes_in, __ATOMIC_RELAXED);
+    stats->process_ns = __atomic_load_n(&c->stats.process_ns, __ATOMIC_RELAXED);
+    stats->put_wait_ns = 0;
+    stats->get_wait_ns = 0;
+    stats->queue_high_water = 0;
+    stats->queue_capacity = 0;
+
+    if (c->queue) { // fused instances have none
+        uint64_t put_wait, get_wait;
+        size_t high_water;
+        consumer_producer_get_stats(c->queue, &put_wait, &get_wait, &high_water);
+        stats->put_wait_ns = put_wait;
+        stats->get_wait_ns = get_wait;
+        stats->queue_high_water = high_water;
+        stats->queue_capacity = (unsigned long long)consumer_producer_get_capacity(c->queue);
+    }
+    return NULL;
+}
+
+// fuse an instance into the end of another instance's fused group
+void plugin_instance_fuse(plugin_context_t* c, char* (*process)(plugin_context_t*, char*), plugin_context_t* fused) {
+    if (!c || !process || !fused) return;
+    while (c->fused_next) c = c->fused_next;
+    c->fused_next = fused;
+    c->fused_next_process = process;
+    c->fused_next_process_msg = NULL;
+}
+
+// fuse an instance that takes messages into the end of another instance's fused group
+void plugin_instance_fuse_msg(plugin_context_t* c, plugin_msg_t* (*process_msg)(plugin_context_t*, plugin_msg_t*), plugin_context_t* fused) {
+    if (!c || !process_msg || !fused) return;
+    while (c->fused_next) c = c->fused_next;
+    c->fused_next = fused;
+    c->fused_next_process = NULL;
+    c->fused_next_process_msg = process_msg;
+}
+
+/* single instance entry points - kept for existing hosts, they all act on pg */
+
 // finalize plugin
 const char* plugin_fini(void) {
-    if (!pg.initialized) return "plugin wanst initialized";
-    pthread_join(pg.consumer_thread, NULL); // wait for thread
-    consumer_producer_destroy(pg.queue); // destroy queue
-    free(pg.queue); // free struct
-    pg.initialized = 0;
-    return NULL;
+    return plugin_instance_fini(&pg);
 }
 
 // place work
 const char* plugin_place_work(const char* str) {
-    if (!pg.initialized) return "plugin wanst initialized";
-    return consumer_producer_put(pg.queue, str);
+    return plugin_instance_place_work(&pg, str);
+}
+
+// place work, taking ownership of the buffer
+const char* plugin_place_work_owned(char* str) {
+    return plugin_instance_place_work_owned(&pg, str);
+}
+
+// place a batch of work, taking ownership of the buffers that were queued
+int plugin_place_work_batch(char** items, int count) {
+    return plugin_instance_place_work_batch(&pg, items, count);
+}
+
+// set how many items the consumer thread drains per wakeup
+const char* plugin_set_batch_size(int batch_size) {
+    return plugin_instance_set_batch_size(&pg, batch_size);
 }
 
 // attach next plugin
@@ -110,9 +970,22 @@ void plugin_attach(const char* (*next)(const char*)) {
     pg.next_place_work = next;
 }
 
+// attach next plugin, handing it buffers instead of copies
+void plugin_attach_owned(const char* (*next)(char*)) {
+    pg.next_place_work_owned = next;
+}
+
+// attach next plugin, handing it whole batches of buffers
+void plugin_attach_batch(int (*next)(char**, int)) {
+    pg.next_place_work_batch = next;
+}
+
+// read counters
+const char* plugin_get_stats(plugin_stats_t* stats) {
+    return plugin_instance_get_stats(&pg, stats);
+}
+
 // wait for finish
 const char* plugin_wait_finished(void) {
-    if (!pg.initialized) return "plugin wanst initialized";
-    consumer_producer_wait_finished(pg.queue); // wait for queue to finish processing
-    return NULL;
-}
\ No newline at end of file
+    return plugin_instance_wait_finished(&pg);
+}
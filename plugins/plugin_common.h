@@ -2,21 +2,82 @@
 #define PLUGIN_COMMON_H
 
 #include <pthread.h>
+#include <sys/uio.h>
+#include "plugin_sdk.h"
 #include "sync/consumer_producer.h"
+#include "sync/buffer_pool.h"
+#include "sync/message.h"
 
 /**
  * Common SDK structures and functions for plugin implementation
  */
 
-// Plugin context structure
-typedef struct {
+#define PLUGIN_DEFAULT_BATCH 32   // items drained per consumer wakeup
+#define PLUGIN_MAX_BATCH 1024     // upper bound for plugin_set_batch_size
+#define PLUGIN_MAX_WORKERS 64     // upper bound for plugin_config_t.workers
+#define PLUGIN_TASK_ROUNDS 16     // batches a pooled stage takes per turn before it lets other stages run
+#define PLUGIN_MAX_OPTIONS 64     // upper bound for plugin_config_t.option_count
+
+// Events a stage hook gets besides PLUGIN_CONTROL_FLUSH / _EOS (before the token
+// is passed on) and PLUGIN_CONTROL_ABORT, see common_plugin_set_hook
+#define PLUGIN_HOOK_BATCH 0x100   // a batch was processed, its messages are forwarded next
+#define PLUGIN_HOOK_TICK 0x101    // the hook's tick interval passed (count times)
+#define PLUGIN_HOOK_FINI 0x102    // the instance is finalized - release the state (finalizing thread)
+
+/**
+ * Stage hook, run by the stage's consumer thread
+ * @param state The state given to common_plugin_set_hook
+ * @param event PLUGIN_HOOK_* or PLUGIN_CONTROL_*
+ * @param msgs The processed batch for PLUGIN_HOOK_BATCH (still owned by the stage), else NULL
+ * @param count Number of messages, or for PLUGIN_HOOK_TICK the ticks that fell
+ *        due since the last one (more than 1 when the thread ran late)
+ * @return 1 to hold further input - the thread then runs only ticks until one
+ *         returns 0 - or 0 to carry on
+ */
+typedef int (*plugin_hook_t)(void* state, int event, plugin_msg_t** msgs, int count);
+
+// Plugin context structure - one per instance (a plugin may be loaded several times in a chain)
+typedef struct plugin_context {
     const char* name;                         // Plugin name (for diagnosis)
     consumer_producer_t* queue;               // Input queue
-    pthread_t consumer_thread;                // Consumer thread
-    const char* (*next_place_work)(const char*);   // Next plugin's place_work function
-    const char* (*process_function)(const char*);  // Plugin-specific processing function
+    pthread_t* consumer_threads;              // Consumer threads, one per worker
+    int workers;                              // Number of consumer threads
+    int producers;                            // Number of threads placing work
+    int flags;                                // PLUGIN_* behaviour flags
+    const char* (*next_place_work)(const char*);   // Next plugin's place_work function (copies)
+    const char* (*next_place_work_owned)(char*);   // Next plugin's place_work_owned function (moves)
+    int (*next_place_work_batch)(char**, int);     // Next plugin's place_work_batch function (moves a batch)
+    int (*next_instance_place_work_batch)(struct plugin_context*, char**, int); // Next instance's place_work_batch
+    int (*next_instance_place_msgs)(struct plugin_context*, plugin_msg_t**, int); // Next instance's place_msgs (v2)
+    const char* (*next_instance_control)(struct plugin_context*, int); // Next instance's control function, or NULL
+    struct plugin_context* next_instance;          // Next instance (possibly in another plugin)
+    const char* (*process_function)(const char*);  // Plugin-specific processing function (v1), or
+    plugin_msg_t* (*process_msg)(plugin_msg_t*);   // plugin-specific message processing function (v2)
     int initialized;                          // Initialization flag
     int finished;                             // Finished processing flag
+    int batch_size;                           // Max items drained and forwarded per wakeup
+    pthread_mutex_t reorder_lock;             // Guards the reorder state below (workers > 1)
+    pthread_cond_t reorder_cond;              // Signaled whenever next_seq advances
+    size_t next_seq;                          // Sequence number the next stage expects next
+    struct reorder_batch* reorder_pending;    // Batches processed ahead of next_seq, sorted
+    int reorder_items;                        // Items held in reorder_pending
+    int stopped_workers;                      // Workers that got the end of stream or the abort
+    plugin_hook_t hook;                       // Stage hook (single worker stages only), or NULL
+    void* hook_state;                         // Passed to the hook
+    int tick_ms;                              // Interval of PLUGIN_HOOK_TICK, 0 for none
+    unsigned long long next_tick;             // When the next tick is due (consumer thread only)
+    int fused;                                // Runs in another instance's thread, has no queue or threads
+    struct plugin_context* fused_next;        // Next fused instance run by this thread's head instance
+    char* (*fused_next_process)(struct plugin_context*, char*); // fused_next's plugin_instance_process, or
+    plugin_msg_t* (*fused_next_process_msg)(struct plugin_context*, plugin_msg_t*); // its process_msg (v2)
+    plugin_stats_t stats;                     // Counters, added to with relaxed atomics once per batch
+    plugin_executor_t* executor;              // Thread pool of the chain, or NULL
+    int pooled;                               // Runs as task on executor instead of consumer_threads
+    plugin_task_t task;                       // The stage's task when pooled
+    int task_state;                           // Whether the task is idle, queued or running, see plugin_common.c
+    char* const* options;                     // The stage's "key=value" settings, while it is initialized
+    int option_count;                         // Number of options
+    unsigned long long options_read;          // Bit i set once common_plugin_option returned options[i]
 } plugin_context_t;
 
 /**
@@ -50,6 +111,9 @@ const char* plugin_get_name(void);
 
 /**
  * Initialize the common plugin infrastructure with the specified queue size
+ * The process function owns the heap buffer it is given: it may modify it in
+ * place and return it, return a new heap buffer (the input is then freed), or
+ * return NULL to drop the item. Whatever it returns is moved to the next stage.
  * @param process_function Plugin-specific processing function
  * @param name Plugin name
  * @param queue_size Maximum number of items that can be queued
@@ -57,6 +121,63 @@ const char* plugin_get_name(void);
  */
 const char* common_plugin_init(const char* (*process_function)(const char*), const char* name, int queue_size);
 
+/**
+ * Like common_plugin_init, with PLUGIN_* flags describing the plugin
+ * @param process_function Plugin-specific processing function
+ * @param name Plugin name
+ * @param queue_size Maximum number of items that can be queued
+ * @param flags PLUGIN_STATELESS if the stage may run several workers
+ * @return NULL on success, error message on failure
+ */
+const char* common_plugin_init_flags(const char* (*process_function)(const char*), const char* name, int queue_size, int flags);
+
+/**
+ * Initialize the common plugin infrastructure for a v2 plugin, whose process
+ * function works on messages: it may change the payload in place (data and len,
+ * within capacity), replace data with a new buffer from plugin_alloc_output
+ * (the old one is then freed), and returns the message, or NULL to drop it.
+ * It never sees the end of stream message.
+ * @param process_msg Plugin-specific message processing function
+ * @param name Plugin name
+ * @param queue_size Maximum number of items that can be queued
+ * @param flags PLUGIN_STATELESS if the stage may run several workers
+ * @return NULL on success, error message on failure
+ */
+const char* common_plugin_init_msg(plugin_msg_t* (*process_msg)(plugin_msg_t*), const char* name, int queue_size, int flags);
+
+/**
+ * Give the instance being initialized a hook, for a stage whose output
+ * outlives one item (buffered writes, paced output). Call from plugin_init
+ * before common_plugin_init*; the stage then runs one worker and is never
+ * fused. The hook gets every processed batch, the flush and end tokens
+ * before they are passed on, the abort, and a tick every tick_ms - ticks keep
+ * their schedule while items arrive. PLUGIN_HOOK_FINI comes last.
+ * @param hook The hook
+ * @param state Passed to every call
+ * @param tick_ms Interval of PLUGIN_HOOK_TICK, 0 for none
+ * @return NULL on success, error message on failure
+ */
+const char* common_plugin_set_hook(plugin_hook_t hook, void* state, int tick_ms);
+
+/**
+ * Read a setting given with the stage ("stage NAME key=value" in a config
+ * file, or "name key=value" on the command line). Call from plugin_init
+ * before common_plugin_init*, which fails if the stage was given a setting
+ * the plugin never asked for
+ * @param key The setting's name
+ * @return Its value, valid until plugin_init returns, or NULL if not given
+ */
+const char* common_plugin_option(const char* key);
+
+/**
+ * Write every byte of an iovec array, resuming after short writes
+ * @param fd File descriptor
+ * @param iov The buffers (changed as bytes are written)
+ * @param count Number of buffers
+ * @return 0 on success, -1 with errno set on failure
+ */
+int common_write_all(int fd, struct iovec* iov, int count);
+
 /**
  * Initialize the plugin with the specified queue size - calls common_plugin_init
  * This function should be implemented by each plugin
@@ -66,6 +187,225 @@ const char* common_plugin_init(const char* (*process_function)(const char*), con
 __attribute__((visibility("default")))
 const char* plugin_init(int queue_size);
 
+/**
+ * Create a new, independent instance of this plugin with its own queue and threads.
+ * Runs the plugin's plugin_init, so existing plugins need no changes.
+ * Not thread-safe - create instances from one thread during setup.
+ * @param config Queue size and number of workers (more than one needs PLUGIN_STATELESS)
+ * @param instance Receives the instance handle
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_instance_init(const plugin_config_t* config, plugin_context_t** instance);
+
+/**
+ * Finalize an instance - terminate its thread gracefully and release it
+ * @param instance Instance handle (invalid afterwards)
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_instance_fini(plugin_context_t* instance);
+
+/**
+ * Place work (a string) into an instance's queue
+ * @param instance Instance handle
+ * @param str The string to process (copied)
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_instance_place_work(plugin_context_t* instance, const char* str);
+
+/**
+ * Place work (a heap string) into an instance's queue without copying it
+ * @param instance Instance handle
+ * @param str The string to process (instance takes ownership on success)
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_instance_place_work_owned(plugin_context_t* instance, char* str);
+
+/**
+ * Place several heap strings into an instance's queue without copying them
+ * @param instance Instance handle
+ * @param items The strings to process, in order
+ * @param count Number of strings
+ * @return Number of strings queued (instance owns those, caller keeps the rest)
+ */
+__attribute__((visibility("default")))
+int plugin_instance_place_work_batch(plugin_context_t* instance, char** items, int count);
+
+/**
+ * Set how many queued items an instance takes per wakeup
+ * @param instance Instance handle
+ * @param batch_size 1..PLUGIN_MAX_BATCH
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_instance_set_batch_size(plugin_context_t* instance, int batch_size);
+
+/**
+ * Change how many items an instance's queue holds - safe while it runs, from
+ * any thread; items above a lowered capacity stay queued
+ * @param instance Instance handle
+ * @param capacity New queue capacity
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_instance_set_queue_capacity(plugin_context_t* instance, int capacity);
+
+/**
+ * Pin an instance's consumer threads to cpus, and move its queue to the NUMA
+ * node of the first one (where the kernel allows it)
+ * @param instance Instance handle
+ * @param cpus Worker i runs on cpus[i % count]
+ * @param count Number of cpus
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_instance_set_cpus(plugin_context_t* instance, const int* cpus, int count);
+
+/**
+ * Choose how an instance's queue waits when it is empty or full - safe while
+ * it runs; a queue shared by several workers always sleeps
+ * @param instance Instance handle
+ * @param wait PLUGIN_WAIT_PARK, PLUGIN_WAIT_YIELD or PLUGIN_WAIT_SPIN
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_instance_set_wait(plugin_context_t* instance, int wait);
+
+/**
+ * Attach an instance to the next instance in the chain (which may belong to another plugin)
+ * @param instance Instance handle
+ * @param next_place_work_batch The next plugin's plugin_instance_place_work_batch
+ * @param next_instance The next instance handle
+ */
+__attribute__((visibility("default")))
+void plugin_instance_attach(plugin_context_t* instance, int (*next_place_work_batch)(plugin_context_t*, char**, int), plugin_context_t* next_instance);
+
+/**
+ * Wait until an instance has finished processing all work
+ * @param instance Instance handle
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_instance_wait_finished(plugin_context_t* instance);
+
+/**
+ * Get an instance's behaviour flags
+ * @param instance Instance handle
+ * @return PLUGIN_* flags the plugin initialized with, 0 for an invalid instance
+ */
+__attribute__((visibility("default")))
+int plugin_instance_get_flags(plugin_context_t* instance);
+
+/**
+ * Run a fused instance's process function on one item - called from the
+ * consumer thread of the instance it was fused into
+ * @param instance Fused instance handle
+ * @param item Heap string (ownership moves in, as for the process function)
+ * @return The processed heap string, or NULL if the item was dropped
+ */
+__attribute__((visibility("default")))
+char* plugin_instance_process(plugin_context_t* instance, char* item);
+
+/**
+ * Fuse an instance into another one's consumer thread: items are run through
+ * fused_instance right after instance (and anything fused into it before),
+ * with no queue or thread handoff in between. Setup only, before any work.
+ * @param instance Instance whose thread runs the fused group
+ * @param process The fused plugin's plugin_instance_process
+ * @param fused_instance Instance created with plugin_config_t.fused set
+ */
+__attribute__((visibility("default")))
+void plugin_instance_fuse(plugin_context_t* instance, char* (*process)(plugin_context_t*, char*), plugin_context_t* fused_instance);
+
+/**
+ * Place several messages into an instance's queue without copying them
+ * @param instance Instance handle
+ * @param msgs The messages, in order
+ * @param count Number of messages
+ * @return Number of messages queued (instance owns those, caller keeps the rest)
+ */
+__attribute__((visibility("default")))
+int plugin_instance_place_msgs(plugin_context_t* instance, plugin_msg_t** msgs, int count);
+
+/**
+ * Attach an instance to the next instance in the chain, moving messages to it
+ * @param instance Instance handle
+ * @param next_place_msgs The next plugin's plugin_instance_place_msgs
+ * @param next_instance The next instance handle
+ */
+__attribute__((visibility("default")))
+void plugin_instance_attach_msgs(plugin_context_t* instance, int (*next_place_msgs)(plugin_context_t*, plugin_msg_t**, int), plugin_context_t* next_instance);
+
+/**
+ * Run a fused instance's process function on one message - called from the
+ * consumer thread of the instance it was fused into
+ * @param instance Fused instance handle
+ * @param msg The message (ownership moves in)
+ * @return The processed message, or NULL if it was dropped
+ */
+__attribute__((visibility("default")))
+plugin_msg_t* plugin_instance_process_msg(plugin_context_t* instance, plugin_msg_t* msg);
+
+/**
+ * Like plugin_instance_fuse, with the fused plugin's plugin_instance_process_msg
+ * @param instance Instance whose thread runs the fused group
+ * @param process_msg The fused plugin's plugin_instance_process_msg
+ * @param fused_instance Instance created with plugin_config_t.fused set
+ */
+__attribute__((visibility("default")))
+void plugin_instance_fuse_msg(plugin_context_t* instance, plugin_msg_t* (*process_msg)(plugin_context_t*, plugin_msg_t*), plugin_context_t* fused_instance);
+
+/**
+ * Send a control token to an instance's queue. The stage passes it on to the
+ * next instance in order: a flush after the items placed before it, the end
+ * of stream once every item is forwarded. An abort drops what is queued and
+ * is passed on at once. A flush must come from the thread placing work.
+ * @param instance Instance handle
+ * @param control PLUGIN_CONTROL_FLUSH, PLUGIN_CONTROL_EOS or PLUGIN_CONTROL_ABORT
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_instance_control(plugin_context_t* instance, int control);
+
+/**
+ * Pass an instance's control tokens to the next instance's control function.
+ * Call after plugin_instance_attach / plugin_instance_attach_msgs, which clear
+ * it; without it only the end of stream is passed on, in band.
+ * @param instance Instance handle
+ * @param next_control The next plugin's plugin_instance_control
+ */
+__attribute__((visibility("default")))
+void plugin_instance_attach_control(plugin_context_t* instance, const char* (*next_control)(plugin_context_t*, int));
+
+/**
+ * Check whether the instance whose thread is calling was aborted - for a
+ * transform that takes long, so an abort does not wait for it
+ * @return 1 if aborted, 0 otherwise
+ */
+__attribute__((visibility("default")))
+int plugin_cancelled(void);
+
+/**
+ * Read an instance's counters without locking - the queue counters come from
+ * the queue, the rest are added to by the consumer threads once per batch
+ * @param instance Instance handle
+ * @param stats Receives the counters
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_instance_get_stats(plugin_context_t* instance, plugin_stats_t* stats);
+
+/**
+ * Read the plugin's counters (see plugin_instance_get_stats)
+ * @param stats Receives the counters
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_get_stats(plugin_stats_t* stats);
+
 /**
  * Finalize the plugin - drain queue and terminate thread gracefully (i.e. pthread_join)
  * @return NULL on success, error message on failure
@@ -81,6 +421,32 @@ const char* plugin_fini(void);
 __attribute__((visibility("default")))
 const char* plugin_place_work(const char* str);
 
+/**
+ * Place work (a heap string) into the plugin's queue without copying it
+ * @param str The string to process (plugin takes ownership on success, caller keeps it on failure)
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_place_work_owned(char* str);
+
+/**
+ * Place several heap strings into the plugin's queue without copying them
+ * @param items The strings to process, in order
+ * @param count Number of strings
+ * @return Number of strings queued (plugin owns those, caller keeps the rest)
+ */
+__attribute__((visibility("default")))
+int plugin_place_work_batch(char** items, int count);
+
+/**
+ * Set how many queued items the consumer thread takes per wakeup and forwards
+ * to the next plugin in one call
+ * @param batch_size 1..PLUGIN_MAX_BATCH
+ * @return NULL on success, error message on failure
+ */
+__attribute__((visibility("default")))
+const char* plugin_set_batch_size(int batch_size);
+
 /**
  * Attach this plugin to the next plugin in the chain
  * @param next_place_work Function pointer to the next plugin's place_work function
@@ -88,6 +454,22 @@ const char* plugin_place_work(const char* str);
 __attribute__((visibility("default")))
 void plugin_attach(const char* (*next_place_work)(const char*));
 
+/**
+ * Attach this plugin to the next plugin in the chain, moving buffers to it
+ * Takes precedence over plugin_attach
+ * @param next_place_work_owned Function pointer to the next plugin's place_work_owned function
+ */
+__attribute__((visibility("default")))
+void plugin_attach_owned(const char* (*next_place_work_owned)(char*));
+
+/**
+ * Attach this plugin to the next plugin in the chain, moving whole batches to it
+ * Takes precedence over plugin_attach_owned and plugin_attach
+ * @param next_place_work_batch Function pointer to the next plugin's place_work_batch function
+ */
+__attribute__((visibility("default")))
+void plugin_attach_batch(int (*next_place_work_batch)(char**, int));
+
 /**
  * Wait until the plugin has finished processing all work and is ready to shutdown
  * This is a blocking function used for graceful shutdown coordination
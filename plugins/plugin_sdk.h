@@ -1,6 +1,85 @@
 #ifndef PLUGIN_SDK_H
 #define PLUGIN_SDK_H
 
+#include <stddef.h>
+
+/* Plugin behaviour flags, see plugin_instance_get_flags */
+#define PLUGIN_STATELESS 0x1    /* output depends only on the current item, so items may be processed in parallel */
+#define PLUGIN_READ_ONLY 0x2    /* never changes the messages it is given, so one shared with other branches is not copied first */
+
+/* Control tokens, see plugin_instance_control - they travel beside the items, not as items */
+#define PLUGIN_CONTROL_FLUSH 1  /* pass on everything placed before it, then the token */
+#define PLUGIN_CONTROL_EOS 2    /* end of stream: drain the queue, pass the end on, stop */
+#define PLUGIN_CONTROL_ABORT 3  /* stop at once: queued items are dropped, the abort is passed on */
+
+/* Wait strategies, see plugin_instance_set_wait - how a stage's queue waits when it is empty or full */
+#define PLUGIN_WAIT_PARK 0      /* sleep at once: no cpu spent waiting, a wakeup per wait (default) */
+#define PLUGIN_WAIT_YIELD 1     /* yield the cpu a few times, then sleep */
+#define PLUGIN_WAIT_SPIN 2      /* spin a bounded number of rounds, then yield, then sleep: lowest latency, burns a cpu */
+
+/* Message flags, see plugin_msg_t */
+#define PLUGIN_MSG_END 0x1      /* end of the stream as a message, for hosts without control tokens: no payload, nothing follows it */
+#define PLUGIN_MSG_BORROWED 0x2 /* data is the host's (a line of a mapped input), not a pool buffer: read it, never change or free it -
+                                   a stage that changes messages gets a copy first, and there is no NUL after it */
+
+/* One item travelling through the chain (v2 ABI) - replaces the NUL-terminated
+   strings of the v1 functions, which every stage had to measure and compare
+   against "<END>" */
+typedef struct {
+    char* data;             /* Payload, a pool buffer (see plugin_alloc_output) unless borrowed; may contain NULs */
+    size_t len;             /* Payload bytes */
+    size_t capacity;        /* Bytes data can hold, not counting one more kept for a NUL */
+    unsigned int flags;     /* PLUGIN_MSG_* */
+} plugin_msg_t;
+
+/* Opaque handle of one plugin instance */
+typedef struct plugin_context plugin_instance_t;
+
+/* Work an executor runs - a stage whose queue has items, run on one thread at
+   a time until it is empty or has had its turn */
+typedef struct plugin_task {
+    void (*run)(struct plugin_task* task);
+    int order;          /* Position of the stage in the chain, see plugin_config_t.order */
+} plugin_task_t;
+
+/* A pool of threads the host shares between stages, instead of a thread per
+   stage - the host provides it, plugins only call through it */
+typedef struct plugin_executor {
+    /* Queue a task to be run once by some thread of the pool (any thread may call) */
+    void (*submit)(struct plugin_executor* executor, plugin_task_t* task);
+    /* Called by a thread that would wait on a full queue: a pool thread runs a
+       task of a later stage, or waits a little for one, and returns 1; any
+       other thread returns 0 and should wait as usual */
+    int (*help)(struct plugin_executor* executor);
+    /* Have every pool thread call fn before it exits, e.g. to return its
+       buffer caches (calling it again with the same fn adds nothing) */
+    void (*at_thread_exit)(struct plugin_executor* executor, void (*fn)(void));
+} plugin_executor_t;
+
+/* Settings for a new plugin instance */
+typedef struct {
+    int queue_size;     /* Maximum number of items that can be queued */
+    int workers;        /* Threads processing the queue; output keeps input order */
+    int fused;          /* No queue or threads: run by another instance via plugin_instance_fuse */
+    int producers;      /* Threads placing work (branches merging into the instance), 0 or 1 for one */
+    plugin_executor_t* executor; /* Run a single worker stage as tasks on this pool instead of its own thread, or NULL */
+    int order;          /* Position in the chain - every stage feeding this one has a lower one (with an executor) */
+    char* const* options; /* "key=value" settings given with the stage, see common_plugin_option, or NULL */
+    int option_count;   /* Number of options */
+} plugin_config_t;
+
+/* Counters of one instance, see plugin_instance_get_stats */
+typedef struct {
+    unsigned long long items_in;            /* Items processed (taken from the queue, or handed in when fused) */
+    unsigned long long items_out;           /* Items forwarded (items_in minus dropped ones) */
+    unsigned long long bytes_in;            /* Bytes of the items processed */
+    unsigned long long process_ns;          /* Time in the process function (of the whole group when fused into) */
+    unsigned long long put_wait_ns;         /* Time producers were blocked on the full queue (backpressure from this stage) */
+    unsigned long long get_wait_ns;         /* Time the instance's threads were blocked on the empty queue (starvation) */
+    unsigned long long queue_high_water;    /* Most items found waiting in the queue */
+    unsigned long long queue_capacity;      /* Queue capacity, 0 when fused */
+} plugin_stats_t;
+
 /** 
  * Get the plugin's name * 
  * @return The plugin's name (should not be modified or freed) 
@@ -22,10 +101,141 @@ const char* plugin_fini(void);
  * @param str The string to process (plugin takes ownership if it allocates new memory) * 
  * @return NULL on success, error message on failure */ 
 const char* plugin_place_work(const char* str); 
+/** 
+ * Place work (a pool buffer, see buffer_pool_alloc) into the plugin's queue without copying it * 
+ * @param str The string to process (plugin takes ownership on success) * 
+ * @return NULL on success, error message on failure */ 
+const char* plugin_place_work_owned(char* str); 
+/** 
+ * Place several pool buffers into the plugin's queue without copying them * 
+ * @param items The strings to process * @param count Number of strings * 
+ * @return Number of strings queued (plugin owns those, caller keeps the rest) */ 
+int plugin_place_work_batch(char** items, int count); 
+/** 
+ * Set how many queued items are processed and forwarded per wakeup * 
+ * @param batch_size 1..PLUGIN_MAX_BATCH * 
+ * @return NULL on success, error message on failure */ 
+const char* plugin_set_batch_size(int batch_size); 
 /** 
  * * Attach this plugin to the next plugin in the chain * 
  * @param next_place_work Function pointer to the next plugin's place_work function */ 
 void plugin_attach(const char* (*next_place_work)(const char*)); 
+/** 
+ * Attach this plugin to the next plugin, moving buffers instead of copying * 
+ * @param next_place_work_owned Function pointer to the next plugin's place_work_owned function */ 
+void plugin_attach_owned(const char* (*next_place_work_owned)(char*)); 
+/** 
+ * Attach this plugin to the next plugin, moving whole batches to it * 
+ * @param next_place_work_batch Function pointer to the next plugin's place_work_batch function */ 
+void plugin_attach_batch(int (*next_place_work_batch)(char**, int)); 
+/** 
+ * Create a new, independent instance of the plugin (own queue and threads) * 
+ * @param config Queue size and worker count (several workers need a stateless plugin) * 
+ * @param instance Receives the instance handle * 
+ * @return NULL on success, error message on failure */ 
+const char* plugin_instance_init(const plugin_config_t* config, plugin_instance_t** instance); 
+/** 
+ * Finalize an instance - terminate its thread gracefully * 
+ * @return NULL on success, error message on failure */ 
+const char* plugin_instance_fini(plugin_instance_t* instance); 
+/** 
+ * Place work (a string) into an instance's queue (copied) * 
+ * @return NULL on success, error message on failure */ 
+const char* plugin_instance_place_work(plugin_instance_t* instance, const char* str); 
+/** 
+ * Place work (a pool buffer, see buffer_pool_alloc) into an instance's queue without copying it * 
+ * @return NULL on success, error message on failure */ 
+const char* plugin_instance_place_work_owned(plugin_instance_t* instance, char* str); 
+/** 
+ * Place several pool buffers into an instance's queue without copying them * 
+ * @return Number of strings queued (instance owns those, caller keeps the rest) */ 
+int plugin_instance_place_work_batch(plugin_instance_t* instance, char** items, int count); 
+/** 
+ * Set how many queued items an instance processes and forwards per wakeup * 
+ * @return NULL on success, error message on failure */ 
+const char* plugin_instance_set_batch_size(plugin_instance_t* instance, int batch_size); 
+/** 
+ * Change how many items an instance's queue holds, while it runs (optional) * 
+ * @return NULL on success, error message on failure (a fused instance has no queue) */ 
+const char* plugin_instance_set_queue_capacity(plugin_instance_t* instance, int capacity); 
+/** 
+ * Pin an instance's threads to cpus, worker i to cpus[i % count], and move its queue to their NUMA node (optional) * 
+ * @return NULL on success, error message on failure (a fused instance has no threads) */ 
+const char* plugin_instance_set_cpus(plugin_instance_t* instance, const int* cpus, int count); 
+/** 
+ * Choose how an instance's queue waits, one of PLUGIN_WAIT_* (optional) * 
+ * @return NULL on success, error message on failure (a fused instance has no queue) */ 
+const char* plugin_instance_set_wait(plugin_instance_t* instance, int wait); 
+/** 
+ * Attach an instance to the next instance, possibly of another plugin * 
+ * @param next_place_work_batch The next plugin's plugin_instance_place_work_batch * 
+ * @param next_instance The next instance handle */ 
+void plugin_instance_attach(plugin_instance_t* instance, int (*next_place_work_batch)(plugin_instance_t*, char**, int), plugin_instance_t* next_instance); 
+/** 
+ * Wait until an instance has finished processing all work * 
+ * @return NULL on success, error message on failure */ 
+const char* plugin_instance_wait_finished(plugin_instance_t* instance); 
+/** 
+ * Get an instance's PLUGIN_* behaviour flags * 
+ * @return The flags, 0 for an invalid instance */ 
+int plugin_instance_get_flags(plugin_instance_t* instance); 
+/** 
+ * Run a fused instance's transform on one pool buffer (ownership semantics of the process function) * 
+ * @return The processed string, or NULL if it was dropped */ 
+char* plugin_instance_process(plugin_instance_t* instance, char* item); 
+/** 
+ * Run a fused instance in the consumer thread of instance, after its own transform and any stage fused earlier * 
+ * @param process The fused plugin's plugin_instance_process * 
+ * @param fused_instance Instance created with plugin_config_t.fused set */ 
+void plugin_instance_fuse(plugin_instance_t* instance, char* (*process)(plugin_instance_t*, char*), plugin_instance_t* fused_instance); 
+/** 
+ * Place several messages into an instance's queue (v2 ABI) - no copy, no scan * 
+ * @param msgs The messages, see plugin_msg_t * @param count Number of messages * 
+ * @return Number of messages queued (instance owns those, caller keeps the rest) */ 
+int plugin_instance_place_msgs(plugin_instance_t* instance, plugin_msg_t** msgs, int count); 
+/** 
+ * Attach an instance to the next instance, moving messages to it (v2 ABI) * 
+ * @param next_place_msgs The next plugin's plugin_instance_place_msgs * 
+ * @param next_instance The next instance handle */ 
+void plugin_instance_attach_msgs(plugin_instance_t* instance, int (*next_place_msgs)(plugin_instance_t*, plugin_msg_t**, int), plugin_instance_t* next_instance); 
+/** 
+ * Run a fused instance's transform on one message (v2 ABI) * 
+ * @return The message, or NULL if it was dropped (and freed) */ 
+plugin_msg_t* plugin_instance_process_msg(plugin_instance_t* instance, plugin_msg_t* msg); 
+/** 
+ * Like plugin_instance_fuse, with the fused plugin's plugin_instance_process_msg (v2 ABI) */ 
+void plugin_instance_fuse_msg(plugin_instance_t* instance, plugin_msg_t* (*process_msg)(plugin_instance_t*, plugin_msg_t*), plugin_instance_t* fused_instance); 
+/** 
+ * Send a control token to an instance - a flush must come from the thread placing work * 
+ * @param control PLUGIN_CONTROL_FLUSH, PLUGIN_CONTROL_EOS or PLUGIN_CONTROL_ABORT * 
+ * @return NULL on success, error message on failure */ 
+const char* plugin_instance_control(plugin_instance_t* instance, int control); 
+/** 
+ * Pass an instance's control tokens on to the next instance (call after attaching it) * 
+ * @param next_control The next plugin's plugin_instance_control */ 
+void plugin_instance_attach_control(plugin_instance_t* instance, const char* (*next_control)(plugin_instance_t*, int)); 
+/** 
+ * Check whether the instance running the calling thread was aborted - a transform 
+ * that takes long polls this to stop early * 
+ * @return 1 if aborted, 0 otherwise */ 
+int plugin_cancelled(void); 
+/** 
+ * Read an instance's counters - safe from any thread while the instance runs, takes no lock * 
+ * @param stats Receives the counters * 
+ * @return NULL on success, error message on failure */ 
+const char* plugin_instance_get_stats(plugin_instance_t* instance, plugin_stats_t* stats); 
+/** 
+ * Read the plugin's counters - safe from any thread, takes no lock * 
+ * @param stats Receives the counters * 
+ * @return NULL on success, error message on failure */ 
+const char* plugin_get_stats(plugin_stats_t* stats); 
+/** 
+ * Get a buffer for a transform's output, to return instead of the input * 
+ * Buffers from here are recycled through the pipeline's buffer pool; a transform 
+ * may still return a malloc'd buffer, at the cost of a copy * 
+ * @param size Bytes needed, including the NUL * 
+ * @return The buffer, or NULL if out of memory */ 
+char* plugin_alloc_output(size_t size); 
 /** * Wait until the plugin has finished processing all work and is ready to shutdown 
 * This is a blocking function used for graceful shutdown coordination * 
 @return NULL on success, error message on failure */ 
@@ -1,24 +1,11 @@
 #include "plugin_common.h"
-#include <stdlib.h>
-#include <string.h>
+#include "simd/text_kernels.h"
 
-// rotate the string one char right 
-static const char* plugin_transform(const char* input) {
-    if (input) {
-        size_t len = strlen(input);
-        if (len > 0) {
-            char* out = malloc(len + 1);
-            if (out) {
-                out[0] = input[len - 1]; // last char first
-                for (size_t i = 1; i < len; i++) {
-                    out[i] = input[i - 1]; // shift rest
-                }
-                out[len] = '\0';
-                return out;
-            }
-        }
-    }
-    return NULL;
+// rotate the message one char right, in place - an empty one is dropped
+static plugin_msg_t* plugin_transform(plugin_msg_t* msg) {
+    if (msg->len == 0) return NULL;
+    text_kernels->rotate_right(msg->data, msg->len); // last char first, shift rest
+    return msg;
 }
 
 const char* plugin_get_name(void) {
@@ -26,5 +13,5 @@ const char* plugin_get_name(void) {
 }
 
 const char* plugin_init(int queue_size) {
-    return common_plugin_init(plugin_transform, "rotator", queue_size);
+    return common_plugin_init_msg(plugin_transform, "rotator", queue_size, PLUGIN_STATELESS);
 }
\ No newline at end of file
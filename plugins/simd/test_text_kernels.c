@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include "text_kernels.h"
+
+// every implementation, slowest first
+static const text_kernels_t* all_kernels[] = {
+    &text_kernels_scalar,
+#if defined(__x86_64__) || defined(__i386__)
+    &text_kernels_sse2,
+    &text_kernels_avx2,
+#endif
+};
+#define KERNEL_COUNT (sizeof(all_kernels) / sizeof(all_kernels[0]))
+
+#define MAX_LEN 1100
+#define MAX_OFFSET 7
+
+static unsigned int seed = 12345;
+
+// random bytes, weighted to the edges of a-z and including bytes >= 0x80
+static void fill_random(char* buf, size_t len) {
+    static const char edges[] = "`az{@AZ[ ";
+    for (size_t i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        unsigned int r = (seed >> 16) & 0x7fff;
+        if (r % 3 == 0) buf[i] = edges[r % (sizeof(edges) - 1)];
+        else buf[i] = (char)(r % 255 + 1); // no NUL inside the string
+    }
+}
+
+/* === TESTS === */
+
+// 1. In place kernels match scalar for every length and alignment
+static void check_in_place(const char* what, size_t field) {
+    printf("Testing %s...\n", what);
+    char src[MAX_LEN + MAX_OFFSET + 1];
+    char want[MAX_LEN + MAX_OFFSET + 1];
+    char got[MAX_LEN + MAX_OFFSET + 1];
+
+    for (size_t k = 0; k < KERNEL_COUNT; k++) {
+        const text_kernels_t* kernels = all_kernels[k];
+        if (!text_kernels_supported(kernels)) {
+            printf("  %s not supported here, skipped\n", kernels->name);
+            continue;
+        }
+        void (*fn)(char*, size_t) = *(void (**)(char*, size_t))((const char*)kernels + field);
+        void (*ref)(char*, size_t) = *(void (**)(char*, size_t))((const char*)&text_kernels_scalar + field);
+
+        for (size_t len = 0; len <= MAX_LEN; len++) {
+            for (size_t off = 0; off <= MAX_OFFSET; off += (len < 200 ? 1 : MAX_OFFSET)) {
+                fill_random(src, sizeof(src));
+                memcpy(want, src, sizeof(src));
+                memcpy(got, src, sizeof(src));
+
+                ref(want + off, len);
+                fn(got + off, len);
+                assert(memcmp(want, got, sizeof(src)) == 0); // bytes outside the range untouched too
+            }
+        }
+    }
+}
+
+// 2. Expand matches scalar, NUL included, and writes nothing past 2 * len
+static void test_expand(void) {
+    printf("Testing expand...\n");
+    char src[MAX_LEN + MAX_OFFSET + 1];
+    char want[2 * MAX_LEN + MAX_OFFSET + 16];
+    char got[2 * MAX_LEN + MAX_OFFSET + 16];
+
+    for (size_t k = 0; k < KERNEL_COUNT; k++) {
+        const text_kernels_t* kernels = all_kernels[k];
+        if (!text_kernels_supported(kernels)) continue;
+
+        for (size_t len = 1; len <= MAX_LEN; len++) {
+            for (size_t off = 0; off <= MAX_OFFSET; off += (len < 200 ? 1 : MAX_OFFSET)) {
+                fill_random(src, sizeof(src));
+                memset(want, 'x', sizeof(want));
+                memset(got, 'x', sizeof(got));
+
+                text_kernels_scalar.expand(want + off, src + off, len);
+                kernels->expand(got + off, src + off, len);
+                assert(memcmp(want, got, sizeof(want)) == 0);
+                assert(got[off + 2 * len - 1] == '\0');
+                assert(got[off + 2 * len] == 'x');
+            }
+        }
+    }
+}
+
+// 3. Known answers for the scalar reference itself
+static void test_reference(void) {
+    printf("Testing scalar reference...\n");
+    char buf[64];
+
+    strcpy(buf, "hello, World `{@[");
+    text_kernels_scalar.upper(buf, strlen(buf));
+    assert(strcmp(buf, "HELLO, WORLD `{@[") == 0);
+
+    strcpy(buf, "abcde");
+    text_kernels_scalar.reverse(buf, strlen(buf));
+    assert(strcmp(buf, "edcba") == 0);
+
+    strcpy(buf, "abcde");
+    text_kernels_scalar.rotate_right(buf, strlen(buf));
+    assert(strcmp(buf, "eabcd") == 0);
+
+    text_kernels_scalar.expand(buf, "abc", 3);
+    assert(strcmp(buf, "a b c") == 0);
+    text_kernels_scalar.expand(buf, "a", 1);
+    assert(strcmp(buf, "a") == 0);
+}
+
+// 4. The picked set is one this cpu supports
+static void test_dispatch(void) {
+    printf("Testing dispatch...\n");
+    assert(text_kernels != NULL);
+    assert(text_kernels_supported(text_kernels));
+    printf("  picked %s\n", text_kernels->name);
+}
+
+/* === MAIN === */
+int main() {
+    printf("Starting text kernel tests...\n\n");
+
+    test_reference();
+    check_in_place("upper", offsetof(text_kernels_t, upper));
+    check_in_place("reverse", offsetof(text_kernels_t, reverse));
+    check_in_place("rotate_right", offsetof(text_kernels_t, rotate_right));
+    test_expand();
+    test_dispatch();
+
+    printf("\n🎉 All tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,217 @@
+#include "text_kernels.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TEXT_KERNELS_X86 1
+#endif
+
+/* === scalar - the reference every other implementation must match === */
+
+static void upper_scalar(char* s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] >= 'a' && s[i] <= 'z') s[i] -= 'a' - 'A';
+    }
+}
+
+static void reverse_scalar(char* s, size_t len) {
+    for (size_t i = 0; i < len / 2; i++) {
+        char tmp = s[i];
+        s[i] = s[len - i - 1];
+        s[len - i - 1] = tmp;
+    }
+}
+
+static void rotate_right_scalar(char* s, size_t len) {
+    if (len < 2) return;
+    char last = s[len - 1];
+    for (size_t i = len - 1; i > 0; i--) s[i] = s[i - 1];
+    s[0] = last;
+}
+
+// expand src[from, len) - the tail the vector loops leave over
+static void expand_tail(char* dst, const char* src, size_t from, size_t len) {
+    for (size_t i = from; i < len; i++) {
+        dst[2 * i] = src[i];
+        if (i < len - 1) dst[2 * i + 1] = ' ';
+    }
+    dst[2 * len - 1] = '\0';
+}
+
+static void expand_scalar(char* dst, const char* src, size_t len) {
+    expand_tail(dst, src, 0, len);
+}
+
+// one memmove, which libc already runs with the widest vectors it has
+static void rotate_right_memmove(char* s, size_t len) {
+    if (len < 2) return;
+    char last = s[len - 1];
+    memmove(s + 1, s, len - 1);
+    s[0] = last;
+}
+
+const text_kernels_t text_kernels_scalar = {
+    "scalar", upper_scalar, reverse_scalar, rotate_right_scalar, expand_scalar
+};
+
+#ifdef TEXT_KERNELS_X86
+
+/* === sse2 - 16 bytes at a time === */
+
+// lanes holding a-z: shift a..z to the bottom of the signed range, then one compare
+static inline __m128i lower_mask_sse2(__m128i v) {
+    __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - 'a')));
+    return _mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(0x80 + 26)));
+}
+
+static void upper_sse2(char* s, size_t len) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        v = _mm_xor_si128(v, _mm_and_si128(lower_mask_sse2(v), _mm_set1_epi8(0x20)));
+        _mm_storeu_si128((__m128i*)(s + i), v);
+    }
+    upper_scalar(s + i, len - i);
+}
+
+// reverse 16 bytes - swap the bytes of each word, then the words (sse2 has no byte shuffle)
+static inline __m128i reverse16_sse2(__m128i v) {
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    return _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+}
+
+// reverse s[i, j) by swapping reversed blocks from both ends
+static void reverse_blocks_sse2(char* s, size_t i, size_t j) {
+    while (j - i >= 32) {
+        __m128i front = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i back = _mm_loadu_si128((const __m128i*)(s + j - 16));
+        _mm_storeu_si128((__m128i*)(s + i), reverse16_sse2(back));
+        _mm_storeu_si128((__m128i*)(s + j - 16), reverse16_sse2(front));
+        i += 16;
+        j -= 16;
+    }
+    reverse_scalar(s + i, j - i);
+}
+
+static void reverse_sse2(char* s, size_t len) {
+    reverse_blocks_sse2(s, 0, len);
+}
+
+// expand src[from, len) 16 bytes at a time - interleave each byte with a space
+static void expand_from_sse2(char* dst, const char* src, size_t from, size_t len) {
+    const __m128i spaces = _mm_set1_epi8(' ');
+    size_t i = from;
+    for (; i + 16 < len; i += 16) { // strictly less: the last byte gets no space after it
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + 2 * i), _mm_unpacklo_epi8(v, spaces));
+        _mm_storeu_si128((__m128i*)(dst + 2 * i + 16), _mm_unpackhi_epi8(v, spaces));
+    }
+    expand_tail(dst, src, i, len);
+}
+
+static void expand_sse2(char* dst, const char* src, size_t len) {
+    expand_from_sse2(dst, src, 0, len);
+}
+
+const text_kernels_t text_kernels_sse2 = {
+    "sse2", upper_sse2, reverse_sse2, rotate_right_memmove, expand_sse2
+};
+
+/* === avx2 - 32 bytes at a time, the sse2 loops finish the tail === */
+
+__attribute__((target("avx2")))
+static void upper_avx2(char* s, size_t len) {
+    const __m256i bias = _mm256_set1_epi8((char)(0x80 - 'a'));
+    const __m256i limit = _mm256_set1_epi8((char)(0x80 + 26));
+    const __m256i bit = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i lower = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(v, bias));
+        _mm256_storeu_si256((__m256i*)(s + i), _mm256_xor_si256(v, _mm256_and_si256(lower, bit)));
+    }
+    upper_sse2(s + i, len - i);
+}
+
+// reverse 32 bytes - reverse each 128 bit lane with a shuffle, then swap the lanes
+__attribute__((target("avx2")))
+static inline __m256i reverse32_avx2(__m256i v) {
+    const __m256i order = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                           15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    v = _mm256_shuffle_epi8(v, order);
+    return _mm256_permute2x128_si256(v, v, 0x01);
+}
+
+__attribute__((target("avx2")))
+static void reverse_avx2(char* s, size_t len) {
+    size_t i = 0, j = len;
+    while (j - i >= 64) {
+        __m256i front = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i back = _mm256_loadu_si256((const __m256i*)(s + j - 32));
+        _mm256_storeu_si256((__m256i*)(s + i), reverse32_avx2(back));
+        _mm256_storeu_si256((__m256i*)(s + j - 32), reverse32_avx2(front));
+        i += 32;
+        j -= 32;
+    }
+    reverse_blocks_sse2(s, i, j);
+}
+
+__attribute__((target("avx2")))
+static void expand_avx2(char* dst, const char* src, size_t len) {
+    const __m256i spaces = _mm256_set1_epi8(' ');
+    size_t i = 0;
+    for (; i + 32 < len; i += 32) {
+        // unpack works inside 128 bit lanes, so first put bytes 0-7 and 8-15
+        // in the low halves of the two lanes and bytes 16-31 in the high halves
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        v = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i*)(dst + 2 * i), _mm256_unpacklo_epi8(v, spaces));
+        _mm256_storeu_si256((__m256i*)(dst + 2 * i + 32), _mm256_unpackhi_epi8(v, spaces));
+    }
+    expand_from_sse2(dst, src, i, len);
+}
+
+const text_kernels_t text_kernels_avx2 = {
+    "avx2", upper_avx2, reverse_avx2, rotate_right_memmove, expand_avx2
+};
+
+#endif
+
+const text_kernels_t* text_kernels = &text_kernels_scalar;
+
+// check whether this cpu can run an implementation
+int text_kernels_supported(const text_kernels_t* k) {
+    if (k == &text_kernels_scalar) return 1;
+#ifdef TEXT_KERNELS_X86
+    __builtin_cpu_init();
+    if (k == &text_kernels_sse2) return __builtin_cpu_supports("sse2");
+    if (k == &text_kernels_avx2) return __builtin_cpu_supports("avx2");
+#endif
+    return 0;
+}
+
+// pick the kernels when the plugin is loaded - the fastest supported set,
+// unless TEXT_KERNELS names another supported one
+__attribute__((constructor))
+static void text_kernels_pick(void) {
+    const text_kernels_t* all[] = {
+        &text_kernels_scalar,
+#ifdef TEXT_KERNELS_X86
+        &text_kernels_sse2,
+        &text_kernels_avx2,
+#endif
+    };
+    const char* want = getenv("TEXT_KERNELS");
+    const text_kernels_t* best = &text_kernels_scalar;
+    const text_kernels_t* wanted = NULL;
+
+    for (size_t i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+        if (!text_kernels_supported(all[i])) continue;
+        best = all[i]; // listed slowest first
+        if (want && strcmp(want, all[i]->name) == 0) wanted = all[i];
+    }
+    text_kernels = wanted ? wanted : best;
+}
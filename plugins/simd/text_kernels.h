@@ -0,0 +1,52 @@
+#ifndef TEXT_KERNELS_H
+#define TEXT_KERNELS_H
+
+#include <stddef.h>
+
+/**
+ * Per-character string kernels used by the transform plugins
+ * Every implementation gives byte-for-byte the same result as the scalar one;
+ * the best one the cpu supports is picked when the plugin is loaded
+ */
+
+/**
+ * One implementation of every kernel
+ */
+typedef struct {
+    const char* name;                                       /* "scalar", "sse2" or "avx2" */
+
+    /* Convert ASCII a-z to A-Z in place, other bytes are left alone */
+    void (*upper)(char* str, size_t len);
+
+    /* Reverse the bytes of str in place */
+    void (*reverse)(char* str, size_t len);
+
+    /* Move every byte one place right in place, the last byte becomes the first */
+    void (*rotate_right)(char* str, size_t len);
+
+    /* Write src (len > 0 bytes) to dst with a space between every two bytes,
+       NUL-terminated - dst needs 2 * len bytes */
+    void (*expand)(char* dst, const char* src, size_t len);
+} text_kernels_t;
+
+extern const text_kernels_t text_kernels_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+extern const text_kernels_t text_kernels_sse2;
+extern const text_kernels_t text_kernels_avx2;
+#endif
+
+/**
+ * Kernels picked for this cpu when the library was loaded - the
+ * TEXT_KERNELS environment variable (scalar, sse2, avx2) may ask for a
+ * slower set, for comparison
+ */
+extern const text_kernels_t* text_kernels;
+
+/**
+ * Check whether this cpu can run an implementation
+ * @param kernels Implementation to check
+ * @return 1 if supported, 0 otherwise
+ */
+int text_kernels_supported(const text_kernels_t* kernels);
+
+#endif
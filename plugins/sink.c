@@ -0,0 +1,318 @@
+#define _GNU_SOURCE
+#include "plugin_common.h"
+#include "sync/uring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// the sink writes every line it gets, through a large buffer, and passes the
+// lines on unchanged. Each sink of a chain is set up by its stage settings
+// ("stage sink output=FILE" in a config file, "sink output=FILE" on the
+// command line), and the environment gives the ones a stage leaves out:
+//   output=path    SINK_OUTPUT  write to a file instead of stdout
+//   flush=policy   SINK_FLUSH   size[:bytes] (default, 1 MiB), line, or time:ms
+//   direct=1       SINK_DIRECT  open the file with O_DIRECT, where the file system allows it
+//   uring=1        SINK_URING   write a full buffer through io_uring while filling a
+//                               second one, where the kernel has io_uring
+#define SINK_BUFFER (1 << 20)      // default buffer size
+#define SINK_BLOCK 4096            // O_DIRECT alignment of the buffer, the length and the file offset
+
+typedef enum {
+    SINK_FLUSH_SIZE,               // write when the buffer is full
+    SINK_FLUSH_LINE,               // write every batch as it comes
+    SINK_FLUSH_TIME                // write every tick
+} sink_policy_t;
+
+typedef struct {
+    int fd;
+    int close_fd;                  // the sink opened fd
+    int direct;                    // fd has O_DIRECT set
+    int failed;                    // a write failed, the rest of the output is dropped
+    sink_policy_t policy;
+    char* buf;                     // SINK_BLOCK aligned
+    size_t len;
+    size_t capacity;               // a multiple of SINK_BLOCK with O_DIRECT
+    size_t alloc;                  // bytes allocated for each buffer
+
+    // io_uring - spare is the buffer being written while buf fills up
+    uring_t* ring;                 // NULL writes with write(2)
+    char* bufs[2];                 // buf and spare, in the order they are registered
+    char* spare;
+    int writing;                   // a write of spare is in flight
+    size_t write_len;
+    unsigned long long ring_writes; // writes submitted to the ring, reported at the end
+} sink_t;
+
+// drop O_DIRECT for the rest of the output
+static void sink_direct_off(sink_t* s) {
+    int flags = fcntl(s->fd, F_GETFL);
+    if (flags >= 0) fcntl(s->fd, F_SETFL, flags & ~O_DIRECT);
+    s->direct = 0;
+}
+
+static void sink_write(sink_t* s, char* data, size_t len);
+
+// wait for the write in flight - what it left unwritten (a short write, or
+// one the kernel refused) goes out at once
+static void sink_wait(sink_t* s) {
+    if (!s->writing) return;
+    s->writing = 0;
+    unsigned long long what;
+    int res;
+    if (uring_wait(s->ring, &what, &res) != 0) res = 0;
+    size_t done = res > 0 ? (size_t)res : 0;
+    if (done < s->write_len) sink_write(s, s->spare + done, s->write_len - done);
+}
+
+// write buffers out - output that cannot be written is dropped, with one error
+static void sink_writev(sink_t* s, struct iovec* iov, int count) {
+    sink_wait(s); // what the ring is writing goes first
+    if (s->failed || count == 0) return;
+    if (common_write_all(s->fd, iov, count) == 0) return;
+    if (errno == EINVAL && s->direct) { // the file system took the open but not the write
+        sink_direct_off(s);
+        if (common_write_all(s->fd, iov, count) == 0) return;
+    }
+    fprintf(stderr, "[ERROR][sink] - write failed: %s\n", strerror(errno));
+    s->failed = 1;
+}
+
+static void sink_write(sink_t* s, char* data, size_t len) {
+    struct iovec iov = { data, len };
+    sink_writev(s, &iov, len > 0);
+}
+
+// write the first n bytes of the buffer through the ring, then fill the
+// other buffer (starting with the bytes after n) while the kernel writes
+static void sink_submit(sink_t* s, size_t n) {
+    sink_wait(s); // the spare is free again
+    char* out = s->buf;
+    if (n > 0 && !s->failed) {
+        if (uring_prep_rw(s->ring, 1, s->fd, out, (unsigned)n, out == s->bufs[0] ? 0 : 1, 0) == 0 &&
+            uring_submit(s->ring) == 0) {
+            s->writing = 1;
+            s->write_len = n;
+            s->ring_writes++;
+            s->buf = s->spare;
+            s->spare = out;
+            memcpy(s->buf, out + n, s->len - n);
+            s->len -= n;
+            return;
+        }
+        sink_write(s, out, n);
+    }
+    memmove(s->buf, s->buf + n, s->len - n);
+    s->len -= n;
+}
+
+// write the buffer out - with O_DIRECT only whole blocks go until the end of
+// the output, where the last, partial one is written without it
+static void sink_flush(sink_t* s, int end) {
+    size_t n = s->len;
+    if (s->ring && !end) {
+        sink_submit(s, s->direct ? n - n % SINK_BLOCK : n);
+        return;
+    }
+    if (s->direct) {
+        size_t whole = n - n % SINK_BLOCK;
+        sink_write(s, s->buf, whole);
+        if (!end || whole == n) n = whole;
+        if (n > whole) {
+            sink_direct_off(s);
+            sink_write(s, s->buf + whole, n - whole);
+        }
+    } else {
+        sink_write(s, s->buf, n);
+    }
+    memmove(s->buf, s->buf + n, s->len - n); // at most a partial block is kept
+    s->len -= n;
+}
+
+// copy into the buffer, writing it out whenever it fills up
+static void sink_copy(sink_t* s, const char* data, size_t len) {
+    while (len > 0) {
+        if (s->len == s->capacity) sink_flush(s, 0);
+        size_t n = s->capacity - s->len < len ? s->capacity - s->len : len;
+        memcpy(s->buf + s->len, data, n);
+        s->len += n;
+        data += n;
+        len -= n;
+    }
+}
+
+// take a processed batch - a line per message
+static void sink_add(sink_t* s, plugin_msg_t** msgs, int count) {
+    struct iovec iov[PLUGIN_MAX_BATCH * 2 + 1];
+    int n = 0;
+    size_t bytes = 0;
+    for (int i = 0; i < count; i++) bytes += msgs[i]->len + 1;
+
+    // the whole batch in one writev: every batch for the line policy, or a
+    // batch the buffer has no room for, after what the buffer holds - with a
+    // ring the buffers are filled and written by it instead
+    if (!s->direct && !s->ring && (s->policy == SINK_FLUSH_LINE || s->len + bytes > s->capacity)) {
+        if (s->len > 0) iov[n++] = (struct iovec){ s->buf, s->len };
+        for (int i = 0; i < count; i++) {
+            iov[n++] = (struct iovec){ msgs[i]->data, msgs[i]->len };
+            iov[n++] = (struct iovec){ (char*)"\n", 1 };
+        }
+        sink_writev(s, iov, n);
+        s->len = 0;
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        sink_copy(s, msgs[i]->data, msgs[i]->len);
+        sink_copy(s, "\n", 1);
+    }
+    if (s->policy == SINK_FLUSH_LINE) sink_flush(s, 0);
+}
+
+static int sink_hook(void* state, int event, plugin_msg_t** msgs, int count) {
+    sink_t* s = (sink_t*)state;
+    switch (event) {
+    case PLUGIN_HOOK_BATCH:
+        sink_add(s, msgs, count);
+        break;
+    case PLUGIN_HOOK_TICK:         // only the time policy has ticks
+    case PLUGIN_CONTROL_FLUSH:
+        sink_flush(s, 0);
+        break;
+    case PLUGIN_CONTROL_EOS:
+        sink_flush(s, 1);
+        break;
+    case PLUGIN_CONTROL_ABORT:
+        s->len = 0; // buffered output is dropped with the queued lines
+        break;
+    case PLUGIN_HOOK_FINI:
+        sink_flush(s, 1); // the stream may have ended without its end token
+        if (s->close_fd) close(s->fd);
+        if (s->ring) {
+            fprintf(stderr, "[INFO][sink] - %llu writes through io_uring\n", s->ring_writes);
+            uring_exit(s->ring); // nothing is in flight after the flush
+        }
+        free(s->ring);
+        free(s->buf);
+        free(s->spare);
+        free(s);
+        break;
+    }
+    return 0;
+}
+
+// a setting of the stage, or else of the environment
+static const char* sink_setting(const char* key, const char* env) {
+    const char* value = common_plugin_option(key);
+    return value ? value : getenv(env);
+}
+
+// parse the flush setting into the policy, the buffer size and the tick
+static const char* sink_parse_flush(const char* value, sink_t* s, size_t* size, int* tick_ms) {
+    char* end;
+    if (!value || strcmp(value, "size") == 0) return NULL;
+    if (strcmp(value, "line") == 0) {
+        s->policy = SINK_FLUSH_LINE;
+        return NULL;
+    }
+    if (strncmp(value, "size:", 5) == 0) {
+        long long bytes = strtoll(value + 5, &end, 10);
+        if (*end != '\0' || end == value + 5 || bytes <= 0 || bytes > (1LL << 30)) return "flush size is not valid";
+        *size = (size_t)bytes;
+        return NULL;
+    }
+    if (strncmp(value, "time:", 5) == 0) {
+        long ms = strtol(value + 5, &end, 10);
+        if (*end != '\0' || end == value + 5 || ms <= 0 || ms > 3600000) return "flush time is not valid";
+        s->policy = SINK_FLUSH_TIME;
+        *tick_ms = (int)ms;
+        return NULL;
+    }
+    return "flush is not line, size[:bytes] or time:ms";
+}
+
+// open the output - O_DIRECT falls back to normal writes where the file
+// system does not take it
+static const char* sink_open(sink_t* s) {
+    const char* path = sink_setting("output", "SINK_OUTPUT");
+    const char* direct = sink_setting("direct", "SINK_DIRECT");
+    if (!path || !*path) {
+        s->fd = STDOUT_FILENO;
+        return NULL;
+    }
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    s->direct = direct && strcmp(direct, "1") == 0;
+    s->fd = open(path, flags | (s->direct ? O_DIRECT : 0), 0644);
+    if (s->fd < 0 && s->direct && errno == EINVAL) {
+        s->direct = 0;
+        s->fd = open(path, flags, 0644);
+    }
+    if (s->fd < 0) return "cannot open the output";
+    s->close_fd = 1;
+    return NULL;
+}
+
+// with uring=1, a second buffer and a ring - without io_uring the sink
+// keeps writing with write(2)
+static void sink_start_uring(sink_t* s) {
+    const char* value = sink_setting("uring", "SINK_URING");
+    if (!value || strcmp(value, "1") != 0) return;
+    s->ring = (uring_t*)malloc(sizeof(uring_t));
+    s->spare = (char*)aligned_alloc(SINK_BLOCK, s->alloc);
+    if (!s->ring || !s->spare || uring_init(s->ring, 2) != NULL) {
+        fprintf(stderr, "[INFO][sink] - io_uring is not available, writing with write(2)\n");
+        free(s->ring);
+        free(s->spare);
+        s->ring = NULL;
+        s->spare = NULL;
+        return;
+    }
+    s->bufs[0] = s->buf;
+    s->bufs[1] = s->spare;
+    struct iovec iov[2] = { { s->buf, s->alloc }, { s->spare, s->alloc } };
+    uring_register_buffers(s->ring, iov, 2); // plain writes if the locked memory limit is too low
+}
+
+// pass the message unchanged - the hook writes it
+static plugin_msg_t* plugin_transform(plugin_msg_t* msg) {
+    return msg;
+}
+
+const char* plugin_get_name(void) {
+    return "sink";
+}
+
+const char* plugin_init(int queue_size) {
+    sink_t* s = (sink_t*)calloc(1, sizeof(sink_t));
+    if (!s) return "malloc has failed";
+    size_t size = SINK_BUFFER;
+    int tick_ms = 0;
+    const char* err = sink_parse_flush(sink_setting("flush", "SINK_FLUSH"), s, &size, &tick_ms);
+    if (err) {
+        free(s);
+        return err;
+    }
+
+    err = sink_open(s);
+    if (!err) {
+        s->capacity = size;
+        if (s->direct) s->capacity = (size + SINK_BLOCK - 1) / SINK_BLOCK * SINK_BLOCK; // whole blocks
+        s->alloc = (s->capacity + SINK_BLOCK - 1) / SINK_BLOCK * SINK_BLOCK;
+        s->buf = (char*)aligned_alloc(SINK_BLOCK, s->alloc);
+        if (!s->buf) err = "malloc has failed";
+    }
+    if (!err) sink_start_uring(s);
+    if (!err) err = common_plugin_set_hook(sink_hook, s, tick_ms);
+    if (!err) err = common_plugin_init_msg(plugin_transform, "sink", queue_size, PLUGIN_READ_ONLY);
+    if (err) {
+        if (s->close_fd) close(s->fd);
+        if (s->ring) uring_exit(s->ring);
+        free(s->ring);
+        free(s->buf);
+        free(s->spare);
+        free(s);
+    }
+    return err;
+}
@@ -0,0 +1,163 @@
+#include "buffer_pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+// every buffer starts with a header; while a buffer is free its first bytes
+// link it to the next free buffer
+typedef struct buffer_depot {
+    char* head;                     // free buffers of one size class, a lock-free stack
+} buffer_depot_t;
+
+typedef struct {
+    buffer_depot_t* home;           // free list the buffer goes back to, NULL for a large buffer
+    unsigned int size_class;
+    unsigned int refs;              // holders, 1 while the buffer is free
+} buffer_header_t;                  // 16 bytes, so buffers keep malloc's alignment
+
+static buffer_depot_t depots[BUFFER_POOL_CLASSES];
+static __thread char* caches[BUFFER_POOL_CLASSES];     // this thread's buffers, no atomics needed
+
+#define BUFFER_POOL_MAX_SIZE ((size_t)BUFFER_POOL_MIN_SIZE << (BUFFER_POOL_CLASSES - 1))
+
+static buffer_header_t* header_of(char* buf) {
+    return (buffer_header_t*)buf - 1;
+}
+
+static char** next_of(char* buf) {
+    return (char**)buf;
+}
+
+// smallest class that holds size bytes (size <= BUFFER_POOL_MAX_SIZE)
+static size_t class_of(size_t size) {
+    if (size <= BUFFER_POOL_MIN_SIZE) return 0;
+    return (size_t)(64 - __builtin_clzll((unsigned long long)(size - 1))) - 5;
+}
+
+// push the list first..last onto a depot - the only step another thread ever
+// takes on a pool, so it is a single compare-and-swap in the common case
+static void depot_push(buffer_depot_t* depot, char* first, char* last) {
+    char* head = __atomic_load_n(&depot->head, __ATOMIC_RELAXED);
+    do {
+        *next_of(last) = head;
+    } while (!__atomic_compare_exchange_n(&depot->head, &head, first, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// push a whole list, finding its last buffer
+static void depot_push_list(buffer_depot_t* depot, char* list) {
+    char* last = list;
+    while (*next_of(last)) last = *next_of(last);
+    depot_push(depot, list, last);
+}
+
+// take every free buffer of a class at once (an exchange, so no ABA problem),
+// keep up to BUFFER_POOL_CACHE of them and give the rest back
+static char* cache_refill(size_t cls) {
+    char* list = __atomic_exchange_n(&depots[cls].head, NULL, __ATOMIC_ACQUIRE);
+    if (!list) return NULL;
+
+    char* last = list;
+    for (int n = 1; n < BUFFER_POOL_CACHE && *next_of(last); n++) last = *next_of(last);
+    char* rest = *next_of(last);
+    *next_of(last) = NULL;
+
+    if (rest) {
+        // usually nothing was freed meanwhile, then rest goes back without a walk
+        char* empty = NULL;
+        if (!__atomic_compare_exchange_n(&depots[cls].head, &empty, rest, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            depot_push_list(&depots[cls], rest);
+        }
+    }
+    return list;
+}
+
+// get a buffer
+char* buffer_pool_alloc(size_t size) {
+    if (size > BUFFER_POOL_MAX_SIZE) { // too big to be worth keeping
+        buffer_header_t* h = (buffer_header_t*)malloc(sizeof(buffer_header_t) + size);
+        if (!h) return NULL;
+        h->home = NULL;
+        h->size_class = BUFFER_POOL_CLASSES;
+        h->refs = 1;
+        return (char*)(h + 1);
+    }
+
+    size_t cls = class_of(size);
+    char* buf = caches[cls];
+    if (!buf) buf = cache_refill(cls);
+    if (buf) {
+        caches[cls] = *next_of(buf);
+        return buf;
+    }
+
+    // pool is empty - grow it by one buffer
+    buffer_header_t* h = (buffer_header_t*)malloc(sizeof(buffer_header_t) + ((size_t)BUFFER_POOL_MIN_SIZE << cls));
+    if (!h) return NULL;
+    h->home = &depots[cls];
+    h->size_class = (unsigned int)cls;
+    h->refs = 1;
+    return (char*)(h + 1);
+}
+
+// copy a string into a new buffer
+char* buffer_pool_strndup(const char* str, size_t len) {
+    if (!str) return NULL;
+    char* buf = buffer_pool_alloc(len + 1);
+    if (!buf) return NULL;
+    memcpy(buf, str, len);
+    buf[len] = '\0';
+    return buf;
+}
+
+// add a holder
+char* buffer_pool_ref(char* buf) {
+    __atomic_fetch_add(&header_of(buf)->refs, 1, __ATOMIC_RELAXED);
+    return buf;
+}
+
+// drop a holder - a sole holder needs no atomic update, nobody else can add one
+int buffer_pool_unref(char* buf) {
+    buffer_header_t* h = header_of(buf);
+    if (__atomic_load_n(&h->refs, __ATOMIC_ACQUIRE) == 1) return 1;
+    if (__atomic_sub_fetch(&h->refs, 1, __ATOMIC_ACQ_REL) != 0) return 0;
+    __atomic_store_n(&h->refs, 1, __ATOMIC_RELAXED); // the last holder keeps it, as a free buffer would be
+    return 1;
+}
+
+// check for other holders
+int buffer_pool_shared(char* buf) {
+    return __atomic_load_n(&header_of(buf)->refs, __ATOMIC_ACQUIRE) > 1;
+}
+
+// give a buffer back to the pool that allocated it, once its last holder does
+void buffer_pool_free(char* buf) {
+    if (!buf || !buffer_pool_unref(buf)) return;
+    buffer_header_t* h = header_of(buf);
+    if (!h->home) {
+        free(h);
+        return;
+    }
+    depot_push(h->home, buf, buf);
+}
+
+// give the calling thread's cache back
+void buffer_pool_thread_flush(void) {
+    for (size_t cls = 0; cls < BUFFER_POOL_CLASSES; cls++) {
+        if (caches[cls]) depot_push_list(&depots[cls], caches[cls]); // only ever holds this pool's buffers
+        caches[cls] = NULL;
+    }
+}
+
+// free the pool when the program or plugin that holds it is unloaded - every
+// buffer it made must have been given back by then
+__attribute__((destructor))
+static void buffer_pool_release(void) {
+    buffer_pool_thread_flush();
+    for (size_t cls = 0; cls < BUFFER_POOL_CLASSES; cls++) {
+        char* buf = __atomic_exchange_n(&depots[cls].head, NULL, __ATOMIC_ACQUIRE);
+        while (buf) {
+            char* next = *next_of(buf);
+            free(header_of(buf));
+            buf = next;
+        }
+    }
+}
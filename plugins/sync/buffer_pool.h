@@ -0,0 +1,73 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+
+/**
+ * Pool for the line buffers that travel through the pipeline
+ * Buffers come in power of two size classes (32 bytes up to 4 KiB, larger
+ * ones are plain malloc). Every thread allocates from its own cache, which is
+ * refilled from a shared free list in one step. A buffer goes back to the free
+ * list of the pool that allocated it, from any thread, with one lock-free
+ * push - so a buffer made by one stage and freed by the next never touches a
+ * malloc arena lock.
+ * The host and every plugin link their own copy of the pool; a buffer may be
+ * freed through any copy, as long as the copy that allocated it is still loaded.
+ * A buffer can have several holders (a line sent down several branches): each
+ * one frees it, and it goes back to the pool with the last.
+ */
+
+#define BUFFER_POOL_MIN_SIZE 32         /* smallest size class */
+#define BUFFER_POOL_CLASSES 8           /* size classes, 32 bytes .. 4 KiB */
+#define BUFFER_POOL_CACHE 64            /* buffers a thread keeps from one refill */
+
+/**
+ * Get a buffer
+ * @param size Bytes needed (including any NUL)
+ * @return The buffer, or NULL if out of memory
+ */
+char* buffer_pool_alloc(size_t size);
+
+/**
+ * Copy len bytes of str into a new NUL-terminated buffer
+ * @param str String to copy
+ * @param len Bytes to copy
+ * @return The buffer, or NULL if out of memory
+ */
+char* buffer_pool_strndup(const char* str, size_t len);
+
+/**
+ * Give a buffer back, from any thread - with other holders, only drop this one
+ * @param buf Buffer from buffer_pool_alloc (NULL is ignored)
+ */
+void buffer_pool_free(char* buf);
+
+/**
+ * Add a holder to a buffer - every holder frees it once
+ * @param buf Buffer from buffer_pool_alloc
+ * @return buf
+ */
+char* buffer_pool_ref(char* buf);
+
+/**
+ * Drop a holder without giving the buffer back
+ * @param buf Buffer from buffer_pool_alloc
+ * @return 1 if it was the last one (the caller now holds the buffer alone and
+ *         must free it), 0 if others still hold it
+ */
+int buffer_pool_unref(char* buf);
+
+/**
+ * Check whether a buffer has other holders - it must not be changed then
+ * @param buf Buffer from buffer_pool_alloc
+ * @return 1 if it is shared, 0 if the caller is its only holder
+ */
+int buffer_pool_shared(char* buf);
+
+/**
+ * Give the calling thread's cached buffers back to the pool - call before a
+ * thread that allocated from the pool exits
+ */
+void buffer_pool_thread_flush(void);
+
+#endif
@@ -1,121 +1,763 @@
 #include "consumer_producer.h"
+#include <limits.h>
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 
-// init queue
+// sleep while *addr still holds val (returns at once if it changed), at most
+// timeout if one is given
+static void futex_wait(uint32_t* addr, uint32_t val, const struct timespec* timeout) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, timeout, NULL, 0);
+}
+
+// wake every thread sleeping on addr
+static void futex_wake(uint32_t* addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+// monotonic time in nanoseconds, for the blocked time statistics
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// tell the cpu we are in a spin loop - it backs off the pipeline and, with
+// smt, leaves the core to the sibling
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#else
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+#endif
+}
+
+// where a thread is in the spin and yield rounds of one wait
+typedef struct {
+    int round;
+    uint64_t start;                // when the first round began, 0 if none did
+} cp_backoff_t;
+
+// count the rounds a wait spent as blocked time, and start the next wait
+// from the first round
+static void backoff_done(cp_backoff_t* b, uint64_t* wait_ns) {
+    if (b->start) __atomic_fetch_add(wait_ns, now_ns() - b->start, __ATOMIC_RELAXED);
+    b->start = 0;
+    b->round = 0;
+}
+
+// spend one round of a wait the way the queue's strategy says, returns 0
+// once the rounds are used up and it is time to sleep
+static int backoff(consumer_producer_t* q, cp_backoff_t* b, uint64_t* wait_ns) {
+    int spins = __atomic_load_n(&q->spin_rounds, __ATOMIC_RELAXED);
+    int yields = __atomic_load_n(&q->yield_rounds, __ATOMIC_RELAXED);
+    if (b->round >= spins + yields) {
+        backoff_done(b, wait_ns); // the sleep counts its own time
+        b->round = spins + yields;
+        return 0;
+    }
+    if (b->round == 0) b->start = now_ns();
+    if (b->round++ < spins) {
+        cpu_relax();
+    } else {
+        sched_yield();
+    }
+    return 1;
+}
+
+// raise the high water mark (called by consumers, rarely by more than one)
+static void note_high_water(consumer_producer_t* q, size_t waiting) {
+    if (waiting > __atomic_load_n(&q->high_water, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&q->high_water, waiting, __ATOMIC_RELAXED);
+    }
+}
+
+// ring size for a capacity - a power of two, so the spsc ring indexes with a mask
+static size_t ring_slots(int capacity) {
+    size_t slots = 1;
+    while (slots < (size_t)capacity) slots <<= 1;
+    return slots;
+}
+
+// init queue in locked mode
 const char* consumer_producer_init(consumer_producer_t* q, int capacity) {
+    return consumer_producer_init_mode(q, capacity, CP_MODE_LOCKED);
+}
+
+// init queue
+const char* consumer_producer_init_mode(consumer_producer_t* q, int capacity, cp_mode_t mode) {
    
     if (!q || capacity <= 0){
         return "args are invalid"; // check for null pointer and non-positive capacity
     } 
 
+    // the spsc ring indexes with a mask, so round its size up to a power of two
+    size_t slots = mode == CP_MODE_SPSC ? ring_slots(capacity) : (size_t)capacity;
+
     // allocate memory for items and check if allocation was successful
-    q->items = (char**)malloc(sizeof(char*) * capacity);
+    q->items = (char**)malloc(sizeof(char*) * slots);
     if (!q->items) return "malloc failed"; 
 
     // initialize queue properties
     q->capacity = capacity;
+    q->slots = (int)slots;
     q->count = 0;
     q->head = 0;
     q->tail = 0;
     q->is_finished = 0;
+    q->is_aborted = 0;
+    q->flush_at = 0;
+    q->taken = 0;
+    q->mode = mode;
+    q->put_wait_ns = 0;
+    q->get_wait_ns = 0;
+    q->high_water = 0;
 
-    // initialize monitors and mutex
+    // initialize the spsc ring state
+    q->ring_mask = slots - 1;
+    q->resize_at = 0;
+    q->resize_pending = 0;
+    q->ring_capacity = capacity;
+    q->spin_rounds = 0;
+    q->yield_rounds = 0;
+    q->full_hook = NULL;
+    q->full_arg = NULL;
+    q->read_items = q->items;
+    q->read_mask = slots - 1;
+    q->spsc_tail = 0;
+    q->cached_head = 0;
+    q->data_seq = 0;
+    q->producer_waiting = 0;
+    q->spsc_head = 0;
+    q->cached_tail = 0;
+    q->space_seq = 0;
+    q->consumer_waiting = 0;
+
+    // initialize mutex, condition variables and monitor
     if (pthread_mutex_init(&q->lock, NULL) != 0) return "mutex init failed";
-    if (monitor_init(&q->not_full_monitor) != 0) return "monitor init failed";
-    if (monitor_init(&q->not_empty_monitor) != 0) return "monitor init failed";
+    if (pthread_cond_init(&q->not_full, NULL) != 0) return "cond init failed";
+    // consumers may wait with a timeout, measured on the monotonic clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    int rc = pthread_cond_init(&q->not_empty, &attr);
+    pthread_condattr_destroy(&attr);
+    if (rc != 0) return "cond init failed";
     if (monitor_init(&q->finished_monitor) != 0) return "monitor init failed";
 
     return NULL;
 }
 
+// the consumer's slot for index i - at the index where the producer moved
+// to a new ring, every item of the old one has been taken, so the consumer
+// moves too and frees it (consumer thread, or with nobody using the queue)
+static char* spsc_slot(consumer_producer_t* q, size_t i) {
+    if (__atomic_load_n(&q->resize_pending, __ATOMIC_ACQUIRE) && i == q->resize_at) {
+        free(q->read_items);
+        q->read_items = q->items; // written before resize_pending was set, and not again until it is clear
+        q->read_mask = q->ring_mask;
+        __atomic_store_n(&q->resize_pending, 0, __ATOMIC_RELEASE);
+    }
+    return q->read_items[i & q->read_mask];
+}
+
+// move the consumer to the producer's new ring once it has taken every item
+// of the old one - when the queue ends right at a resize, no item in the new
+// ring takes it there through spsc_slot (with nobody using the queue)
+static void spsc_release_ring(consumer_producer_t* q) {
+    if (__atomic_load_n(&q->resize_pending, __ATOMIC_ACQUIRE) && q->spsc_head == q->resize_at &&
+        q->read_items != q->items) {
+        free(q->read_items);
+        q->read_items = q->items;
+        q->read_mask = q->ring_mask;
+        __atomic_store_n(&q->resize_pending, 0, __ATOMIC_RELEASE);
+    }
+}
+
 // destroy queue and free resources
 void consumer_producer_destroy(consumer_producer_t* q) {
     if (!q) return; // check for null pointer
 
     // free remaining items in queue
-    for (int i = 0; i < q->count; i++) {
-        free(q->items[(q->head + i) % q->capacity]); 
+    if (q->mode == CP_MODE_SPSC) {
+        for (size_t i = q->spsc_head; i != q->spsc_tail; i++) {
+            free(spsc_slot(q, i)); // moves to the producer's ring on the way
+        }
+        q->spsc_head = q->spsc_tail;
+        spsc_release_ring(q);
+    } else {
+        for (int i = 0; i < q->count; i++) {
+            free(q->items[(q->head + i) % q->slots]); 
+        }
     }
 
-    free(q->items); // free all items in the queue
+    free(q->items); // free all items in the queue (spsc_slot freed an older ring)
 
-    // destroy mutex and monitors
+    // destroy mutex, condition variables and monitor
     pthread_mutex_destroy(&q->lock);
-    monitor_destroy(&q->not_full_monitor);
-    monitor_destroy(&q->not_empty_monitor);
+    pthread_cond_destroy(&q->not_full);
+    pthread_cond_destroy(&q->not_empty);
     monitor_destroy(&q->finished_monitor);
 }
 
-// put item into queue
-const char* consumer_producer_put(consumer_producer_t* q, const char* item) {
-    if (!q || !item) return "args are invalid"; // check for null pointers
+// check the finished flag without the lock (spsc mode)
+static int spsc_finished(consumer_producer_t* q) {
+    return __atomic_load_n(&q->is_finished, __ATOMIC_ACQUIRE);
+}
 
-    pthread_mutex_lock(&q->lock); // lock the mutex to protect shared state
+// wake the consumer if it went to sleep on an empty ring
+static void spsc_wake_consumer(consumer_producer_t* q) {
+    // pairs with the fence in spsc_sleep_consumer: either we see the waiting
+    // flag or the consumer sees our new tail before it sleeps
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&q->consumer_waiting, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&q->data_seq, 1, __ATOMIC_RELEASE);
+        futex_wake(&q->data_seq);
+    }
+}
 
-    // wait until there is space in the queue or it is finished
-    while (q->count == q->capacity && !q->is_finished) {
-        pthread_mutex_unlock(&q->lock);
-        monitor_wait(&q->not_full_monitor);
-        pthread_mutex_lock(&q->lock);
+// wake the producer if it went to sleep on a full ring
+static void spsc_wake_producer(consumer_producer_t* q) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&q->producer_waiting, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&q->space_seq, 1, __ATOMIC_RELEASE);
+        futex_wake(&q->space_seq);
     }
+}
 
-    // if the queue is finished wont accept new items
-    if (q->is_finished) {
-        pthread_mutex_unlock(&q->lock);
-        return "queue finished";
+// sleep until the ring is not empty, the queue is finished, or the deadline
+// (0 for none) passes
+static void spsc_sleep_consumer(consumer_producer_t* q, uint64_t deadline) {
+    uint32_t seq = __atomic_load_n(&q->data_seq, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&q->consumer_waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    // recheck after announcing ourselves, a put may have raced with us
+    if (__atomic_load_n(&q->spsc_tail, __ATOMIC_ACQUIRE) == q->spsc_head && !spsc_finished(q) &&
+        !__atomic_load_n(&q->flush_at, __ATOMIC_ACQUIRE)) {
+        uint64_t start = now_ns();
+        struct timespec timeout;
+        if (deadline) {
+            uint64_t left = deadline > start ? deadline - start : 0;
+            timeout.tv_sec = (time_t)(left / 1000000000ULL);
+            timeout.tv_nsec = (long)(left % 1000000000ULL);
+        }
+        futex_wait(&q->data_seq, seq, deadline ? &timeout : NULL);
+        __atomic_fetch_add(&q->get_wait_ns, now_ns() - start, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&q->consumer_waiting, 0, __ATOMIC_RELAXED);
+}
+
+// items the producer may have in the ring - the capacity, but no more than
+// its ring holds (it may not have moved to a larger one yet)
+static size_t spsc_limit(consumer_producer_t* q) {
+    size_t capacity = (size_t)__atomic_load_n(&q->capacity, __ATOMIC_RELAXED);
+    return capacity <= q->ring_mask ? capacity : q->ring_mask + 1;
+}
+
+// move the producer to a ring sized for a changed capacity, starting at
+// index tail (producer thread only). A ring is only given up for a smaller
+// one when it is more than four times too large, and not while the consumer
+// is still on the previous one
+static void spsc_resize(consumer_producer_t* q, size_t tail) {
+    int capacity = __atomic_load_n(&q->capacity, __ATOMIC_RELAXED);
+    size_t slots = ring_slots(capacity);
+    size_t current = q->ring_mask + 1;
+    if (slots == current || (slots < current && slots * 4 > current)) {
+        q->ring_capacity = capacity; // the ring fits
+        return;
+    }
+    if (__atomic_load_n(&q->resize_pending, __ATOMIC_ACQUIRE)) return; // tried again on the next put
+
+    char** ring = (char**)malloc(sizeof(char*) * slots);
+    if (!ring) return; // the old ring stays, and caps the capacity
+    q->items = ring;
+    q->ring_mask = slots - 1;
+    q->resize_at = tail;
+    q->ring_capacity = capacity;
+    __atomic_store_n(&q->resize_pending, 1, __ATOMIC_RELEASE); // published with the next tail
+}
+
+// sleep until the ring has a free slot or the queue is finished
+static void spsc_sleep_producer(consumer_producer_t* q) {
+    uint32_t seq = __atomic_load_n(&q->space_seq, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&q->producer_waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    size_t head = __atomic_load_n(&q->spsc_head, __ATOMIC_ACQUIRE);
+    if (q->spsc_tail - head >= spsc_limit(q) && !spsc_finished(q)) {
+        uint64_t start = now_ns();
+        futex_wait(&q->space_seq, seq, NULL);
+        __atomic_fetch_add(&q->put_wait_ns, now_ns() - start, __ATOMIC_RELAXED);
     }
+    __atomic_store_n(&q->producer_waiting, 0, __ATOMIC_RELAXED);
+}
+
+// put items into the spsc ring (producer thread only), returns how many were put
+static int spsc_put_batch(consumer_producer_t* q, char** items, int count) {
+    size_t tail = q->spsc_tail;
+    int placed = 0;
+    cp_backoff_t wait = { 0, 0 };
+
+    while (placed < count) {
+        // if the queue is finished wont accept new items
+        if (spsc_finished(q)) break;
+
+        // the capacity changed - move to a ring of the new size first
+        if (__atomic_load_n(&q->capacity, __ATOMIC_RELAXED) != q->ring_capacity) spsc_resize(q, tail);
+
+        // wait until there is a free slot, only reloading the consumer index
+        // when the cached one says the ring is full
+        size_t limit = spsc_limit(q);
+        if (tail - q->cached_head >= limit) {
+            q->cached_head = __atomic_load_n(&q->spsc_head, __ATOMIC_ACQUIRE);
+            if (tail - q->cached_head >= limit) {
+                if (q->full_hook && q->full_hook(q->full_arg)) continue;
+                if (!backoff(q, &wait, &q->put_wait_ns)) spsc_sleep_producer(q);
+                continue;
+            }
+        }
+        backoff_done(&wait, &q->put_wait_ns);
+
+        // fill every free slot we know of, then publish them with one store
+        size_t room = limit - (tail - q->cached_head);
+        while (room-- > 0 && placed < count) {
+            q->items[tail & q->ring_mask] = items[placed++];
+            tail++;
+        }
+        __atomic_store_n(&q->spsc_tail, tail, __ATOMIC_RELEASE);
+        spsc_wake_consumer(q);
+    }
+    return placed;
+}
+
+// clear a flush marker the consumer reached - a newer one the producer set
+// meanwhile lies further on and stays
+static void clear_flush(consumer_producer_t* q, size_t flush) {
+    __atomic_compare_exchange_n(&q->flush_at, &flush, 0, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+// get up to max items from the spsc ring (consumer thread only), stopping at
+// a flush marker, waiting until the deadline at most (0 for none)
+static int spsc_get_batch(consumer_producer_t* q, char** out, int max, size_t* first_seq, cp_control_t* control,
+                          uint64_t deadline) {
+    size_t head = q->spsc_head;
+    size_t flush;
+    cp_backoff_t wait = { 0, 0 };
+    *first_seq = head;
+    *control = CP_CONTROL_NONE;
+
+    // wait until there is an item or a token, only reloading the producer
+    // index when the cached one says the ring is empty
+    while (1) {
+        if (__atomic_load_n(&q->is_aborted, __ATOMIC_ACQUIRE)) {
+            *control = CP_CONTROL_ABORT;
+            break;
+        }
+        flush = __atomic_load_n(&q->flush_at, __ATOMIC_ACQUIRE);
+        if (flush == head + 1) { // the marker is first in line
+            clear_flush(q, flush);
+            *control = CP_CONTROL_FLUSH;
+            break;
+        }
+        if (head != q->cached_tail) break;
+        q->cached_tail = __atomic_load_n(&q->spsc_tail, __ATOMIC_ACQUIRE);
+        if (head != q->cached_tail) break;
+
+        // finished and drained - reload once more so items put before the
+        // finished signal are not lost
+        if (spsc_finished(q)) {
+            q->cached_tail = __atomic_load_n(&q->spsc_tail, __ATOMIC_ACQUIRE);
+            if (head == q->cached_tail) *control = CP_CONTROL_EOS;
+            break;
+        }
+        if (deadline && now_ns() >= deadline) break; // CP_CONTROL_NONE and nothing taken
+        if (!backoff(q, &wait, &q->get_wait_ns)) spsc_sleep_consumer(q, deadline);
+    }
+    backoff_done(&wait, &q->get_wait_ns);
+    if (*control != CP_CONTROL_NONE || head == q->cached_tail) return 0;
+
+    // take what is there up to a flush marker, release the slots with one
+    // store, then wake the producer if it is asleep (the ring index doubles
+    // as sequence number). The marker is read again after the tail: one
+    // placed before the items we take is visible by now
+    flush = __atomic_load_n(&q->flush_at, __ATOMIC_ACQUIRE);
+    size_t end = q->cached_tail;
+    if (flush > head && flush - 1 < end) end = flush - 1;
+    note_high_water(q, q->cached_tail - head);
+    int n = 0;
+    while (n < max && head != end) {
+        out[n++] = spsc_slot(q, head);
+        head++;
+    }
+    __atomic_store_n(&q->spsc_head, head, __ATOMIC_RELEASE);
+    spsc_wake_producer(q);
+
+    *control = CP_CONTROL_NONE;
+    if (flush == head + 1) {
+        clear_flush(q, flush);
+        *control = CP_CONTROL_FLUSH;
+    }
+    return n;
+}
+
+// put a copy of item into queue
+const char* consumer_producer_put(consumer_producer_t* q, const char* item) {
+    if (!q || !item) return "args are invalid"; // check for null pointers
 
     // allocate memory for the new item and check if allocation successful
-    q->items[q->tail] = strdup(item);
-    q->tail = (q->tail + 1) % q->capacity;
-    q->count++;
+    char* copy = strdup(item);
+    if (!copy) return "malloc failed";
 
-    // signal that there is at least one item in the queue
-    monitor_signal(&q->not_empty_monitor);
-    pthread_mutex_unlock(&q->lock);
+    const char* err = consumer_producer_put_owned(q, copy);
+    if (err) free(copy); // queue did not take it
+    return err;
+}
+
+// put item into queue, taking ownership of it
+const char* consumer_producer_put_owned(consumer_producer_t* q, char* item) {
+    if (!q || !item) return "args are invalid"; // check for null pointers
+    if (consumer_producer_put_batch(q, &item, 1) != 1) return "queue finished";
     return NULL;
 }
 
+// put items into queue, taking ownership of the ones that were put
+int consumer_producer_put_batch(consumer_producer_t* q, char** items, int count) {
+    if (!q || !items || count <= 0) return 0; // check for null pointers
+    if (q->mode == CP_MODE_SPSC) return spsc_put_batch(q, items, count);
+
+    pthread_mutex_lock(&q->lock); // lock the mutex to protect shared state
+
+    int placed = 0;
+    while (placed < count) {
+        // wait until there is space in the queue or it is finished - the
+        // predicate is rechecked under lock so a wakeup is never lost or stale
+        if (q->count >= q->capacity && !q->is_finished && q->full_hook) {
+            pthread_mutex_unlock(&q->lock);
+            int again = q->full_hook(q->full_arg);
+            pthread_mutex_lock(&q->lock);
+            if (again) continue;
+        }
+        if (q->count >= q->capacity && !q->is_finished) {
+            uint64_t start = now_ns();
+            while (q->count >= q->capacity && !q->is_finished) {
+                pthread_cond_wait(&q->not_full, &q->lock);
+            }
+            __atomic_fetch_add(&q->put_wait_ns, now_ns() - start, __ATOMIC_RELAXED);
+        }
+
+        // if the queue is finished wont accept new items
+        if (q->is_finished) break;
+
+        int before = placed;
+        while (q->count < q->capacity && placed < count) {
+            q->items[q->tail] = items[placed++];
+            q->tail = (q->tail + 1) % q->slots;
+            q->count++;
+        }
+
+        // wake one consumer per new item
+        if (placed - before == 1) {
+            pthread_cond_signal(&q->not_empty);
+        } else {
+            pthread_cond_broadcast(&q->not_empty);
+        }
+    }
+
+    pthread_mutex_unlock(&q->lock);
+    return placed;
+}
+
 // get item from queue
 char* consumer_producer_get(consumer_producer_t* q) {
-    if (!q) return NULL; // null pointer check
+    char* item = NULL;
+    if (consumer_producer_get_batch(q, &item, 1) != 1) return NULL;
+    return item;
+}
+
+// get up to max items from queue
+int consumer_producer_get_batch(consumer_producer_t* q, char** out, int max) {
+    size_t first_seq;
+    return consumer_producer_get_batch_seq(q, out, max, &first_seq);
+}
+
+// get up to max items from queue along with the sequence number of the first
+int consumer_producer_get_batch_seq(consumer_producer_t* q, char** out, int max, size_t* first_seq) {
+    cp_control_t control;
+    int n;
+    do { // a flush marker means nothing to callers that do not ask for tokens
+        n = consumer_producer_get_batch_control(q, out, max, first_seq, &control);
+    } while (n == 0 && control == CP_CONTROL_FLUSH);
+    return n;
+}
+
+// get up to max items from queue, stopping at a flush marker, and report the token that ended the batch
+int consumer_producer_get_batch_control(consumer_producer_t* q, char** out, int max, size_t* first_seq, cp_control_t* control) {
+    return consumer_producer_get_batch_timed(q, out, max, first_seq, control, -1);
+}
+
+// like consumer_producer_get_batch_control, waiting at most timeout_ms
+int consumer_producer_get_batch_timed(consumer_producer_t* q, char** out, int max, size_t* first_seq, cp_control_t* control,
+                                      int timeout_ms) {
+    if (!q || !out || max <= 0 || !first_seq || !control) return 0; // null pointer check
+    uint64_t deadline = timeout_ms >= 0 ? now_ns() + (uint64_t)timeout_ms * 1000000ULL : 0;
+    if (q->mode == CP_MODE_SPSC) return spsc_get_batch(q, out, max, first_seq, control, deadline);
     pthread_mutex_lock(&q->lock);
 
-    // wait until there is an item in the queue or it is finished
-    while (q->count == 0 && !q->is_finished) {
-        pthread_mutex_unlock(&q->lock);
-        monitor_wait(&q->not_empty_monitor);
-        pthread_mutex_lock(&q->lock);
+    // wait until there is an item in the queue, a token, it is finished, or the time is up
+    if (q->count == 0 && !q->is_finished && !q->flush_at) {
+        uint64_t start = now_ns();
+        struct timespec until = { (time_t)(deadline / 1000000000ULL), (long)(deadline % 1000000000ULL) };
+        int timed_out = deadline && start >= deadline; // a poll, a timed wait would sleep out the timer slack
+        while (q->count == 0 && !q->is_finished && !q->flush_at && !timed_out) {
+            if (deadline) {
+                timed_out = pthread_cond_timedwait(&q->not_empty, &q->lock, &until) != 0;
+            } else {
+                pthread_cond_wait(&q->not_empty, &q->lock);
+            }
+        }
+        __atomic_fetch_add(&q->get_wait_ns, now_ns() - start, __ATOMIC_RELAXED);
+        if (q->count == 0 && !q->is_finished && !q->flush_at) {
+            *first_seq = q->taken;
+            *control = CP_CONTROL_NONE; // timed out
+            pthread_mutex_unlock(&q->lock);
+            return 0;
+        }
     }
 
-    // if the queue is finished and empty, return NULL
-    if (q->count == 0 && q->is_finished) {
+    *first_seq = q->taken;
+    *control = CP_CONTROL_NONE;
+    if (q->is_aborted) {
+        *control = CP_CONTROL_ABORT;
         pthread_mutex_unlock(&q->lock);
+        return 0;
+    }
+
+    // take whatever is there, up to max and up to a flush marker, and update
+    // the state (finished and empty takes nothing)
+    int limit = q->count;
+    if (q->flush_at && q->flush_at - 1 - q->taken < (size_t)limit) limit = (int)(q->flush_at - 1 - q->taken);
+    note_high_water(q, (size_t)q->count);
+    int n = 0;
+    while (n < max && n < limit) {
+        out[n++] = q->items[q->head];
+        q->head = (q->head + 1) % q->slots;
+        q->count--;
+    }
+    q->taken += n;
+
+    if (q->flush_at && q->flush_at == q->taken + 1) {
+        q->flush_at = 0;
+        *control = CP_CONTROL_FLUSH;
+    } else if (n == 0) {
+        *control = CP_CONTROL_EOS; // only finished and drained gets here empty handed
+    }
+
+    // wake one producer per free slot
+    if (n == 1) {
+        pthread_cond_signal(&q->not_full);
+    } else if (n > 1) {
+        pthread_cond_broadcast(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return n;
+}
+
+// take what is left in a queue nobody uses any more, aborted or not
+int consumer_producer_drain(consumer_producer_t* q, char** out, int max) {
+    if (!q || !out || max <= 0) return 0; // null pointer check
+    int n = 0;
+    pthread_mutex_lock(&q->lock);
+    if (q->mode == CP_MODE_SPSC) {
+        size_t tail = __atomic_load_n(&q->spsc_tail, __ATOMIC_ACQUIRE);
+        while (n < max && q->spsc_head != tail) {
+            out[n++] = spsc_slot(q, q->spsc_head);
+            q->spsc_head++;
+        }
+        if (q->spsc_head == tail) spsc_release_ring(q);
+    } else {
+        while (n < max && q->count > 0) {
+            out[n++] = q->items[q->head];
+            q->head = (q->head + 1) % q->slots;
+            q->count--;
+        }
+        q->taken += n;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return n;
+}
+
+// change the capacity - locked mode moves the items to an array of the new
+// size (a smaller one only when the old is more than four times too large),
+// spsc mode leaves the ring to the producer
+const char* consumer_producer_set_capacity(consumer_producer_t* q, int capacity) {
+    if (!q || capacity <= 0) return "args are invalid";
+    if (q->mode == CP_MODE_SPSC) {
+        __atomic_store_n(&q->capacity, capacity, __ATOMIC_RELAXED);
+        // a producer asleep on a full ring may have room now
+        __atomic_fetch_add(&q->space_seq, 1, __ATOMIC_RELEASE);
+        futex_wake(&q->space_seq);
         return NULL;
     }
 
-    // get the item from the queue and update the state
-    char* item = q->items[q->head];
-    q->head = (q->head + 1) % q->capacity;
-    q->count--;
+    pthread_mutex_lock(&q->lock);
+    if (capacity > q->slots || (capacity * 4 < q->slots && q->count <= capacity)) {
+        char** items = (char**)malloc(sizeof(char*) * (size_t)capacity);
+        if (!items) {
+            pthread_mutex_unlock(&q->lock);
+            return "malloc failed";
+        }
+        for (int i = 0; i < q->count; i++) items[i] = q->items[(q->head + i) % q->slots];
+        free(q->items);
+        q->items = items;
+        q->slots = capacity;
+        q->head = 0;
+        q->tail = q->count % capacity;
+    }
+    __atomic_store_n(&q->capacity, capacity, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+// choose the wait strategy - the rounds are read at every wait, so a change
+// reaches both sides on their next one
+const char* consumer_producer_set_wait(consumer_producer_t* q, cp_wait_t wait) {
+    if (!q || wait < CP_WAIT_PARK || wait > CP_WAIT_SPIN) return "args are invalid";
+    int spins = 0, yields = 0;
+    if (wait != CP_WAIT_PARK) yields = CP_YIELD_ROUNDS;
+    // a spinning thread keeps the other side off a lone cpu, so it yields at once
+    if (wait == CP_WAIT_SPIN && sysconf(_SC_NPROCESSORS_ONLN) > 1) spins = CP_SPIN_ROUNDS;
+    __atomic_store_n(&q->spin_rounds, spins, __ATOMIC_RELAXED);
+    __atomic_store_n(&q->yield_rounds, yields, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+// give the queue a hook for producers that find it full
+void consumer_producer_set_full_hook(consumer_producer_t* q, int (*hook)(void*), void* arg) {
+    if (!q) return;
+    q->full_hook = hook;
+    q->full_arg = arg;
+}
+
+// move the pages holding [addr, addr + len) to a node, a few at a time
+static int move_pages_to_node(void* addr, size_t len, int node) {
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t at = (uintptr_t)addr & ~(page - 1);
+    uintptr_t end = (uintptr_t)addr + len;
+    while (at < end) {
+        void* pages[64];
+        int nodes[64];
+        int status[64];
+        unsigned long n = 0;
+        for (; n < 64 && at < end; n++, at += page) {
+            pages[n] = (void*)at;
+            nodes[n] = node;
+        }
+        if (syscall(SYS_move_pages, 0, n, pages, nodes, status, MPOL_MF_MOVE) < 0) return -1;
+    }
+    return 0;
+}
 
-    monitor_signal(&q->not_full_monitor); // signal that there is space in the queue
+// move the queue and the ring the consumers read to a node
+const char* consumer_producer_move_to_node(consumer_producer_t* q, int node) {
+    if (!q || node < 0) return "args are invalid";
+    pthread_mutex_lock(&q->lock); // keeps a locked mode resize out, spsc resizes start on a put
+    size_t ring = q->mode == CP_MODE_SPSC ? q->read_mask + 1 : (size_t)q->slots;
+    char** items = q->mode == CP_MODE_SPSC ? q->read_items : q->items;
+    int rc = move_pages_to_node(q, sizeof(*q), node);
+    if (rc == 0) rc = move_pages_to_node(items, sizeof(char*) * ring, node);
     pthread_mutex_unlock(&q->lock);
-    return item;
+    return rc == 0 ? NULL : "cannot move the pages";
 }
-// signal that processing is finished
-void consumer_producer_signal_finished(consumer_producer_t* q) {
+
+// read the capacity without the lock
+int consumer_producer_get_capacity(consumer_producer_t* q) {
+    return q ? __atomic_load_n(&q->capacity, __ATOMIC_RELAXED) : 0;
+}
+
+// read the statistics without the lock
+void consumer_producer_get_stats(consumer_producer_t* q, uint64_t* put_wait_ns, uint64_t* get_wait_ns, size_t* high_water) {
     if (!q) return; // null pointer check
-    
+    if (put_wait_ns) *put_wait_ns = __atomic_load_n(&q->put_wait_ns, __ATOMIC_RELAXED);
+    if (get_wait_ns) *get_wait_ns = __atomic_load_n(&q->get_wait_ns, __ATOMIC_RELAXED);
+    if (high_water) *high_water = __atomic_load_n(&q->high_water, __ATOMIC_RELAXED);
+}
+
+// stop accepting items and wake everybody - abort also tells the consumers
+// to stop taking them
+static void cp_finish(consumer_producer_t* q, int abort) {
+    // spsc mode has no lock - publish the flags and kick both sides awake
+    if (q->mode == CP_MODE_SPSC) {
+        if (abort) __atomic_store_n(&q->is_aborted, 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&q->is_finished, 1, __ATOMIC_RELEASE);
+        __atomic_fetch_add(&q->data_seq, 1, __ATOMIC_RELEASE);
+        __atomic_fetch_add(&q->space_seq, 1, __ATOMIC_RELEASE);
+        futex_wake(&q->data_seq);
+        futex_wake(&q->space_seq);
+        return;
+    }
+
     pthread_mutex_lock(&q->lock);
+    if (abort) __atomic_store_n(&q->is_aborted, 1, __ATOMIC_RELEASE);
     q->is_finished = 1;
-    monitor_signal(&q->not_empty_monitor);
-    monitor_signal(&q->not_full_monitor);
-    monitor_signal(&q->finished_monitor);
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// place a flush marker after the items put so far (producer thread only)
+static void cp_flush(consumer_producer_t* q) {
+    if (q->mode == CP_MODE_SPSC) {
+        __atomic_store_n(&q->flush_at, q->spsc_tail + 1, __ATOMIC_RELEASE);
+        spsc_wake_consumer(q);
+        return;
+    }
+
+    pthread_mutex_lock(&q->lock);
+    q->flush_at = q->taken + (size_t)q->count + 1;
+    pthread_cond_signal(&q->not_empty);
     pthread_mutex_unlock(&q->lock);
 }
 
+// send a control token
+void consumer_producer_control(consumer_producer_t* q, cp_control_t control) {
+    if (!q) return; // null pointer check
+    switch (control) {
+    case CP_CONTROL_FLUSH:
+        cp_flush(q);
+        break;
+    case CP_CONTROL_EOS:
+        cp_finish(q, 0);
+        break;
+    case CP_CONTROL_ABORT:
+        cp_finish(q, 1);
+        monitor_signal(&q->finished_monitor); // nobody waits for a drain
+        break;
+    default:
+        break;
+    }
+}
+
+// check the aborted flag without the lock
+int consumer_producer_aborted(consumer_producer_t* q) {
+    return q && __atomic_load_n(&q->is_aborted, __ATOMIC_ACQUIRE);
+}
+
+// signal that processing is finished
+void consumer_producer_signal_finished(consumer_producer_t* q) {
+    if (!q) return; // null pointer check
+    cp_finish(q, 0);
+    monitor_signal(&q->finished_monitor);
+}
+
 int consumer_producer_wait_finished(consumer_producer_t* q) {
     return monitor_wait(&q->finished_monitor);
 }
\ No newline at end of file
@@ -3,32 +3,117 @@
 
 #include "monitor.h"
 #include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CP_CACHE_LINE 64               /* keeps producer and consumer indices apart */
+#define CP_SPIN_ROUNDS 4096            /* pause rounds of CP_WAIT_SPIN before it yields */
+#define CP_YIELD_ROUNDS 16             /* sched_yield rounds of CP_WAIT_YIELD and CP_WAIT_SPIN before they sleep */
+
+/**
+ * Queue synchronization mode
+ */
+typedef enum {
+    CP_MODE_LOCKED = 0,                /* Mutex + monitors, any number of producers/consumers */
+    CP_MODE_SPSC                       /* Lock-free ring, exactly one producer and one consumer */
+} cp_mode_t;
+
+/**
+ * Control tokens - they travel beside the items instead of as items, so
+ * nothing has to be compared against a magic value
+ */
+typedef enum {
+    CP_CONTROL_NONE = 0,
+    CP_CONTROL_FLUSH,                  /* Ordered marker: everything put before it is handed out first */
+    CP_CONTROL_EOS,                    /* End of stream: no more items, consumers drain what is queued */
+    CP_CONTROL_ABORT                   /* Stop now: puts fail, gets return at once, queued items stay for consumer_producer_drain */
+} cp_control_t;
+
+/**
+ * How an spsc queue waits for an item or a free slot - sleeping costs a
+ * futex wake on the other side and a scheduler round trip per wait, spinning
+ * costs a cpu while it waits
+ */
+typedef enum {
+    CP_WAIT_PARK = 0,                  /* Sleep on the futex at once (default) */
+    CP_WAIT_YIELD,                     /* Yield the cpu CP_YIELD_ROUNDS times, then sleep */
+    CP_WAIT_SPIN                       /* Spin CP_SPIN_ROUNDS times with a pause, then yield, then sleep */
+} cp_wait_t;
 
 /**
  * Consumer-Producer queue structure for thread-safe producer-consumer pattern
- * Now using monitors for simpler implementation
+ * Locked mode waits on condition variables with the count predicate checked
+ * under lock; the finished monitor is a one-shot latch
  */
 typedef struct {
-    char** items;                  /* Array of string pointers */
-    int capacity;                  /* Maximum number of items */
+    char** items;                  /* Array of string pointers (the producer's ring in spsc mode) */
+    int capacity;                  /* Maximum number of items, see consumer_producer_set_capacity */
+    int slots;                     /* Length of items (locked mode) */
     int count;                     /* Current number of items */
     int head;                      /* Index of first item */
     int tail;                      /* Index of next insertion point */
-    monitor_t not_full_monitor;    /* Monitor for "not full" state */
-    monitor_t not_empty_monitor;   /* Monitor for "not empty" state */
-    monitor_t finished_monitor;    /* Monitor for finished signal */
-    int is_finished;               /* Flag for finished state */
+    pthread_cond_t not_full;       /* Waited on under lock while count >= capacity */
+    pthread_cond_t not_empty;      /* Waited on under lock while count == 0 */
+    monitor_t finished_monitor;    /* Monitor for finished signal (stays signaled) */
+    int is_finished;               /* Flag for finished state (no more puts) */
+    int is_aborted;                /* Set by CP_CONTROL_ABORT, gets take nothing more */
+    size_t flush_at;               /* 1 + number of items put before a pending flush, 0 for none */
+    size_t taken;                  /* Items ever taken (locked mode sequence numbers) */
     pthread_mutex_t lock;          /* Mutex to protect shared state */
+    cp_mode_t mode;                /* Synchronization mode */
+
+    /* statistics - only touched when a thread blocks or takes items, read
+       with relaxed atomic loads from any thread */
+    uint64_t put_wait_ns;          /* Time producers spent blocked on a full queue */
+    uint64_t get_wait_ns;          /* Time consumers spent blocked on an empty queue */
+    size_t high_water;             /* Most items a consumer found waiting */
+
+    /* SPSC mode: ring of ring_mask + 1 slots, indices grow forever. A new
+       capacity moves the producer to a new ring at index resize_at; the
+       consumer follows when it gets there and frees the old one */
+    size_t ring_mask;              /* Producer's ring */
+    size_t resize_at;              /* First index in the producer's ring while resize_pending */
+    int resize_pending;            /* The consumer is still on the old ring */
+    int spin_rounds;               /* Wait strategy, see consumer_producer_set_wait */
+    int yield_rounds;
+    int (*full_hook)(void*);       /* Run by a producer before it waits on a full queue, see consumer_producer_set_full_hook */
+    void* full_arg;
+
+    /* producer side - written only by the producer thread */
+    size_t spsc_tail __attribute__((aligned(CP_CACHE_LINE)));  /* Next slot to write */
+    size_t cached_head;            /* Producer's last view of spsc_head */
+    uint32_t data_seq;             /* Futex word the consumer sleeps on */
+    int producer_waiting;          /* Producer is (about to be) asleep on space_seq */
+    int ring_capacity;             /* Capacity the producer's ring was sized for */
+
+    /* consumer side - written only by the consumer thread */
+    size_t spsc_head __attribute__((aligned(CP_CACHE_LINE)));  /* Next slot to read */
+    size_t cached_tail;            /* Consumer's last view of spsc_tail */
+    uint32_t space_seq;            /* Futex word the producer sleeps on */
+    int consumer_waiting;          /* Consumer is (about to be) asleep on data_seq */
+    char** read_items;             /* Consumer's ring */
+    size_t read_mask;
 } consumer_producer_t;
 
 /**
- * Initialize a consumer-producer queue
+ * Initialize a consumer-producer queue (locked mode)
  * @param queue Pointer to queue structure
  * @param capacity Maximum number of items
  * @return NULL on success, error message on failure
  */
 const char* consumer_producer_init(consumer_producer_t* queue, int capacity);
 
+/**
+ * Initialize a consumer-producer queue with an explicit synchronization mode.
+ * CP_MODE_SPSC is only valid when exactly one thread puts and one thread gets;
+ * it never takes a lock and only sleeps when the ring is empty or full.
+ * @param queue Pointer to queue structure
+ * @param capacity Maximum number of items
+ * @param mode CP_MODE_LOCKED or CP_MODE_SPSC
+ * @return NULL on success, error message on failure
+ */
+const char* consumer_producer_init_mode(consumer_producer_t* queue, int capacity, cp_mode_t mode);
+
 /**
  * Destroy a consumer-producer queue and free its resources
  * @param queue Pointer to queue structure
@@ -36,14 +121,36 @@ const char* consumer_producer_init(consumer_producer_t* queue, int capacity);
 void consumer_producer_destroy(consumer_producer_t* queue);
 
 /**
- * Add an item to the queue (producer).
+ * Add a copy of an item to the queue (producer).
  * Blocks if queue is full.
  * @param queue Pointer to queue structure
- * @param item String to add (queue takes ownership)
+ * @param item String to add (queue stores its own copy)
  * @return NULL on success, error message on failure
  */
 const char* consumer_producer_put(consumer_producer_t* queue, const char* item);
 
+/**
+ * Add an item to the queue without copying it (producer).
+ * Blocks if queue is full.
+ * @param queue Pointer to queue structure
+ * @param item Heap string to add (queue takes ownership on success; on
+ *             failure it stays with the caller)
+ * @return NULL on success, error message on failure
+ */
+const char* consumer_producer_put_owned(consumer_producer_t* queue, char* item);
+
+/**
+ * Add several items to the queue without copying them (producer).
+ * Blocks until every item is queued; items are published in as few steps
+ * as the free space allows.
+ * @param queue Pointer to queue structure
+ * @param items Heap strings to add, in order
+ * @param count Number of items
+ * @return Number of items queued (queue owns those); fewer than count only if
+ *         the queue finished, the rest stay with the caller
+ */
+int consumer_producer_put_batch(consumer_producer_t* queue, char** items, int count);
+
 /**
  * Remove an item from the queue (consumer) and returns it.
  * Blocks if queue is empty.
@@ -53,7 +160,149 @@ const char* consumer_producer_put(consumer_producer_t* queue, const char* item);
 char* consumer_producer_get(consumer_producer_t* queue);
 
 /**
- * Signal that processing is finished
+ * Remove up to max items from the queue (consumer) in one step.
+ * Blocks only while the queue is empty; never waits for a full batch.
+ * @param queue Pointer to queue structure
+ * @param out Array receiving the items, in order (caller owns them)
+ * @param max Capacity of out
+ * @return Number of items taken, 0 once the queue is finished and empty
+ */
+int consumer_producer_get_batch(consumer_producer_t* queue, char** out, int max);
+
+/**
+ * Like consumer_producer_get_batch, and also reports the sequence number of
+ * the first item taken. Items are numbered 0, 1, 2... in queue order, so a
+ * batch holds first_seq .. first_seq + count - 1 even with several consumers.
+ * @param queue Pointer to queue structure
+ * @param out Array receiving the items, in order (caller owns them)
+ * @param max Capacity of out
+ * @param first_seq Receives the sequence number of out[0]
+ * @return Number of items taken, 0 once the queue is finished and empty
+ */
+int consumer_producer_get_batch_seq(consumer_producer_t* queue, char** out, int max, size_t* first_seq);
+
+/**
+ * Like consumer_producer_get_batch_seq, and also reports a control token. A
+ * batch never reaches past a flush marker: the batch that ends at it reports
+ * CP_CONTROL_FLUSH (it may be empty, when the marker is first in line).
+ * CP_CONTROL_EOS comes with 0 items once the queue is finished and drained,
+ * CP_CONTROL_ABORT with 0 items as soon as the queue is aborted.
+ * @param queue Pointer to queue structure
+ * @param out Array receiving the items, in order (caller owns them)
+ * @param max Capacity of out
+ * @param first_seq Receives the sequence number of out[0]
+ * @param control Receives CP_CONTROL_NONE or the token that ended the batch
+ * @return Number of items taken
+ */
+int consumer_producer_get_batch_control(consumer_producer_t* queue, char** out, int max, size_t* first_seq, cp_control_t* control);
+
+/**
+ * Like consumer_producer_get_batch_control, waiting at most timeout_ms for an
+ * item or a token - when the time is up it returns 0 with CP_CONTROL_NONE
+ * @param queue Pointer to queue structure
+ * @param out Array receiving the items, in order (caller owns them)
+ * @param max Capacity of out
+ * @param first_seq Receives the sequence number of out[0]
+ * @param control Receives CP_CONTROL_NONE or the token that ended the batch
+ * @param timeout_ms Longest wait in milliseconds, -1 for no limit
+ * @return Number of items taken
+ */
+int consumer_producer_get_batch_timed(consumer_producer_t* queue, char** out, int max, size_t* first_seq, cp_control_t* control,
+                                      int timeout_ms);
+
+/**
+ * Send a control token. CP_CONTROL_FLUSH is ordered with the items, so it
+ * must come from the thread that puts; the others may come from any thread.
+ * CP_CONTROL_EOS does not signal the finished monitor - the consumer does
+ * that (consumer_producer_signal_finished) once it has handled the end.
+ * CP_CONTROL_ABORT does, so waiters return without waiting for a drain.
+ * @param queue Pointer to queue structure
+ * @param control CP_CONTROL_FLUSH, CP_CONTROL_EOS or CP_CONTROL_ABORT
+ */
+void consumer_producer_control(consumer_producer_t* queue, cp_control_t control);
+
+/**
+ * Check whether the queue was aborted - safe from any thread, takes no lock
+ * @param queue Pointer to queue structure
+ * @return 1 if aborted, 0 otherwise
+ */
+int consumer_producer_aborted(consumer_producer_t* queue);
+
+/**
+ * Take the items left in a queue no thread uses any more (after an abort,
+ * gets no longer hand them out), so the caller can free them
+ * @param queue Pointer to queue structure
+ * @param out Array receiving the items, in order (caller owns them)
+ * @param max Capacity of out
+ * @return Number of items taken, 0 once the queue is empty
+ */
+int consumer_producer_drain(consumer_producer_t* queue, char** out, int max);
+
+/**
+ * Change the capacity while the queue is in use, from any thread. Locked mode
+ * resizes its array at once; in spsc mode the producer moves to a ring of the
+ * new size on its next put, and the consumer follows once it has taken the
+ * items of the old one. Items above a lowered capacity stay queued, puts
+ * wait until they are taken.
+ * @param queue Pointer to queue structure
+ * @param capacity New maximum number of items
+ * @return NULL on success, error message on failure (the capacity is unchanged)
+ */
+const char* consumer_producer_set_capacity(consumer_producer_t* queue, int capacity);
+
+/**
+ * Choose how the queue waits when it is empty or full, from any thread - both
+ * the producer and the consumer follow it from their next wait. Spinning only
+ * pays off with the two on different cpus, so on a single cpu CP_WAIT_SPIN
+ * yields at once. Locked mode always sleeps on its condition variables.
+ * @param queue Pointer to queue structure
+ * @param wait CP_WAIT_PARK, CP_WAIT_YIELD or CP_WAIT_SPIN
+ * @return NULL on success, error message on failure
+ */
+const char* consumer_producer_set_wait(consumer_producer_t* queue, cp_wait_t wait);
+
+/**
+ * Give the queue a function a producer runs when it finds the queue full,
+ * before it waits - for a consumer that is not a thread of its own, which has
+ * to be told there is work, and so producers of a thread pool can run other
+ * work instead of sleeping. Set before the queue is used.
+ * @param queue Pointer to queue structure
+ * @param hook Returns 1 to have the producer look at the queue again instead
+ *             of waiting, 0 to wait as usual (NULL for no hook)
+ * @param arg Passed to hook
+ */
+void consumer_producer_set_full_hook(consumer_producer_t* queue, int (*hook)(void*), void* arg);
+
+/**
+ * Move the queue's memory to a NUMA node, as far as the kernel can (pages it
+ * cannot move stay where they are) - meant for the node its consumers run
+ * on, before items flow. A ring allocated later by a capacity change is
+ * placed by the kernel's usual first touch policy.
+ * @param queue Pointer to queue structure
+ * @param node The node
+ * @return NULL on success, error message if the kernel cannot move pages
+ */
+const char* consumer_producer_move_to_node(consumer_producer_t* queue, int node);
+
+/**
+ * Read the capacity - safe from any thread, takes no lock
+ * @param queue Pointer to queue structure
+ * @return The current maximum number of items
+ */
+int consumer_producer_get_capacity(consumer_producer_t* queue);
+
+/**
+ * Read the queue's statistics - safe from any thread, takes no lock
+ * @param queue Pointer to queue structure
+ * @param put_wait_ns Receives the time producers spent blocked on a full queue
+ * @param get_wait_ns Receives the time consumers spent blocked on an empty queue
+ * @param high_water Receives the most items a consumer found waiting
+ */
+void consumer_producer_get_stats(consumer_producer_t* queue, uint64_t* put_wait_ns, uint64_t* get_wait_ns, size_t* high_water);
+
+/**
+ * Signal that processing is finished - no more puts, consumers drain what is
+ * queued, and the finished monitor is signaled
  * @param queue Pointer to queue structure
  */
 void consumer_producer_signal_finished(consumer_producer_t* queue);
@@ -65,4 +314,4 @@ void consumer_producer_signal_finished(consumer_producer_t* queue);
  */
 int consumer_producer_wait_finished(consumer_producer_t* queue);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,120 @@
+#include "message.h"
+#include "buffer_pool.h"
+#include <string.h>
+
+// allocate the message itself
+static plugin_msg_t* message_alloc(char* data, size_t len, size_t capacity, unsigned int flags) {
+    plugin_msg_t* msg = (plugin_msg_t*)buffer_pool_alloc(sizeof(plugin_msg_t));
+    if (!msg) return NULL;
+    msg->data = data;
+    msg->len = len;
+    msg->capacity = capacity;
+    msg->flags = flags;
+    return msg;
+}
+
+// payload stored in the same buffer, right after the message
+static char* inline_data(plugin_msg_t* msg) {
+    return (char*)(msg + 1);
+}
+
+// create an empty message - one buffer for the message and its payload
+plugin_msg_t* message_new(size_t capacity) {
+    plugin_msg_t* msg = (plugin_msg_t*)buffer_pool_alloc(sizeof(plugin_msg_t) + capacity + 1);
+    if (!msg) return NULL;
+    msg->data = inline_data(msg);
+    msg->data[0] = '\0';
+    msg->len = 0;
+    msg->capacity = capacity;
+    msg->flags = 0;
+    return msg;
+}
+
+// create a message holding a copy of data
+plugin_msg_t* message_from(const char* data, size_t len) {
+    plugin_msg_t* msg = message_new(len);
+    if (!msg) return NULL;
+    memcpy(msg->data, data, len);
+    msg->data[len] = '\0';
+    msg->len = len;
+    return msg;
+}
+
+// point a message at data the host keeps - only the message is allocated
+plugin_msg_t* message_borrow(const char* data, size_t len) {
+    return message_alloc((char*)data, len, len, PLUGIN_MSG_BORROWED);
+}
+
+// create an end of stream message - it has no payload
+plugin_msg_t* message_end(void) {
+    return message_alloc(NULL, 0, 0, PLUGIN_MSG_END);
+}
+
+// wrap a v1 string - the one place a v1 item is measured and checked for the end signal
+plugin_msg_t* message_wrap(char* str) {
+    if (!str) return NULL;
+    size_t len = strlen(str);
+    unsigned int flags = strcmp(str, MESSAGE_END_STRING) == 0 ? PLUGIN_MSG_END : 0;
+    return message_alloc(str, len, len, flags); // an end message keeps the string, so unwrap can return it
+}
+
+// take the payload out of a message as a NUL-terminated buffer of its own
+char* message_take_data(plugin_msg_t* msg) {
+    char* str = msg->data;
+    if (!str) return NULL;
+    if (buffer_pool_shared((char*)msg)) return buffer_pool_strndup(str, msg->len); // the other holders keep it
+    if (str == inline_data(msg) || (msg->flags & PLUGIN_MSG_BORROWED)) {
+        str = buffer_pool_strndup(str, msg->len); // the payload goes away with the message
+        if (!str) return NULL;
+    } else {
+        str[msg->len] = '\0'; // there is always room for it
+    }
+    msg->data = NULL;
+    msg->flags &= ~PLUGIN_MSG_BORROWED; // whatever payload comes next is the message's
+    return str;
+}
+
+// turn a message back into a v1 string
+char* message_unwrap(plugin_msg_t* msg) {
+    if (!msg) return NULL;
+    char* str;
+    if (!msg->data && (msg->flags & PLUGIN_MSG_END)) {
+        str = buffer_pool_strndup(MESSAGE_END_STRING, strlen(MESSAGE_END_STRING));
+    } else {
+        str = message_take_data(msg);
+    }
+    message_free(msg);
+    return str;
+}
+
+// add a holder - the message buffer's holders are the message's
+plugin_msg_t* message_share(plugin_msg_t* msg) {
+    buffer_pool_ref((char*)msg);
+    return msg;
+}
+
+// copy a shared or borrowed message, so the caller can change it
+plugin_msg_t* message_own(plugin_msg_t* msg) {
+    if (!msg || (!buffer_pool_shared((char*)msg) && !(msg->flags & PLUGIN_MSG_BORROWED))) return msg;
+    plugin_msg_t* copy = msg->data ? message_from(msg->data, msg->len) : message_alloc(NULL, 0, 0, 0);
+    if (copy) copy->flags = msg->flags & ~PLUGIN_MSG_BORROWED;
+    message_free(msg);
+    return copy;
+}
+
+// free a message's payload unless it is stored in the message itself, or
+// borrowed - then the message no longer is
+void message_free_data(plugin_msg_t* msg, char* data) {
+    if (msg->flags & PLUGIN_MSG_BORROWED) {
+        msg->flags &= ~PLUGIN_MSG_BORROWED;
+        return;
+    }
+    if (data != inline_data(msg)) buffer_pool_free(data);
+}
+
+// free a message and its payload
+void message_free(plugin_msg_t* msg) {
+    if (!msg || !buffer_pool_unref((char*)msg)) return; // the payload is the other holders' too
+    message_free_data(msg, msg->data);
+    buffer_pool_free((char*)msg);
+}
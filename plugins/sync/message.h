@@ -0,0 +1,107 @@
+#ifndef MESSAGE_H
+#define MESSAGE_H
+
+#include <stddef.h>
+#include "../plugin_sdk.h"
+
+/**
+ * Helpers for plugin_msg_t, the item type of the v2 plugin ABI
+ * A message and its payload are buffer pool buffers - a new message keeps its
+ * payload in the same buffer, a replaced or wrapped payload is separate. The end of the
+ * stream is a control token between stages that take them; elsewhere it is a message
+ * with PLUGIN_MSG_END set, or in v1 strings MESSAGE_END_STRING, and wrapping /
+ * unwrapping converts between the two.
+ * A message sent down several branches is shared, not copied: each branch
+ * holds it and frees it, and a stage that changes messages takes its own copy
+ * first (message_own). A borrowed message points into memory the host keeps
+ * (the mapped input) and is copied the same way before it is changed.
+ */
+
+#define MESSAGE_END_STRING "<END>"      /* the v1 end signal */
+
+/**
+ * Create an empty message
+ * @param capacity Payload bytes it must hold (one more is kept for a NUL)
+ * @return The message, or NULL if out of memory
+ */
+plugin_msg_t* message_new(size_t capacity);
+
+/**
+ * Create a message holding a copy of data
+ * @param data Payload to copy (may contain NULs)
+ * @param len Payload bytes
+ * @return The message, or NULL if out of memory
+ */
+plugin_msg_t* message_from(const char* data, size_t len);
+
+/**
+ * Create a message that points at data without copying it - data must stay
+ * unchanged until every holder has freed the message
+ * @param data Payload (may contain NULs, need not be NUL-terminated)
+ * @param len Payload bytes
+ * @return The message, or NULL if out of memory
+ */
+plugin_msg_t* message_borrow(const char* data, size_t len);
+
+/**
+ * Create an end of stream message
+ * @return The message, or NULL if out of memory
+ */
+plugin_msg_t* message_end(void);
+
+/**
+ * Wrap a v1 string (a NUL-terminated pool buffer) in a message without
+ * copying it - MESSAGE_END_STRING becomes an end of stream message
+ * @param str The string, owned by the message on success
+ * @return The message, or NULL if out of memory (the caller keeps str)
+ */
+plugin_msg_t* message_wrap(char* str);
+
+/**
+ * Take the payload out of a message, as a NUL-terminated pool buffer of its own
+ * @param msg The message (its data is NULL afterwards, unless it is shared -
+ *        then the payload stays and the caller gets a copy)
+ * @return The payload, or NULL if out of memory (the message keeps it)
+ */
+char* message_take_data(plugin_msg_t* msg);
+
+/**
+ * Turn a message back into a v1 string, freeing the message itself
+ * @param msg The message
+ * @return The NUL-terminated payload (MESSAGE_END_STRING for the end of the
+ *         stream), or NULL if out of memory
+ */
+char* message_unwrap(plugin_msg_t* msg);
+
+/**
+ * Add a holder to a message, for one more branch - every holder frees it
+ * once, and none may change it while it is shared
+ * @param msg The message
+ * @return msg
+ */
+plugin_msg_t* message_share(plugin_msg_t* msg);
+
+/**
+ * Make a message safe to change - a shared or borrowed one is copied and
+ * the caller's hold on it dropped
+ * @param msg The message
+ * @return The message to change (msg itself if nobody else holds it), or
+ *         NULL if out of memory (msg is freed)
+ */
+plugin_msg_t* message_own(plugin_msg_t* msg);
+
+/**
+ * Free a payload the message no longer points to (it may be stored inside
+ * the message, and is then freed with it)
+ * @param msg The message
+ * @param data The old payload
+ */
+void message_free_data(plugin_msg_t* msg, char* data);
+
+/**
+ * Free a message and its payload - a shared one only loses this holder
+ * @param msg The message (NULL is ignored)
+ */
+void message_free(plugin_msg_t* msg);
+
+#endif
@@ -3,6 +3,12 @@
 
 #include <pthread.h>
 
+/*
+ * Manual-reset event: once signaled, every wait returns immediately until
+ * monitor_reset is called. Suited to one-shot latches such as "finished";
+ * per-item not-empty/not-full waits must use a condition predicate instead,
+ * otherwise the sticky signal turns every later wait into a busy loop.
+ */
 typedef struct {
     pthread_mutex_t mutex;      
     pthread_cond_t condition;   
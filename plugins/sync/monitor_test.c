@@ -1,7 +1,13 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <pthread.h>
+#include <time.h>
 #include <unistd.h>
 #include "monitor.h"
+#include "consumer_producer.h"
+
+#define IDLE_STAGES 10
+#define IDLE_CPU_LIMIT_MS 50 // whole process, over one idle second
 
 monitor_t test_monitor;
 
@@ -139,6 +145,67 @@ int test_reset_without_signal() {
     return result == 0;
 }
 
+// one pipeline stage: forward everything from its queue to the next one
+typedef struct {
+    consumer_producer_t* in;
+    consumer_producer_t* out;
+} idle_stage_t;
+
+void* idle_stage_thread(void* arg) {
+    idle_stage_t* stage = (idle_stage_t*)arg;
+    char* item;
+    while ((item = consumer_producer_get(stage->in)) != NULL) {
+        if (stage->out) consumer_producer_put(stage->out, item);
+        free(item);
+    }
+    if (stage->out) consumer_producer_signal_finished(stage->out);
+    return NULL;
+}
+
+double process_cpu_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+int run_idle_pipeline(cp_mode_t mode, const char* label) {
+    consumer_producer_t queues[IDLE_STAGES];
+    idle_stage_t stages[IDLE_STAGES];
+    pthread_t threads[IDLE_STAGES];
+
+    for (int i = 0; i < IDLE_STAGES; i++) {
+        consumer_producer_init_mode(&queues[i], 4, mode);
+    }
+    for (int i = 0; i < IDLE_STAGES; i++) {
+        stages[i].in = &queues[i];
+        stages[i].out = (i + 1 < IDLE_STAGES) ? &queues[i + 1] : NULL;
+        pthread_create(&threads[i], NULL, idle_stage_thread, &stages[i]);
+    }
+
+    // push a few items through so every stage has been woken at least once
+    for (int i = 0; i < 8; i++) consumer_producer_put(&queues[0], "warmup");
+    sleep(1);
+
+    // every stage is now blocked on an empty queue
+    double before = process_cpu_ms();
+    sleep(1);
+    double idle_ms = process_cpu_ms() - before;
+    printf("[%s] %d idle stages used %.1f ms CPU in 1s (limit %d ms)\n", label, IDLE_STAGES, idle_ms, IDLE_CPU_LIMIT_MS);
+
+    consumer_producer_signal_finished(&queues[0]);
+    for (int i = 0; i < IDLE_STAGES; i++) pthread_join(threads[i], NULL);
+    for (int i = 0; i < IDLE_STAGES; i++) consumer_producer_destroy(&queues[i]);
+
+    return idle_ms < IDLE_CPU_LIMIT_MS;
+}
+
+int test_idle_pipeline_cpu() {
+    printf("\nTesting idle pipeline CPU usage...\n");
+    int ok = run_idle_pipeline(CP_MODE_LOCKED, "locked");
+    ok &= run_idle_pipeline(CP_MODE_SPSC, "spsc");
+    return ok;
+}
+
 int main() {
     printf("Starting monitor tests...\n");
     
@@ -148,7 +215,7 @@ int main() {
     }
 
     int tests_passed = 0;
-    int total_tests = 7;
+    int total_tests = 8;
 
     tests_passed += test_signal_before_wait();
     tests_passed += test_wait_then_signal();
@@ -157,6 +224,7 @@ int main() {
     tests_passed += test_signal_without_waiters();
     tests_passed += test_multiple_signals();
     tests_passed += test_reset_without_signal();
+    tests_passed += test_idle_pipeline_cpu();
 
     printf("\nTest Results: %d/%d tests passed\n", tests_passed, total_tests);
     
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include "buffer_pool.h"
+
+#define HANDOFF_ITEMS 100000
+#define HANDOFF_SLOTS 256
+
+// a tiny mutex ring to hand buffers from one thread to another
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    char* slots[HANDOFF_SLOTS];
+    int head, count;
+} handoff_t;
+
+/* === Helper Threads === */
+void* alloc_thread(void* arg) {
+    handoff_t* h = (handoff_t*)arg;
+    for (int i = 0; i < HANDOFF_ITEMS; i++) {
+        size_t size = 1 + (size_t)(i % 5000);
+        char* buf = buffer_pool_alloc(size);
+        assert(buf != NULL);
+        memset(buf, 'a' + i % 26, size - 1);
+        buf[size - 1] = '\0';
+
+        pthread_mutex_lock(&h->lock);
+        while (h->count == HANDOFF_SLOTS) pthread_cond_wait(&h->changed, &h->lock);
+        h->slots[(h->head + h->count) % HANDOFF_SLOTS] = buf;
+        h->count++;
+        pthread_cond_broadcast(&h->changed);
+        pthread_mutex_unlock(&h->lock);
+    }
+    buffer_pool_thread_flush();
+    return NULL;
+}
+
+void* free_thread(void* arg) {
+    handoff_t* h = (handoff_t*)arg;
+    for (int i = 0; i < HANDOFF_ITEMS; i++) {
+        pthread_mutex_lock(&h->lock);
+        while (h->count == 0) pthread_cond_wait(&h->changed, &h->lock);
+        char* buf = h->slots[h->head];
+        h->head = (h->head + 1) % HANDOFF_SLOTS;
+        h->count--;
+        pthread_cond_broadcast(&h->changed);
+        pthread_mutex_unlock(&h->lock);
+
+        size_t size = 1 + (size_t)(i % 5000);
+        assert(strlen(buf) == size - 1); // nobody else wrote to it
+        assert(size == 1 || buf[0] == 'a' + i % 26);
+        buffer_pool_free(buf);
+    }
+    return NULL;
+}
+
+/* === TESTS === */
+
+// 1. Every size gets a usable buffer
+void test_sizes() {
+    printf("Testing sizes...\n");
+    size_t sizes[] = { 0, 1, 31, 32, 33, 64, 65, 1000, 4095, 4096, 4097, 100000 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        char* buf = buffer_pool_alloc(sizes[i]);
+        assert(buf != NULL);
+        memset(buf, 'x', sizes[i]); // the whole size is writable
+        buffer_pool_free(buf);
+    }
+    buffer_pool_free(NULL); // ignored
+}
+
+// 2. A freed buffer is handed out again for the same size class
+void test_reuse() {
+    printf("Testing reuse...\n");
+    char* a = buffer_pool_alloc(100);
+    assert(a != NULL);
+    buffer_pool_free(a);
+    char* b = buffer_pool_alloc(120); // same class (128 bytes)
+    assert(b == a);
+    buffer_pool_free(b);
+
+    // a different class does not get it
+    char* c = buffer_pool_alloc(20);
+    assert(c != a);
+    buffer_pool_free(c);
+    buffer_pool_thread_flush();
+}
+
+// 3. strndup copies exactly len bytes and terminates
+void test_strndup() {
+    printf("Testing strndup...\n");
+    char* s = buffer_pool_strndup("hello world", 5);
+    assert(s != NULL);
+    assert(strcmp(s, "hello") == 0);
+    buffer_pool_free(s);
+
+    s = buffer_pool_strndup("", 0);
+    assert(s != NULL && s[0] == '\0');
+    buffer_pool_free(s);
+    assert(buffer_pool_strndup(NULL, 3) == NULL);
+}
+
+// 4. Buffers allocated on one thread and freed on another come back intact
+void test_cross_thread() {
+    printf("Testing cross-thread free...\n");
+    handoff_t h;
+    memset(&h, 0, sizeof(h));
+    pthread_mutex_init(&h.lock, NULL);
+    pthread_cond_init(&h.changed, NULL);
+
+    pthread_t producer, consumer;
+    pthread_create(&producer, NULL, alloc_thread, &h);
+    pthread_create(&consumer, NULL, free_thread, &h);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+    assert(h.count == 0);
+
+    pthread_mutex_destroy(&h.lock);
+    pthread_cond_destroy(&h.changed);
+}
+
+// 5. Several threads freeing into one pool at once
+void* free_many_thread(void* arg) {
+    char** bufs = (char**)arg;
+    for (int i = 0; i < 1000; i++) buffer_pool_free(bufs[i]);
+    return NULL;
+}
+
+void test_concurrent_free() {
+    printf("Testing concurrent free...\n");
+    static char* bufs[4][1000];
+    for (int t = 0; t < 4; t++) {
+        for (int i = 0; i < 1000; i++) {
+            bufs[t][i] = buffer_pool_alloc(50);
+            assert(bufs[t][i] != NULL);
+        }
+    }
+    pthread_t threads[4];
+    for (int t = 0; t < 4; t++) pthread_create(&threads[t], NULL, free_many_thread, bufs[t]);
+    for (int t = 0; t < 4; t++) pthread_join(threads[t], NULL);
+
+    // all 4000 are back - allocating them again must not give one out twice
+    char* again[4000];
+    for (int i = 0; i < 4000; i++) {
+        again[i] = buffer_pool_alloc(50);
+        assert(again[i] != NULL);
+        again[i][0] = 0;
+    }
+    for (int i = 0; i < 4000; i++) {
+        assert(again[i][0] == 0);
+        again[i][0] = 1; // a duplicate would already be 1
+    }
+    for (int i = 0; i < 4000; i++) buffer_pool_free(again[i]);
+    buffer_pool_thread_flush();
+}
+
+// 6. A shared buffer goes back with its last holder, from whichever thread
+void* release_thread(void* arg) {
+    char** bufs = (char**)arg;
+    for (int i = 0; i < 1000; i++) buffer_pool_free(bufs[i]);
+    return NULL;
+}
+
+void test_refs() {
+    printf("Testing shared buffers...\n");
+    char* buf = buffer_pool_alloc(50);
+    assert(!buffer_pool_shared(buf));
+    assert(buffer_pool_ref(buf) == buf && buffer_pool_shared(buf));
+    assert(buffer_pool_unref(buf) == 0); // the other holder keeps it
+    assert(!buffer_pool_shared(buf));
+    assert(buffer_pool_unref(buf) == 1); // the last one, still ours
+    buffer_pool_free(buf);
+
+    static char* bufs[1000];
+    for (int i = 0; i < 1000; i++) {
+        bufs[i] = buffer_pool_ref(buffer_pool_alloc(50));
+        assert(bufs[i] != NULL);
+    }
+    pthread_t threads[2];
+    for (int t = 0; t < 2; t++) pthread_create(&threads[t], NULL, release_thread, bufs);
+    for (int t = 0; t < 2; t++) pthread_join(threads[t], NULL);
+
+    // every buffer is back exactly once
+    char* again[1000];
+    for (int i = 0; i < 1000; i++) {
+        again[i] = buffer_pool_alloc(50);
+        assert(!buffer_pool_shared(again[i])); // a recycled buffer has one holder
+        again[i][0] = 0;
+    }
+    for (int i = 0; i < 1000; i++) {
+        assert(again[i][0] == 0);
+        again[i][0] = 1;
+    }
+    for (int i = 0; i < 1000; i++) buffer_pool_free(again[i]);
+    buffer_pool_thread_flush();
+}
+
+/* === MAIN === */
+int main() {
+    printf("Starting buffer pool tests...\n\n");
+
+    test_sizes();
+    test_reuse();
+    test_strndup();
+    test_cross_thread();
+    test_concurrent_free();
+    test_refs();
+
+    printf("\n🎉 All tests passed!\n");
+    return 0;
+}
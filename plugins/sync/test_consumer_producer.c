@@ -4,6 +4,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <time.h>
 #include "consumer_producer.h"
 
 // Thread args
@@ -280,6 +281,567 @@ void test_two_by_two_threads() {
     consumer_producer_destroy(&q);
 }
 
+// 3. SPSC ring: order preserved and non power of two capacity respected
+void test_spsc_basic() {
+    printf("Testing spsc ring put/get...\n");
+    consumer_producer_t q;
+    assert(consumer_producer_init_mode(&q, 3, CP_MODE_SPSC) == NULL);
+
+    assert(consumer_producer_put(&q, "a") == NULL);
+    assert(consumer_producer_put(&q, "b") == NULL);
+    assert(consumer_producer_put(&q, "c") == NULL);
+    assert(q.spsc_tail - q.spsc_head == 3); // ring has 4 slots, capacity is 3
+
+    const char* expected[] = {"a", "b", "c"};
+    for (int i = 0; i < 3; i++) {
+        char* item = consumer_producer_get(&q);
+        assert(strcmp(item, expected[i]) == 0);
+        free(item);
+    }
+
+    consumer_producer_signal_finished(&q);
+    assert(strcmp(consumer_producer_put(&q, "d"), "queue finished") == 0);
+    assert(consumer_producer_get(&q) == NULL);
+    consumer_producer_destroy(&q);
+}
+
+// 4. SPSC ring: blocked producer and consumer are woken
+void test_spsc_blocking() {
+    printf("Testing spsc ring blocking...\n");
+    consumer_producer_t q;
+    assert(consumer_producer_init_mode(&q, 2, CP_MODE_SPSC) == NULL);
+
+    assert(consumer_producer_put(&q, "item1") == NULL);
+    assert(consumer_producer_put(&q, "item2") == NULL);
+
+    pthread_t producer;
+    const char* test_item = "item3";
+    thread_args_t args = {&q, 1, &test_item};
+    pthread_create(&producer, NULL, producer_thread, &args);
+    sleep(1); // ensure producer blocks on the full ring
+
+    for (int i = 0; i < 3; i++) free(consumer_producer_get(&q));
+    pthread_join(producer, NULL);
+
+    // consumer blocks on the empty ring until the producer puts
+    pthread_t consumer;
+    thread_args_t cargs = {&q, 1, NULL};
+    pthread_create(&consumer, NULL, consumer_thread, &cargs);
+    sleep(1);
+    assert(consumer_producer_put(&q, "late") == NULL);
+    pthread_join(consumer, NULL);
+
+    consumer_producer_destroy(&q);
+}
+
+// 5. SPSC ring: one producer, one consumer, items arrive in order
+#define SPSC_RUNS 200000
+static void* spsc_counting_producer(void* arg) {
+    consumer_producer_t* q = arg;
+    char buf[16];
+    for (int i = 0; i < SPSC_RUNS; ++i) {
+        snprintf(buf, sizeof buf, "%d", i);
+        assert(consumer_producer_put(q, buf) == NULL);
+    }
+    consumer_producer_signal_finished(q);
+    return NULL;
+}
+
+void test_spsc_ordering() {
+    printf("Testing spsc ring ordering under load...\n");
+    consumer_producer_t q;
+    assert(consumer_producer_init_mode(&q, 16, CP_MODE_SPSC) == NULL);
+
+    pthread_t p;
+    pthread_create(&p, NULL, spsc_counting_producer, &q);
+
+    int expected = 0;
+    char* s;
+    while ((s = consumer_producer_get(&q)) != NULL) {
+        assert(atoi(s) == expected);
+        expected++;
+        free(s);
+    }
+    assert(expected == SPSC_RUNS);
+
+    pthread_join(p, NULL);
+    assert(consumer_producer_wait_finished(&q) == 0);
+    consumer_producer_destroy(&q);
+}
+
+// 6. SPSC ring: destroy frees what was never consumed
+void test_spsc_destroy_with_items() {
+    printf("Testing spsc destroy with unconsumed items...\n");
+    consumer_producer_t q;
+    assert(consumer_producer_init_mode(&q, 4, CP_MODE_SPSC) == NULL);
+    consumer_producer_put(&q, "x");
+    consumer_producer_put(&q, "y");
+    free(consumer_producer_get(&q));
+    consumer_producer_put(&q, "z");
+    consumer_producer_destroy(&q);
+}
+
+// 7. Batch put/get in both modes: order kept, partial batches, finished
+void test_batch_mode(cp_mode_t mode) {
+    consumer_producer_t q;
+    assert(consumer_producer_init_mode(&q, 5, mode) == NULL);
+
+    char* in[4] = {strdup("b0"), strdup("b1"), strdup("b2"), strdup("b3")};
+    assert(consumer_producer_put_batch(&q, in, 4) == 4);
+
+    // only what is queued comes back, never more than max
+    char* out[8];
+    assert(consumer_producer_get_batch(&q, out, 3) == 3);
+    assert(strcmp(out[0], "b0") == 0 && strcmp(out[2], "b2") == 0);
+    for (int i = 0; i < 3; i++) free(out[i]);
+    assert(consumer_producer_get_batch(&q, out, 8) == 1);
+    assert(strcmp(out[0], "b3") == 0);
+    free(out[0]);
+
+    // after finished nothing is accepted and the caller keeps the items
+    consumer_producer_signal_finished(&q);
+    char* late = strdup("late");
+    assert(consumer_producer_put_batch(&q, &late, 1) == 0);
+    free(late);
+    assert(consumer_producer_get_batch(&q, out, 8) == 0);
+
+    consumer_producer_destroy(&q);
+}
+
+// 8. Batch put larger than capacity blocks until the consumer drains
+#define BATCH_RUNS 10000
+static void* batch_producer(void* arg) {
+    consumer_producer_t* q = arg;
+    char* batch[64];
+    for (int i = 0; i < BATCH_RUNS; i += 64) {
+        int n = 0;
+        for (int j = i; j < i + 64 && j < BATCH_RUNS; j++) {
+            char buf[16];
+            snprintf(buf, sizeof buf, "%d", j);
+            batch[n++] = strdup(buf);
+        }
+        assert(consumer_producer_put_batch(q, batch, n) == n);
+    }
+    consumer_producer_signal_finished(q);
+    return NULL;
+}
+
+void test_batch_streaming(cp_mode_t mode) {
+    consumer_producer_t q;
+    assert(consumer_producer_init_mode(&q, 7, mode) == NULL);
+
+    pthread_t p;
+    pthread_create(&p, NULL, batch_producer, &q);
+
+    int expected = 0, n;
+    char* out[16];
+    while ((n = consumer_producer_get_batch(&q, out, 16)) > 0) {
+        for (int i = 0; i < n; i++) {
+            assert(atoi(out[i]) == expected++);
+            free(out[i]);
+        }
+    }
+    assert(expected == BATCH_RUNS);
+
+    pthread_join(p, NULL);
+    consumer_producer_destroy(&q);
+}
+
+// 9. Sequence numbers follow queue order across batches in both modes
+void test_batch_seq(cp_mode_t mode) {
+    consumer_producer_t q;
+    assert(consumer_producer_init_mode(&q, 4, mode) == NULL);
+
+    char* out[4];
+    size_t first = 99;
+    for (int round = 0; round < 3; round++) {
+        char* in[3] = {strdup("s"), strdup("s"), strdup("s")};
+        assert(consumer_producer_put_batch(&q, in, 3) == 3);
+        assert(consumer_producer_get_batch_seq(&q, out, 2, &first) == 2);
+        assert(first == (size_t)round * 3);
+        free(out[0]);
+        free(out[1]);
+        assert(consumer_producer_get_batch_seq(&q, out, 4, &first) == 1);
+        assert(first == (size_t)round * 3 + 2);
+        free(out[0]);
+    }
+    consumer_producer_destroy(&q);
+}
+
+void test_batch() {
+    printf("Testing batch put/get...\n");
+    test_batch_mode(CP_MODE_LOCKED);
+    test_batch_mode(CP_MODE_SPSC);
+    test_batch_streaming(CP_MODE_LOCKED);
+    test_batch_streaming(CP_MODE_SPSC);
+    test_batch_seq(CP_MODE_LOCKED);
+    test_batch_seq(CP_MODE_SPSC);
+}
+
+// stats: blocked time is counted on both sides, high water seen by the consumer
+void test_stats_mode(cp_mode_t mode) {
+    consumer_producer_t q;
+    assert(consumer_producer_init_mode(&q, 2, mode) == NULL);
+
+    uint64_t put_wait, get_wait;
+    size_t high_water;
+    consumer_producer_get_stats(&q, &put_wait, &get_wait, &high_water);
+    assert(put_wait == 0 && get_wait == 0 && high_water == 0);
+
+    // producer blocks on the full queue for about 200ms
+    assert(consumer_producer_put(&q, "item1") == NULL);
+    assert(consumer_producer_put(&q, "item2") == NULL);
+    pthread_t producer;
+    const char* test_item = "item3";
+    thread_args_t args = {&q, 1, &test_item};
+    pthread_create(&producer, NULL, producer_thread, &args);
+    usleep(200000);
+    for (int i = 0; i < 3; i++) free(consumer_producer_get(&q));
+    pthread_join(producer, NULL);
+
+    // consumer blocks on the empty queue for about 200ms
+    pthread_t consumer;
+    thread_args_t cargs = {&q, 1, NULL};
+    pthread_create(&consumer, NULL, consumer_thread, &cargs);
+    usleep(200000);
+    assert(consumer_producer_put(&q, "late") == NULL);
+    pthread_join(consumer, NULL);
+
+    consumer_producer_get_stats(&q, &put_wait, &get_wait, &high_water);
+    assert(put_wait >= 100000000ULL && put_wait < 2000000000ULL);
+    assert(get_wait >= 100000000ULL && get_wait < 2000000000ULL);
+    assert(high_water == 2);
+    consumer_producer_destroy(&q);
+}
+
+void test_stats() {
+    printf("Testing queue stats...\n");
+    test_stats_mode(CP_MODE_LOCKED);
+    test_stats_mode(CP_MODE_SPSC);
+}
+
+// control tokens: a flush marker ends a batch in order, the end comes after
+// the last item, and an abort stops both sides at once
+static void* control_consumer(void* arg) {
+    consumer_producer_t* q = (consumer_producer_t*)arg;
+    char* out[4];
+    size_t first;
+    cp_control_t control;
+    assert(consumer_producer_get_batch_control(q, out, 4, &first, &control) == 0);
+    assert(control == CP_CONTROL_FLUSH); // woken by the marker alone
+    return NULL;
+}
+
+static void* control_blocked_producer(void* arg) {
+    consumer_producer_t* q = (consumer_producer_t*)arg;
+    char* item = strdup("late");
+    assert(consumer_producer_put_owned(q, item) != NULL); // the abort fails it
+    free(item);
+    return NULL;
+}
+
+void test_control_mode(cp_mode_t mode) {
+    consumer_producer_t q;
+    assert(consumer_producer_init_mode(&q, 8, mode) == NULL);
+    char* out[8];
+    size_t first;
+    cp_control_t control;
+
+    // flush after three items - the batch stops there even with room for more
+    for (int i = 0; i < 3; i++) assert(consumer_producer_put(&q, "a") == NULL);
+    consumer_producer_control(&q, CP_CONTROL_FLUSH);
+    for (int i = 0; i < 2; i++) assert(consumer_producer_put(&q, "b") == NULL);
+    assert(consumer_producer_get_batch_control(&q, out, 8, &first, &control) == 3);
+    assert(first == 0 && control == CP_CONTROL_FLUSH);
+    for (int i = 0; i < 3; i++) free(out[i]);
+    assert(consumer_producer_get_batch_control(&q, out, 8, &first, &control) == 2);
+    assert(first == 3 && control == CP_CONTROL_NONE && strcmp(out[0], "b") == 0);
+    for (int i = 0; i < 2; i++) free(out[i]);
+
+    // a marker on an empty queue wakes a sleeping consumer
+    pthread_t consumer;
+    pthread_create(&consumer, NULL, control_consumer, &q);
+    usleep(50000);
+    consumer_producer_control(&q, CP_CONTROL_FLUSH);
+    pthread_join(consumer, NULL);
+
+    // callers that do not ask for tokens never see a marker
+    assert(consumer_producer_put(&q, "c") == NULL);
+    consumer_producer_control(&q, CP_CONTROL_FLUSH);
+    assert(consumer_producer_put(&q, "d") == NULL);
+    assert(consumer_producer_get_batch_seq(&q, out, 8, &first) == 1);
+    free(out[0]);
+    assert(consumer_producer_get_batch_seq(&q, out, 8, &first) == 1);
+    assert(strcmp(out[0], "d") == 0);
+    free(out[0]);
+
+    // end of stream - queued items are still handed out, then the end
+    assert(consumer_producer_put(&q, "e") == NULL);
+    consumer_producer_control(&q, CP_CONTROL_EOS);
+    assert(consumer_producer_put(&q, "f") != NULL);
+    assert(consumer_producer_get_batch_control(&q, out, 8, &first, &control) == 1);
+    assert(control == CP_CONTROL_NONE);
+    free(out[0]);
+    assert(consumer_producer_get_batch_control(&q, out, 8, &first, &control) == 0);
+    assert(control == CP_CONTROL_EOS && !consumer_producer_aborted(&q));
+    consumer_producer_destroy(&q);
+
+    // abort - a blocked producer fails, queued items are not handed out but drained
+    assert(consumer_producer_init_mode(&q, 2, mode) == NULL);
+    assert(consumer_producer_put(&q, "x") == NULL);
+    assert(consumer_producer_put(&q, "y") == NULL);
+    pthread_t producer;
+    pthread_create(&producer, NULL, control_blocked_producer, &q);
+    usleep(50000);
+    consumer_producer_control(&q, CP_CONTROL_ABORT);
+    pthread_join(producer, NULL);
+    assert(consumer_producer_aborted(&q));
+    assert(consumer_producer_wait_finished(&q) == 0);
+    assert(consumer_producer_get_batch_control(&q, out, 8, &first, &control) == 0);
+    assert(control == CP_CONTROL_ABORT);
+    assert(consumer_producer_drain(&q, out, 8) == 2);
+    assert(strcmp(out[0], "x") == 0 && strcmp(out[1], "y") == 0);
+    free(out[0]);
+    free(out[1]);
+    assert(consumer_producer_drain(&q, out, 8) == 0);
+    consumer_producer_destroy(&q);
+}
+
+// a timed get returns empty handed once the time is up, and at once with an item
+void test_timed_mode(cp_mode_t mode) {
+    consumer_producer_t q;
+    assert(consumer_producer_init_mode(&q, 4, mode) == NULL);
+    char* out[4];
+    size_t first;
+    cp_control_t control;
+
+    struct timespec a, b;
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    assert(consumer_producer_get_batch_timed(&q, out, 4, &first, &control, 100) == 0);
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    long ms = (b.tv_sec - a.tv_sec) * 1000 + (b.tv_nsec - a.tv_nsec) / 1000000;
+    assert(control == CP_CONTROL_NONE && ms >= 90 && ms < 2000);
+
+    assert(consumer_producer_put(&q, "now") == NULL);
+    assert(consumer_producer_get_batch_timed(&q, out, 4, &first, &control, 0) == 1);
+    free(out[0]);
+    consumer_producer_control(&q, CP_CONTROL_EOS);
+    assert(consumer_producer_get_batch_timed(&q, out, 4, &first, &control, 1000) == 0);
+    assert(control == CP_CONTROL_EOS);
+    consumer_producer_destroy(&q);
+}
+
+void test_control() {
+    printf("Testing control tokens...\n");
+    test_control_mode(CP_MODE_LOCKED);
+    test_control_mode(CP_MODE_SPSC);
+    test_timed_mode(CP_MODE_LOCKED);
+    test_timed_mode(CP_MODE_SPSC);
+}
+
+// 11. Capacity changes keep every item, in order, and apply to later puts
+static int queued(consumer_producer_t* q) {
+    return q->mode == CP_MODE_SPSC ? (int)(q->spsc_tail - q->spsc_head) : q->count;
+}
+
+void test_resize_mode(cp_mode_t mode) {
+    consumer_producer_t q;
+    char buf[16];
+    assert(consumer_producer_init_mode(&q, 4, mode) == NULL);
+    assert(consumer_producer_set_capacity(&q, 0) != NULL);
+
+    // grow with the queue full
+    for (int i = 0; i < 4; i++) {
+        snprintf(buf, sizeof buf, "%d", i);
+        assert(consumer_producer_put(&q, buf) == NULL);
+    }
+    assert(consumer_producer_set_capacity(&q, 100) == NULL);
+    assert(consumer_producer_get_capacity(&q) == 100);
+    for (int i = 4; i < 100; i++) {
+        snprintf(buf, sizeof buf, "%d", i);
+        assert(consumer_producer_put(&q, buf) == NULL); // would block at the old capacity
+    }
+    assert(queued(&q) == 100);
+
+    // shrink below what is queued - nothing is lost
+    assert(consumer_producer_set_capacity(&q, 3) == NULL);
+    for (int i = 0; i < 100; i++) {
+        char* item = consumer_producer_get(&q);
+        assert(item && atoi(item) == i);
+        free(item);
+    }
+    for (int i = 0; i < 3; i++) assert(consumer_producer_put(&q, "x") == NULL);
+    assert(queued(&q) == 3);
+    consumer_producer_destroy(&q); // frees them, and the rings
+}
+
+// resize from a third thread while items stream through
+typedef struct {
+    consumer_producer_t* queue;
+    int stop;
+} resize_args_t;
+
+void* resizing_thread(void* arg) {
+    resize_args_t* args = arg;
+    int sizes[] = { 1, 64, 7, 1024, 2, 300 };
+    for (int i = 0; !__atomic_load_n(&args->stop, __ATOMIC_ACQUIRE); i++) {
+        assert(consumer_producer_set_capacity(args->queue, sizes[i % 6]) == NULL);
+        usleep(100);
+    }
+    return NULL;
+}
+
+void test_resize_streaming(cp_mode_t mode) {
+    consumer_producer_t q;
+    assert(consumer_producer_init_mode(&q, 16, mode) == NULL);
+    resize_args_t args = { &q, 0 };
+    pthread_t p, r;
+    pthread_create(&p, NULL, spsc_counting_producer, &q);
+    pthread_create(&r, NULL, resizing_thread, &args);
+
+    int expected = 0;
+    char* s;
+    while ((s = consumer_producer_get(&q)) != NULL) {
+        assert(atoi(s) == expected);
+        expected++;
+        free(s);
+    }
+    assert(expected == SPSC_RUNS);
+    pthread_join(p, NULL);
+    __atomic_store_n(&args.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(r, NULL);
+    consumer_producer_destroy(&q);
+}
+
+// a put that moves to a smaller ring, finds it full and is stopped by the
+// finish - no item reaches the new ring, the old one is still freed
+void* blocked_put_thread(void* arg) {
+    consumer_producer_t* q = arg;
+    assert(consumer_producer_put(q, "late") != NULL); // finished while waiting
+    return NULL;
+}
+
+void test_resize_unpublished(int drain) {
+    consumer_producer_t q;
+    char buf[16];
+    assert(consumer_producer_init_mode(&q, 64, CP_MODE_SPSC) == NULL);
+    for (int i = 0; i < 4; i++) {
+        snprintf(buf, sizeof buf, "%d", i);
+        assert(consumer_producer_put(&q, buf) == NULL);
+    }
+    assert(consumer_producer_set_capacity(&q, 2) == NULL);
+    pthread_t p;
+    pthread_create(&p, NULL, blocked_put_thread, &q);
+    usleep(20000);
+    assert(q.resize_pending); // on the new ring, with nothing in it
+    consumer_producer_signal_finished(&q);
+    pthread_join(p, NULL);
+
+    if (drain) {
+        char* out[8];
+        assert(consumer_producer_drain(&q, out, 8) == 4);
+        for (int i = 0; i < 4; i++) {
+            assert(atoi(out[i]) == i);
+            free(out[i]);
+        }
+        assert(!q.resize_pending && q.read_items == q.items); // the old ring is gone
+    }
+    consumer_producer_destroy(&q); // frees the old ring too (checked by leak sanitizers)
+}
+
+void test_resize() {
+    printf("Testing capacity changes...\n");
+    test_resize_mode(CP_MODE_LOCKED);
+    test_resize_mode(CP_MODE_SPSC);
+    test_resize_streaming(CP_MODE_LOCKED);
+    test_resize_streaming(CP_MODE_SPSC);
+    test_resize_unpublished(0);
+    test_resize_unpublished(1);
+}
+
+// 12. Every wait strategy keeps the items in order, and times out like parking
+void test_wait_mode(cp_wait_t wait) {
+    consumer_producer_t q;
+    assert(consumer_producer_init_mode(&q, 4, CP_MODE_SPSC) == NULL);
+    assert(consumer_producer_set_wait(&q, wait) == NULL);
+
+    pthread_t p;
+    pthread_create(&p, NULL, spsc_counting_producer, &q); // small ring, both sides wait
+    int expected = 0;
+    char* s;
+    while ((s = consumer_producer_get(&q)) != NULL) {
+        assert(atoi(s) == expected);
+        expected++;
+        free(s);
+    }
+    assert(expected == SPSC_RUNS);
+    pthread_join(p, NULL);
+    consumer_producer_destroy(&q);
+
+    assert(consumer_producer_init_mode(&q, 4, CP_MODE_SPSC) == NULL);
+    assert(consumer_producer_set_wait(&q, wait) == NULL);
+    char* out[4];
+    size_t first;
+    cp_control_t control;
+    assert(consumer_producer_get_batch_timed(&q, out, 4, &first, &control, 50) == 0);
+    assert(control == CP_CONTROL_NONE);
+    consumer_producer_destroy(&q);
+}
+
+void test_wait() {
+    printf("Testing wait strategies...\n");
+    test_wait_mode(CP_WAIT_PARK);
+    test_wait_mode(CP_WAIT_YIELD);
+    test_wait_mode(CP_WAIT_SPIN);
+    consumer_producer_t q;
+    assert(consumer_producer_init_mode(&q, 4, CP_MODE_SPSC) == NULL);
+    assert(consumer_producer_set_wait(&q, (cp_wait_t)7) != NULL);
+    consumer_producer_destroy(&q);
+}
+
+// 13. A producer on a full queue runs the full hook - here it is its own
+// consumer, so every put completes without another thread
+static int full_hook_calls;
+
+static int drain_one(void* arg) {
+    consumer_producer_t* q = (consumer_producer_t*)arg;
+    full_hook_calls++;
+    free(consumer_producer_get(q));
+    return 1;
+}
+
+void test_full_hook_mode(cp_mode_t mode) {
+    consumer_producer_t q;
+    assert(consumer_producer_init_mode(&q, 2, mode) == NULL);
+    consumer_producer_set_full_hook(&q, drain_one, &q);
+    full_hook_calls = 0;
+    for (int i = 0; i < 10; i++) {
+        char item[16];
+        snprintf(item, sizeof(item), "%d", i);
+        assert(consumer_producer_put(&q, item) == NULL);
+    }
+    assert(full_hook_calls == 8);
+    char* s = consumer_producer_get(&q);
+    assert(s && strcmp(s, "8") == 0);
+    free(s);
+
+    // a timeout of 0 only looks
+    char* out[2];
+    size_t first;
+    cp_control_t control;
+    assert(consumer_producer_get_batch_timed(&q, out, 2, &first, &control, 0) == 1);
+    free(out[0]);
+    assert(consumer_producer_get_batch_timed(&q, out, 2, &first, &control, 0) == 0);
+    assert(control == CP_CONTROL_NONE);
+    consumer_producer_destroy(&q);
+}
+
+void test_full_hook() {
+    printf("Testing the full hook...\n");
+    test_full_hook_mode(CP_MODE_LOCKED);
+    test_full_hook_mode(CP_MODE_SPSC);
+}
+
 /* === MAIN === */
 int main() {
     printf("Starting consumer-producer tests...\n\n");
@@ -296,6 +858,16 @@ int main() {
     test_stress();
     test_capacity_one_put_get();
     test_two_by_two_threads();
+    test_spsc_basic();
+    test_spsc_blocking();
+    test_spsc_ordering();
+    test_spsc_destroy_with_items();
+    test_batch();
+    test_stats();
+    test_control();
+    test_resize();
+    test_wait();
+    test_full_hook();
 
     printf("\n🎉 All tests passed!\n");
     return 0;
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include "message.h"
+#include "buffer_pool.h"
+
+/* === TESTS === */
+
+// 1. A copied payload keeps every byte, NULs included
+void test_from() {
+    printf("Testing message_from...\n");
+    plugin_msg_t* msg = message_from("ab\0cd", 5);
+    assert(msg != NULL);
+    assert(msg->len == 5 && msg->capacity >= 5 && msg->flags == 0);
+    assert(memcmp(msg->data, "ab\0cd", 5) == 0);
+    assert(msg->data[5] == '\0'); // room for a NUL is always kept
+    message_free(msg);
+
+    msg = message_new(100);
+    assert(msg != NULL && msg->len == 0 && msg->capacity == 100);
+    memset(msg->data, 'x', 100); // the whole capacity is writable
+    message_free(msg);
+}
+
+// 2. The end signal converts both ways
+void test_end() {
+    printf("Testing end of stream...\n");
+    plugin_msg_t* msg = message_end();
+    assert(msg != NULL && (msg->flags & PLUGIN_MSG_END) && msg->data == NULL);
+    char* str = message_unwrap(msg);
+    assert(str != NULL && strcmp(str, MESSAGE_END_STRING) == 0);
+
+    msg = message_wrap(str); // and back
+    assert(msg != NULL && (msg->flags & PLUGIN_MSG_END));
+    str = message_unwrap(msg);
+    assert(strcmp(str, MESSAGE_END_STRING) == 0);
+    buffer_pool_free(str);
+}
+
+// 3. Wrapping a v1 string does not copy it, unwrapping gives it back
+void test_wrap() {
+    printf("Testing wrap and unwrap...\n");
+    char* str = buffer_pool_strndup("hello", 5);
+    plugin_msg_t* msg = message_wrap(str);
+    assert(msg != NULL && msg->data == str && msg->len == 5 && msg->flags == 0);
+    msg->len = 3; // shortened in place
+    char* back = message_unwrap(msg);
+    assert(back == str && strcmp(back, "hel") == 0);
+    buffer_pool_free(back);
+    assert(message_wrap(NULL) == NULL);
+}
+
+// 4. Taking the payload of a new message gives a buffer of its own
+void test_take_data() {
+    printf("Testing take data...\n");
+    plugin_msg_t* msg = message_from("payload", 7);
+    char* data = message_take_data(msg);
+    assert(data != NULL && strcmp(data, "payload") == 0);
+    assert(msg->data == NULL);
+    message_free(msg); // the payload is not freed with it
+    assert(strcmp(data, "payload") == 0);
+    buffer_pool_free(data);
+}
+
+// 5. A replaced payload is freed separately
+void test_replace() {
+    printf("Testing replaced payload...\n");
+    plugin_msg_t* msg = message_from("abc", 3);
+    char* old = msg->data;
+    msg->data = buffer_pool_strndup("abcdef", 6);
+    msg->len = 6;
+    msg->capacity = 6;
+    message_free_data(msg, old); // stored in the message, nothing to do
+    message_free(msg); // frees the new payload and the message
+}
+
+// 6. A shared message is copied before it is changed, and freed by its last holder
+void test_share() {
+    printf("Testing shared messages...\n");
+    plugin_msg_t* msg = message_from("shared", 6);
+    assert(message_share(msg) == msg);
+    plugin_msg_t* mine = message_own(msg); // another holder: a copy, our hold dropped
+    assert(mine != msg && mine->len == 6 && memcmp(mine->data, "shared", 6) == 0);
+    assert(message_own(msg) == msg); // the only holder now
+    message_free(msg);
+    message_free(mine);
+
+    msg = message_wrap(buffer_pool_strndup("wrapped", 7));
+    message_share(msg);
+    char* str = message_take_data(msg); // a copy, the other holder keeps the payload
+    assert(str != msg->data && strcmp(str, "wrapped") == 0 && strcmp(msg->data, "wrapped") == 0);
+    buffer_pool_free(str);
+    message_free(msg); // drops a holder
+    message_free(msg); // frees the message and its payload
+
+    msg = message_from("abc", 3);
+    plugin_msg_t* copy = message_own(message_share(msg));
+    assert(copy != msg && copy->len == 3 && memcmp(copy->data, "abc", 3) == 0);
+    copy->data[0] = 'x'; // the other holder's is unchanged
+    assert(memcmp(msg->data, "abc", 3) == 0);
+    message_free(copy);
+    message_free(msg);
+}
+
+// 7. A borrowed payload is read where it is, copied before it is changed,
+// and never freed
+void test_borrow() {
+    printf("Testing borrowed messages...\n");
+    static const char line[] = "borrowed line\nnext";
+    plugin_msg_t* msg = message_borrow(line, 13);
+    assert(msg && msg->data == line && msg->len == 13 && (msg->flags & PLUGIN_MSG_BORROWED));
+    plugin_msg_t* mine = message_own(msg); // a copy, the borrowed one freed without its payload
+    assert(mine != NULL && mine->data != line && !(mine->flags & PLUGIN_MSG_BORROWED));
+    assert(mine->len == 13 && memcmp(mine->data, "borrowed line", 13) == 0 && mine->data[13] == '\0');
+    message_free(mine);
+
+    msg = message_share(message_borrow(line, 8));
+    char* str = message_take_data(msg); // shared: a copy, the other holder keeps it
+    assert(strcmp(str, "borrowed") == 0 && msg->data == line);
+    buffer_pool_free(str);
+    message_free(msg);
+    str = message_take_data(msg); // the last holder: still a copy, the message lets go
+    assert(strcmp(str, "borrowed") == 0 && msg->data == NULL && !(msg->flags & PLUGIN_MSG_BORROWED));
+    msg->data = str; // the payload the message owns now
+    message_free(msg);
+}
+
+/* === MAIN === */
+int main() {
+    printf("Starting message tests...\n\n");
+
+    test_from();
+    test_end();
+    test_wrap();
+    test_take_data();
+    test_replace();
+    test_share();
+    test_borrow();
+
+    printf("\n🎉 All tests passed!\n");
+    return 0;
+}
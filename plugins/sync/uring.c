@@ -0,0 +1,163 @@
+#define _GNU_SOURCE
+#include "uring.h"
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// the io_uring system calls, which glibc has no wrappers for
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// set up a ring and map its queues
+const char* uring_init(uring_t* ring, unsigned entries) {
+    if (!ring || entries == 0) return "args are invalid";
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = sys_io_uring_setup(entries, &p);
+    if (fd < 0) return "io_uring is not available";
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) { // before 5.6, every read needs an offset
+        close(fd);
+        return "io_uring cannot use the file position";
+    }
+    ring->fd = fd;
+
+    ring->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                        IORING_OFF_SQ_RING);
+    ring->cq_map = mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                        IORING_OFF_CQ_RING);
+    void* sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || sqes == MAP_FAILED) {
+        if (ring->sq_map == MAP_FAILED) ring->sq_map = NULL;
+        if (ring->cq_map == MAP_FAILED) ring->cq_map = NULL;
+        ring->sqes = sqes == MAP_FAILED ? NULL : (struct io_uring_sqe*)sqes;
+        uring_exit(ring);
+        return "cannot map the io_uring queues";
+    }
+    ring->sqes = (struct io_uring_sqe*)sqes;
+
+    char* sq = (char*)ring->sq_map;
+    ring->sq_head = (unsigned*)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+    char* cq = (char*)ring->cq_map;
+    ring->cq_head = (unsigned*)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return NULL;
+}
+
+int uring_register_buffers(uring_t* ring, const struct iovec* iov, int count) {
+    if (!ring || ring->fd < 0 || !iov || count <= 0) return -1;
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS, iov, (unsigned)count) != 0) return -1;
+    ring->fixed = 1;
+    return 0;
+}
+
+// the next free submission entry, cleared - NULL if the queue is full
+static struct io_uring_sqe* uring_get_sqe(uring_t* ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail + ring->queued;
+    if (tail - head > *ring->sq_mask) return NULL;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->queued++;
+    return sqe;
+}
+
+int uring_prep_rw(uring_t* ring, int write, int fd, void* buf, unsigned len, int buf_index,
+                  unsigned long long user_data) {
+    struct io_uring_sqe* sqe = uring_get_sqe(ring);
+    if (!sqe) return -1;
+    int fixed = ring->fixed && buf_index >= 0;
+    if (fixed) sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    else sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->off = (unsigned long long)-1; // the current position, advanced by the operation
+    sqe->addr = (unsigned long long)(size_t)buf;
+    sqe->len = len;
+    if (fixed) sqe->buf_index = (unsigned short)buf_index;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+int uring_prep_poll(uring_t* ring, int fd, unsigned long long user_data) {
+    struct io_uring_sqe* sqe = uring_get_sqe(ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+int uring_prep_cancel(uring_t* ring, unsigned long long target, unsigned long long user_data) {
+    struct io_uring_sqe* sqe = uring_get_sqe(ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+int uring_submit(uring_t* ring) {
+    if (!ring || ring->fd < 0) return -1;
+    unsigned count = ring->queued;
+    if (count == 0) return 0;
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + count, __ATOMIC_RELEASE); // entries before the tail
+    ring->queued = 0;
+    while (count > 0) {
+        int n = sys_io_uring_enter(ring->fd, count, 0, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        count -= (unsigned)n;
+    }
+    return 0;
+}
+
+int uring_wait(uring_t* ring, unsigned long long* user_data, int* res) {
+    if (!ring || ring->fd < 0 || !user_data || !res) return -1;
+    while (1) {
+        unsigned head = *ring->cq_head;
+        if (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+            *user_data = cqe->user_data;
+            *res = cqe->res;
+            __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE); // the slot can be reused
+            return 0;
+        }
+        if (sys_io_uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) return -1;
+    }
+}
+
+void uring_exit(uring_t* ring) {
+    if (!ring) return;
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_map) munmap(ring->cq_map, ring->cq_map_len);
+    if (ring->sq_map) munmap(ring->sq_map, ring->sq_map_len);
+    if (ring->fd >= 0) close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
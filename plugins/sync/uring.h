@@ -0,0 +1,116 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+/**
+ * A small io_uring ring for the input reader and the sink, set up with the raw
+ * system calls (no liburing). Reads and writes always go at the file's current
+ * position, one after another like read(2) and write(2), so pipes, terminals
+ * and files are treated alike. Buffers may be registered once, after which
+ * operations on them skip mapping the pages on every call.
+ * Callers fall back to read(2)/write(2) when uring_init fails - kernels
+ * without io_uring, or with it disabled (kernel.io_uring_disabled, seccomp).
+ */
+
+typedef struct {
+    int fd;                         // the ring, -1 when not set up
+    int fixed;                      // buffers are registered
+
+    // submission queue
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned queued;                // entries filled in since the last submit
+
+    // completion queue
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_map;
+    size_t sq_map_len;
+    void* cq_map;
+    size_t cq_map_len;
+    size_t sqes_len;
+} uring_t;
+
+/**
+ * Set up a ring
+ * @param ring Pointer to ring structure
+ * @param entries Operations in flight at most
+ * @return NULL on success, error message on failure (the ring is then unusable)
+ */
+const char* uring_init(uring_t* ring, unsigned entries);
+
+/**
+ * Register buffers, to be used by index with fixed reads and writes
+ * @param ring Pointer to ring structure
+ * @param iov The buffers
+ * @param count Entries in iov
+ * @return 0 on success, -1 if they cannot be registered (locked memory limit)
+ */
+int uring_register_buffers(uring_t* ring, const struct iovec* iov, int count);
+
+/**
+ * Queue a read into buf, or a write from it, at the current file position
+ * @param ring Pointer to ring structure
+ * @param write 1 for a write, 0 for a read
+ * @param fd File descriptor
+ * @param buf Buffer
+ * @param len Bytes
+ * @param buf_index Index of buf's registered buffer, or -1
+ * @param user_data Returned with the completion
+ * @return 0 on success, -1 if the submission queue is full
+ */
+int uring_prep_rw(uring_t* ring, int write, int fd, void* buf, unsigned len, int buf_index,
+                  unsigned long long user_data);
+
+/**
+ * Queue a wait for fd to become readable
+ * @param ring Pointer to ring structure
+ * @param fd File descriptor
+ * @param user_data Returned with the completion
+ * @return 0 on success, -1 if the submission queue is full
+ */
+int uring_prep_poll(uring_t* ring, int fd, unsigned long long user_data);
+
+/**
+ * Queue the cancellation of an operation in flight - the operation still
+ * completes (with -ECANCELED if it was cancelled), and so does this
+ * @param ring Pointer to ring structure
+ * @param target User data of the operation
+ * @param user_data Returned with the completion of the cancellation
+ * @return 0 on success, -1 if the submission queue is full
+ */
+int uring_prep_cancel(uring_t* ring, unsigned long long target, unsigned long long user_data);
+
+/**
+ * Submit what was queued
+ * @param ring Pointer to ring structure
+ * @return 0 on success, -1 with errno set on failure
+ */
+int uring_submit(uring_t* ring);
+
+/**
+ * Take a completion, waiting for one if there is none
+ * @param ring Pointer to ring structure
+ * @param user_data Receives the user data of the operation
+ * @param res Receives its result - bytes moved, or -errno
+ * @return 0 on success, -1 with errno set on failure
+ */
+int uring_wait(uring_t* ring, unsigned long long* user_data, int* res);
+
+/**
+ * Tear the ring down - operations still in flight are cancelled, but may
+ * finish after this returns: cancel and wait for the ones using memory first
+ * @param ring Pointer to ring structure
+ */
+void uring_exit(uring_t* ring);
+
+#endif
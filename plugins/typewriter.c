@@ -1,18 +1,65 @@
 #include "plugin_common.h"
-#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
-// print the input string character by character with a 100msdelay
-static const char* plugin_transform(const char* input) {
-    if (input) {
-        for (size_t i = 0; input[i] != '\0'; i++) {
-            putchar(input[i]);
-            fflush(stdout);
-            usleep(100000); // delay 100ms
+#define TYPEWRITER_TICK_MS 100     // one character per tick
+
+// text still to be typed - lines are passed on once they are typed
+typedef struct {
+    char* text;
+    size_t len;       // bytes held
+    size_t pos;       // bytes typed
+    size_t capacity;
+} typewriter_t;
+
+// queue a line for typing
+static void typewriter_add(typewriter_t* t, const char* data, size_t len) {
+    if (t->pos == t->len) t->pos = t->len = 0; // all typed, start over
+    if (t->len + len + 1 > t->capacity) {
+        size_t capacity = (t->len + len + 1) * 2;
+        char* text = (char*)realloc(t->text, capacity);
+        if (!text) return; // out of memory, the line is not typed
+        t->text = text;
+        t->capacity = capacity;
+    }
+    memcpy(t->text + t->len, data, len);
+    t->text[t->len + len] = '\n';
+    t->len += len + 1;
+}
+
+// type one character a tick, the end of a line along with its last one -
+// the consumer thread sleeps between ticks, and when it wakes late the
+// characters of every tick due are typed in one write. An abort drops
+// whatever is left
+static int typewriter_hook(void* state, int event, plugin_msg_t** msgs, int count) {
+    typewriter_t* t = (typewriter_t*)state;
+    switch (event) {
+    case PLUGIN_HOOK_BATCH:
+        for (int i = 0; i < count; i++) typewriter_add(t, msgs[i]->data, msgs[i]->len);
+        break;
+    case PLUGIN_HOOK_TICK:
+        if (t->pos < t->len) {
+            size_t end = t->pos;
+            for (int i = 0; i < count && end < t->len; i++) end += end + 1 < t->len && t->text[end + 1] == '\n' ? 2 : 1;
+            if (write(STDOUT_FILENO, t->text + t->pos, end - t->pos) < 0) end = t->len; // stdout is gone, stop typing
+            t->pos = end;
         }
-        putchar('\n');
+        break;
+    case PLUGIN_CONTROL_ABORT:
+        t->pos = t->len;
+        break;
+    case PLUGIN_HOOK_FINI:
+        free(t->text);
+        free(t);
+        return 0;
     }
-    return input; // pass unchanged
+    return t->pos < t->len; // hold the batch until it is typed
+}
+
+// the lines themselves pass unchanged
+static plugin_msg_t* plugin_transform(plugin_msg_t* msg) {
+    return msg;
 }
 
 const char* plugin_get_name(void) {
@@ -20,5 +67,10 @@ const char* plugin_get_name(void) {
 }
 
 const char* plugin_init(int queue_size) {
-    return common_plugin_init(plugin_transform, "typewriter", queue_size);
-}
\ No newline at end of file
+    typewriter_t* t = (typewriter_t*)calloc(1, sizeof(typewriter_t));
+    if (!t) return "malloc has failed";
+    const char* err = common_plugin_set_hook(typewriter_hook, t, TYPEWRITER_TICK_MS);
+    if (!err) err = common_plugin_init_msg(plugin_transform, "typewriter", queue_size, PLUGIN_READ_ONLY);
+    if (err) free(t);
+    return err;
+}
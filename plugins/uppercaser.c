@@ -1,25 +1,11 @@
 #include "plugin_common.h"
-#include <ctype.h>
-#include <stdlib.h>
-#include <string.h>
+#include "simd/text_kernels.h"
 
-// convert input string to uppercase
-static const char* plugin_transform(const char* input) {
-    // check if input is valid
-    if (input) {
-        size_t len = strlen(input); // get length of input
-        char* out = malloc(len + 1); // allocate memory for output
-
-        if (out) { 
-            // convert each character to uppercase
-            for (size_t i = 0; i < len; i++) {
-                out[i] = toupper((unsigned char)input[i]); // uppercase each char
-            }
-            out[len] = '\0'; // null terminator
-            return out;
-        }
-    }
-    return NULL;
+// convert the message to uppercase in place
+static plugin_msg_t* plugin_transform(plugin_msg_t* msg) {
+    // convert each character to uppercase, many at a time where the cpu can
+    text_kernels->upper(msg->data, msg->len);
+    return msg;
 }
 
 const char* plugin_get_name(void) {
@@ -27,5 +13,5 @@ const char* plugin_get_name(void) {
 }
 
 const char* plugin_init(int queue_size) {
-    return common_plugin_init(plugin_transform, "uppercaser", queue_size);
+    return common_plugin_init_msg(plugin_transform, "uppercaser", queue_size, PLUGIN_STATELESS);
 }
\ No newline at end of file
@@ -0,0 +1,108 @@
+#define _GNU_SOURCE // for the plugins compiled in, which may need it
+#include "static_chain.h"
+#include <string.h>
+#include "plugins/plugin_common.h"
+
+// while a compiled plugin's plugin_init runs, its calls into the common code
+// land here: the chain records what the plugin is, and initializes one stage
+// for all of them
+static int stage_index;             // the plugin being initialized
+static int stage_count;             // plugins in the chain
+static int stage_flags;             // PLUGIN_* flags every plugin so far has
+
+static const char* static_chain_add_stage(plugin_msg_t* (*process_msg)(plugin_msg_t*), const char* name, int queue_size,
+                                          int flags) {
+    (void)process_msg; // called directly, by name
+    (void)name;
+    (void)queue_size;
+    stage_flags &= flags;
+    return NULL;
+}
+
+// the hook of the last plugin is the chain's - it sees the chain's output
+static const char* static_chain_set_hook(plugin_hook_t hook, void* state, int tick_ms) {
+    if (stage_index != stage_count - 1) return "only the last plugin of a static chain may have a hook";
+    return common_plugin_set_hook(hook, state, tick_ms);
+}
+
+// one stage, inlined - a payload it replaces is freed here unless it is the
+// one the chain was given, which the stage running the chain frees
+#define STATIC_CHAIN_STAGE(transform)                                      \
+    data = msg->data;                                                      \
+    processed = transform(msg);                                            \
+    if (msg->data != data && data != first) message_free_data(msg, data);  \
+    if (!processed) return NULL;                                           \
+    msg = processed;
+
+#define common_plugin_init_msg static_chain_add_stage
+#define common_plugin_set_hook static_chain_set_hook
+#include "static_chain_stages.h"
+#undef common_plugin_init_msg
+#undef common_plugin_set_hook
+
+const char* plugin_get_name(void) {
+    return STATIC_CHAIN;
+}
+
+const char* plugin_init(int queue_size) {
+    static const char* (*const inits[])(int) = STATIC_CHAIN_INITS;
+    stage_count = (int)(sizeof(inits) / sizeof(inits[0]));
+    stage_flags = PLUGIN_STATELESS | PLUGIN_READ_ONLY;
+    for (stage_index = 0; stage_index < stage_count; stage_index++) {
+        const char* err = inits[stage_index](queue_size);
+        if (err) return err;
+    }
+    // a plugin that changes messages makes the stage take a copy of a shared
+    // one first, once for the whole chain
+    return common_plugin_init_msg(static_chain_transform, STATIC_CHAIN, queue_size, stage_flags);
+}
+
+// the functions pipeline.c resolves with dlsym for a plugin
+#define STATIC_CHAIN_SYMBOL(fn) { #fn, (void*)fn }
+static const struct {
+    const char* name;
+    void* fn;
+} symbols[] = {
+    STATIC_CHAIN_SYMBOL(plugin_init),
+    STATIC_CHAIN_SYMBOL(plugin_fini),
+    STATIC_CHAIN_SYMBOL(plugin_place_work),
+    STATIC_CHAIN_SYMBOL(plugin_attach),
+    STATIC_CHAIN_SYMBOL(plugin_wait_finished),
+    STATIC_CHAIN_SYMBOL(plugin_get_name),
+    STATIC_CHAIN_SYMBOL(plugin_get_stats),
+    STATIC_CHAIN_SYMBOL(plugin_place_work_owned),
+    STATIC_CHAIN_SYMBOL(plugin_attach_owned),
+    STATIC_CHAIN_SYMBOL(plugin_place_work_batch),
+    STATIC_CHAIN_SYMBOL(plugin_attach_batch),
+    STATIC_CHAIN_SYMBOL(plugin_set_batch_size),
+    STATIC_CHAIN_SYMBOL(plugin_instance_init),
+    STATIC_CHAIN_SYMBOL(plugin_instance_fini),
+    STATIC_CHAIN_SYMBOL(plugin_instance_place_work),
+    STATIC_CHAIN_SYMBOL(plugin_instance_place_work_owned),
+    STATIC_CHAIN_SYMBOL(plugin_instance_place_work_batch),
+    STATIC_CHAIN_SYMBOL(plugin_instance_set_batch_size),
+    STATIC_CHAIN_SYMBOL(plugin_instance_set_queue_capacity),
+    STATIC_CHAIN_SYMBOL(plugin_instance_set_cpus),
+    STATIC_CHAIN_SYMBOL(plugin_instance_set_wait),
+    STATIC_CHAIN_SYMBOL(plugin_instance_attach),
+    STATIC_CHAIN_SYMBOL(plugin_instance_wait_finished),
+    STATIC_CHAIN_SYMBOL(plugin_instance_get_stats),
+    STATIC_CHAIN_SYMBOL(plugin_instance_process),
+    STATIC_CHAIN_SYMBOL(plugin_instance_fuse),
+    STATIC_CHAIN_SYMBOL(plugin_instance_get_flags),
+    STATIC_CHAIN_SYMBOL(plugin_instance_place_msgs),
+    STATIC_CHAIN_SYMBOL(plugin_instance_attach_msgs),
+    STATIC_CHAIN_SYMBOL(plugin_instance_process_msg),
+    STATIC_CHAIN_SYMBOL(plugin_instance_fuse_msg),
+    STATIC_CHAIN_SYMBOL(plugin_instance_control),
+    STATIC_CHAIN_SYMBOL(plugin_instance_attach_control),
+};
+
+static void* static_chain_lookup(const char* symbol) {
+    for (size_t i = 0; i < sizeof(symbols) / sizeof(symbols[0]); i++) {
+        if (strcmp(symbols[i].name, symbol) == 0) return symbols[i].fn;
+    }
+    return NULL;
+}
+
+const pipeline_builtin_t static_chain = { STATIC_CHAIN, static_chain_lookup };
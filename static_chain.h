@@ -0,0 +1,20 @@
+#ifndef STATIC_CHAIN_H
+#define STATIC_CHAIN_H
+
+#include "pipeline.h"
+
+/**
+ * A chain of plugins linked into the analyzer instead of opened at run time.
+ * ./build.sh --static-chain "uppercaser|flipper|logger" generates the list of
+ * stages (output/static_chain_stages.h) and builds output/analyzer_static,
+ * where the plugins' transforms are compiled into static_chain.c and called
+ * one after another in a single function - no function pointer, queue or
+ * thread between them, so the compiler inlines them into the stage's loop.
+ * Only the last plugin may have a hook (logger, sink, typewriter); a chain
+ * given differently on the command line is loaded from the plugins as usual.
+ */
+
+// The compiled chain, for pipeline_set_builtin
+extern const pipeline_builtin_t static_chain;
+
+#endif
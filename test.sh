@@ -29,6 +29,27 @@ run_test() {
     fi
 }
 
+ # unit tests - build.sh builds them into output/tests, and one that fails
+ # prints what it printed and stops the run
+echo " running unit tests..."
+run_unit_test() {
+    local name="$1"
+    local log=$(mktemp)
+    if ./output/tests/$name > $log 2>&1; then
+        rm -f $log
+        print_status "unit tests: $name"
+    else
+        cat $log
+        rm -f $log
+        print_error "unit tests: $name failed"
+    fi
+}
+run_unit_test test_consumer_producer
+run_unit_test monitor_test
+run_unit_test test_text_kernels
+run_unit_test test_buffer_pool
+run_unit_test test_message
+
  # positive tests
 echo " running positive tests..."
 
@@ -203,11 +224,495 @@ else
 fi
 COMMENT_BLOCK
 
-# test 19: trailing blank lines
-EXPECTED="[logger] HELLO"
+# test 19: trailing blank lines - every line is data, so each blank one
+# reaches the logger as an empty line (as in test 3)
+EXPECTED=$'[logger] HELLO\n[logger] \n[logger] '
 ACTUAL=$(echo -e "hello\n\n\n<END>" | ./output/analyzer 5 uppercaser logger | grep "\[logger\]")
 if [ "$ACTUAL" == "$EXPECTED" ]; then
-    print_status "trailing blank lines handled"
+    print_status "trailing blank lines passed on as empty lines"
 else
     print_error "trailing blank lines test failed (expected '$EXPECTED', got '$ACTUAL')"
-fi
\ No newline at end of file
+fi
+
+# test 20: batching does not change the output
+EXPECTED=$(printf 'one\ntwo\nthree\n<END>\n' | ./output/analyzer --batch 1 4 uppercaser flipper logger | grep "\[logger\]")
+ACTUAL=$(printf 'one\ntwo\nthree\n<END>\n' | ./output/analyzer --batch 64 4 uppercaser flipper logger | grep "\[logger\]")
+if [ "$ACTUAL" == "$EXPECTED" ] && [ "$(wc -l <<<"$ACTUAL")" -eq 3 ]; then
+    print_status "batch size 1 and 64 give the same output"
+else
+    print_error "batch sizes disagree (expected '$EXPECTED', got '$ACTUAL')"
+fi
+
+# test 21: invalid batch size
+if ./output/analyzer --batch 0 10 logger 2>&1 | grep -q "error- not a valid batch size"; then
+    print_status "invalid batch size handled"
+else
+    print_error "invalid batch size not handled"
+fi
+
+# test 22: the same plugin twice in one chain gets two independent instances
+EXPECTED=$'[logger] HELLO\n[logger] OLLEH'
+ACTUAL=$(printf 'hello\n<END>\n' | ./output/analyzer 4 uppercaser logger flipper logger | grep "\[logger\]")
+if [ "$ACTUAL" == "$EXPECTED" ]; then
+    print_status "same plugin loaded twice in one chain"
+else
+    print_error "same plugin loaded twice (expected '$EXPECTED', got '$ACTUAL')"
+fi
+
+# test 23: several workers on a stateless stage keep the line order
+INPUT=$(for i in $(seq 1 2000); do echo "line $i"; done; echo '<END>')
+EXPECTED=$(./output/analyzer 8 uppercaser expander logger <<<"$INPUT" | grep "\[logger\]")
+ACTUAL=$(./output/analyzer --batch 4 8 uppercaser:3 expander:4 logger <<<"$INPUT" | grep "\[logger\]")
+if [ "$ACTUAL" == "$EXPECTED" ] && [ "$(wc -l <<<"$ACTUAL")" -eq 2000 ]; then
+    print_status "replicated stages keep line order"
+else
+    print_error "replicated stages changed the output"
+fi
+
+# test 24: stateful plugins refuse several workers
+if printf '<END>\n' | ./output/analyzer 4 logger:2 2>&1 | grep -q "not stateless"; then
+    print_status "several workers on a stateful plugin rejected"
+else
+    print_error "several workers on a stateful plugin not rejected"
+fi
+
+# test 25: fusing stateless stages does not change the output
+INPUT=$(for i in $(seq 1 500); do echo "line $i"; done; echo '<END>')
+EXPECTED=$(./output/analyzer 8 uppercaser flipper rotator expander logger <<<"$INPUT" | grep "\[logger\]")
+ACTUAL=$(./output/analyzer --fuse 8 uppercaser flipper rotator expander logger <<<"$INPUT" | grep "\[logger\]")
+if [ "$ACTUAL" == "$EXPECTED" ] && [ "$(wc -l <<<"$ACTUAL")" -eq 500 ]; then
+    print_status "fused stages give the same output"
+else
+    print_error "fused stages changed the output"
+fi
+
+# test 26: lines of any length are passed on whole
+LONG=$(head -c 200000 < /dev/zero | tr '\0' a)
+ACTUAL=$(printf '%s\n<END>\n' "$LONG" | ./output/analyzer 4 uppercaser logger | grep "\[logger\]")
+if [ "$ACTUAL" == "[logger] ${LONG^^}" ]; then
+    print_status "200000 character line kept whole"
+else
+    print_error "200000 character line was split or truncated"
+fi
+
+# test 27: --input reads a file, which may end without <END> or a final newline
+tmp=$(mktemp)
+printf 'one\n%s\nlast' "$LONG" > "$tmp"
+ACTUAL=$(./output/analyzer --input "$tmp" 4 flipper logger | grep "\[logger\]")
+rm -f "$tmp"
+EXPECTED=$(printf '[logger] eno\n[logger] %s\n[logger] tsal' "$LONG")
+if [ "$ACTUAL" == "$EXPECTED" ]; then
+    print_status "input file read to its end"
+else
+    print_error "input file test failed"
+fi
+
+# test 28: the benchmark harness emits one csv record per run
+OUT=$(./bench.sh --lines 2000 --rounds 200 --queues "8 64" --chain "uppercaser flipper" 2>/dev/null)
+if [ "$(wc -l <<<"$OUT")" -eq 3 ] && head -n 1 <<<"$OUT" | grep -q "^chain,.*p999_us,cpu_ms" && grep -q "uppercaser=" <<<"$OUT"; then
+    print_status "benchmark harness csv output"
+else
+    print_error "benchmark harness output wrong: $OUT"
+fi
+
+# test 29: per-stage counters at shutdown (stderr) and on SIGUSR1
+ERR=$(printf 'ab\ncd\nef\n<END>\n' | ./output/analyzer 4 uppercaser logger 2>&1 >/dev/null)
+if grep -Eq "^uppercaser +3 +3 +6 " <<<"$ERR" && grep -Eq "^logger +3 +3 +6 " <<<"$ERR"; then
+    print_status "per-stage counters printed at shutdown"
+else
+    print_error "per-stage counters wrong: $ERR"
+fi
+tmp=$(mktemp)
+{ echo one; sleep 0.5; echo two; sleep 0.5; echo '<END>'; } | ./output/analyzer 4 uppercaser logger 2>"$tmp" >/dev/null &
+sleep 0.3
+kill -USR1 $!
+wait $!
+if [ "$(grep -c "^stage " "$tmp")" -eq 2 ] && grep -Eq "^uppercaser +1 +1 +3 " "$tmp"; then
+    print_status "SIGUSR1 prints the counters while running"
+else
+    print_error "SIGUSR1 stats dump failed: $(cat "$tmp")"
+fi
+rm -f "$tmp"
+
+# test 30: payloads are length-prefixed messages, so bytes after a NUL survive
+ACTUAL=$(printf 'ab\0cd\n<END>\n' | ./output/analyzer 4 uppercaser flipper logger | grep -a "\[logger\]" | od -An -c | tr -s ' ')
+EXPECTED=$(printf '[logger] DC\0BA\n' | od -An -c | tr -s ' ')
+if [ "$ACTUAL" == "$EXPECTED" ]; then
+    print_status "binary payloads pass through whole"
+else
+    print_error "binary payload test failed: $ACTUAL"
+fi
+
+# test 31: SIGTERM aborts at once - queued lines are dropped, even behind a slow typewriter
+tmp=$(mktemp)
+{ for i in $(seq 1 50); do echo "line $i for the typewriter"; done; } | ./output/analyzer 20 uppercaser typewriter logger >"$tmp" 2>/dev/null &
+pid=$!
+sleep 0.5
+start=$(date +%s%N)
+kill -TERM $pid
+rc=0
+wait $pid || rc=$?
+elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+if [ $rc -eq 143 ] && [ $elapsed -lt 1000 ] && grep -q "Pipeline aborted" "$tmp" && ! grep -q "\[logger\]" "$tmp"; then
+    print_status "SIGTERM aborts a slow pipeline in ${elapsed} ms"
+else
+    print_error "abort test failed (exit $rc after ${elapsed} ms): $(cat "$tmp")"
+fi
+rm -f "$tmp"
+
+# test 32: the end of the input is a token, so <END> can also be a line of data
+ACTUAL=$(printf 'a\n<END>\nb\n' | ./output/analyzer --no-end-marker 4 uppercaser logger | grep "\[logger\]")
+EXPECTED=$(printf '[logger] A\n[logger] <END>\n[logger] B')
+if [ "$ACTUAL" == "$EXPECTED" ]; then
+    print_status "--no-end-marker passes <END> lines on"
+else
+    print_error "--no-end-marker test failed: $ACTUAL"
+fi
+
+# test 33: the sink writes every line to SINK_OUTPUT, in order, under each flush policy
+tmp=$(mktemp)
+for policy in size size:100 line time:20; do
+    ACTUAL=$({ seq 1 5000; echo "<END>"; } | SINK_OUTPUT="$tmp" SINK_FLUSH=$policy ./output/analyzer 16 uppercaser sink logger | grep -c "\[logger\]")
+    if [ "$ACTUAL" == "5000" ] && seq 1 5000 | cmp -s - "$tmp"; then
+        print_status "sink with SINK_FLUSH=$policy wrote all lines"
+    else
+        print_error "sink test failed for SINK_FLUSH=$policy ($ACTUAL lines passed on)"
+    fi
+done
+rm -f "$tmp"
+
+# test 34: per-line flushing shows lines while the stream is open, the size policy holds them
+tmp=$(mktemp)
+for policy in line size; do
+    { printf 'a\nb\n'; sleep 1; echo "<END>"; } | SINK_OUTPUT="$tmp" SINK_FLUSH=$policy ./output/analyzer 4 sink >/dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+    seen=$(cat "$tmp")
+    wait $pid
+    expected=$([ $policy == line ] && printf 'a\nb' || true)
+    if [ "$seen" == "$expected" ] && [ "$(cat "$tmp")" == "$(printf 'a\nb')" ]; then
+        print_status "SINK_FLUSH=$policy writes when it should"
+    else
+        print_error "sink flush policy test failed for $policy: saw '$seen'"
+    fi
+done
+rm -f "$tmp"
+
+# test 35: the typewriter still types a character a tick, and passes a line on once it is typed
+start=$(date +%s%N)
+ACTUAL=$(printf 'abc\n<END>\n' | ./output/analyzer 4 typewriter logger | head -2)
+elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+if [ "$ACTUAL" == "$(printf 'abc\n[logger] abc')" ] && [ $elapsed -ge 300 ]; then
+    print_status "typewriter paces its output (${elapsed} ms)"
+else
+    print_error "typewriter test failed after ${elapsed} ms: $ACTUAL"
+fi
+# stopped for a second while typing 20 characters, it types the ones that fell due at once
+tmp=$(mktemp)
+start=$(date +%s%N)
+{ printf 'abcdefghijklmnopqrst\n'; sleep 3; echo "<END>"; } | ./output/analyzer 4 typewriter logger > $tmp 2>/dev/null &
+sleep 0.5
+kill -STOP $(pgrep -n -f "analyzer 4 typewriter logger")
+sleep 1
+kill -CONT $(pgrep -n -f "analyzer 4 typewriter logger")
+for i in $(seq 1 200); do grep -q "^\[logger\]" $tmp && break; sleep 0.02; done
+elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+wait
+if [ $elapsed -lt 2600 ] && grep -q "^abcdefghijklmnopqrst$" $tmp; then
+    print_status "a late typewriter catches up on the ticks it missed (${elapsed} ms)"
+else
+    print_error "the typewriter did not catch up after a stop (${elapsed} ms)"
+fi
+rm -f $tmp
+
+# test 36: name@C gives a stage its own queue size, alone or with a worker count
+STATS=$(printf 'a\nb\n<END>\n' | ./output/analyzer 10 uppercaser@3 expander:2@7 logger 2>&1 >/dev/null)
+if echo "$STATS" | grep -q "^uppercaser@3 .* [0-9]*/3$" && echo "$STATS" | grep -q "^expander:2@7 .* [0-9]*/7$" &&
+   echo "$STATS" | grep -q "^logger .* [0-9]*/10$"; then
+    print_status "per-stage queue sizes are applied"
+else
+    print_error "per-stage queue size test failed: $STATS"
+fi
+if ! ./output/analyzer 10 logger@0 </dev/null >/dev/null 2>&1; then
+    print_status "invalid per-stage queue size is rejected"
+else
+    print_error "logger@0 was accepted"
+fi
+
+# test 37: adaptive queues keep every line in order while they are resized, within the budget
+tmp=$(mktemp)
+{ for i in $(seq 1 5); do seq 1 20000; sleep 0.2; done; echo "<END>"; } |
+    SINK_OUTPUT="$tmp" ./output/analyzer --adaptive 100000 16 uppercaser flipper sink >/dev/null 2>&1
+if for i in $(seq 1 5); do seq 1 20000 | rev; done | cmp -s - "$tmp"; then
+    print_status "adaptive queues pass every line on in order"
+else
+    print_error "adaptive queue test lost or reordered lines"
+fi
+rm -f "$tmp"
+if ! ./output/analyzer --adaptive 15 10 uppercaser logger </dev/null >/dev/null 2>&1; then
+    print_status "a queue budget below the queue sizes is rejected"
+else
+    print_error "queue budget below the queue sizes was accepted"
+fi
+
+# test 38: --cpus pins the stages' threads, and bad lists are rejected
+output=$(printf "hello\n<END>\n" | ./output/analyzer --cpus auto 10 uppercaser:2 logger 2>/dev/null | grep "^\[logger\]")
+if [ "$output" == "[logger] HELLO" ]; then
+    print_status "--cpus auto runs the pipeline"
+else
+    print_error "--cpus auto failed (got '$output')"
+fi
+fifo=$(mktemp -u)
+mkfifo "$fifo"
+./output/analyzer --cpus 0 10 uppercaser logger <"$fifo" >/dev/null 2>&1 &
+pid=$!
+exec 3>"$fifo"
+echo hello >&3
+sleep 0.2
+pinned=""
+for task in /proc/$pid/task/*; do
+    if [ "$(cat "$task/comm" 2>/dev/null)" == "uppercaser" ]; then
+        pinned=$(grep "^Cpus_allowed_list" "$task/status" | awk '{print $2}')
+    fi
+done
+echo "<END>" >&3
+exec 3>&-
+wait $pid || true
+rm -f "$fifo"
+if [ "$pinned" == "0" ]; then
+    print_status "--cpus pins the stage thread"
+else
+    print_error "stage thread was not pinned (allowed '$pinned')"
+fi
+if ! ./output/analyzer --cpus 99999 10 logger </dev/null >/dev/null 2>&1 &&
+   ! ./output/analyzer --cpus x 10 logger </dev/null >/dev/null 2>&1; then
+    print_status "invalid cpu lists are rejected"
+else
+    print_error "invalid cpu list was accepted"
+fi
+
+# test 39: every wait strategy keeps the output, and bad strategy lists are rejected
+for wait in park yield spin park,spin,yield; do
+    output=$(seq 1 2000 | ./output/analyzer --wait $wait 4 uppercaser flipper sink 2>/dev/null | grep -v "^Pipeline" | tail -n 1)
+    if [ "$output" == "0002" ]; then
+        print_status "--wait $wait passes every line on"
+    else
+        print_error "--wait $wait lost lines (got '$output')"
+    fi
+done
+if ! ./output/analyzer --wait sleep 10 logger </dev/null >/dev/null 2>&1 &&
+   ! ./output/analyzer --wait park,spin 10 uppercaser flipper logger </dev/null >/dev/null 2>&1; then
+    print_status "invalid wait strategy lists are rejected"
+else
+    print_error "invalid wait strategy list was accepted"
+fi
+
+# test 40: branches get every line, a merge gets the lines of all its branches, and bad chains are rejected
+out_file=$(mktemp)
+output=$(seq 1 500 | SINK_OUTPUT=$out_file ./output/analyzer 10 uppercaser [ logger , flipper sink ] 2>/dev/null | grep -c "^\[logger\]")
+if [ "$output" == "500" ] && [ "$(wc -l < $out_file)" == "500" ] && [ "$(tail -n 1 $out_file)" == "005" ]; then
+    print_status "fan-out sends every line down both branches"
+else
+    print_error "fan-out lost lines (logger got '$output', sink wrote $(wc -l < $out_file))"
+fi
+rm -f $out_file
+for fuse in "" --fuse; do
+    output=$(seq 1 500 | ./output/analyzer $fuse 10 uppercaser [ flipper , rotator:2 ] logger 2>/dev/null | grep -c "^\[logger\]")
+    if [ "$output" == "1000" ]; then
+        print_status "merge ${fuse:-without fusion} takes the lines of both branches"
+    else
+        print_error "merge ${fuse:-without fusion} lost lines (got '$output')"
+    fi
+done
+if ! ./output/analyzer 10 [ logger , flipper ] </dev/null >/dev/null 2>&1 &&
+   ! ./output/analyzer 10 uppercaser [ logger , ] </dev/null >/dev/null 2>&1 &&
+   ! ./output/analyzer 10 uppercaser [ logger flipper </dev/null >/dev/null 2>&1; then
+    print_status "malformed branches are rejected"
+else
+    print_error "malformed branches were accepted"
+fi
+
+# test 41: a config file gives a long chain, its plugin path and per-stage options, with no stage limit
+conf_file=$(mktemp)
+{
+    echo "# 30 stages"
+    echo "queue_size 8"
+    echo "path /nonexistent/plugins"
+    echo "path output/plugins"
+    echo "wait yield"
+    for i in $(seq 1 14); do echo "stage flipper"; echo "stage rotator queue=4"; done
+    echo "stage uppercaser workers=2"
+    echo "stage logger"
+} > $conf_file
+output=$(echo "abcdef" | ./output/analyzer --config $conf_file 2>/dev/null | grep "^\[logger\]")
+if [ "$output" == "[logger] ABCDEF" ]; then
+    print_status "config file runs a 30 stage chain"
+else
+    print_error "config file chain gave '$output'"
+fi
+output=$(echo "abc" | ./output/analyzer --config $conf_file 4 flipper logger 2>/dev/null | grep "^\[logger\]")
+if [ "$output" == "[logger] cba" ]; then
+    print_status "the command line chain replaces the config file's"
+else
+    print_error "command line chain with a config file gave '$output'"
+fi
+printf "queue_size 4\nstage flipper wait=spin\nstage logger\n" > $conf_file
+output=$(echo "abc" | ./output/analyzer --config $conf_file 2>/dev/null | grep "^\[logger\]")
+if [ "$output" == "[logger] cba" ]; then
+    print_status "config file stages take their own wait strategy"
+else
+    print_error "config file with a stage wait strategy gave '$output'"
+fi
+echo "stage logger workers=2 colour=red" > $conf_file
+if ! ./output/analyzer --config $conf_file </dev/null >/dev/null 2>&1 &&
+   ! ./output/analyzer --plugin-path /nonexistent 4 logger </dev/null >/dev/null 2>&1; then
+    print_status "bad config files and missing plugins are rejected"
+else
+    print_error "bad config file or missing plugin was accepted"
+fi
+rm -f $conf_file
+
+# test 42: a pool of threads runs the stages as tasks, keeping every line and its order
+lines_file=$(mktemp)
+seq 1 3000 > $lines_file
+expected=$(./output/analyzer 4 uppercaser flipper rotator flipper rotator logger <$lines_file 2>/dev/null | md5sum)
+output_1=$(./output/analyzer --pool 1 4 uppercaser flipper rotator flipper rotator logger <$lines_file 2>/dev/null | md5sum)
+output_auto=$(./output/analyzer --pool auto --fuse 2 uppercaser flipper:2 rotator flipper rotator logger <$lines_file 2>/dev/null | md5sum)
+if [ "$output_1" == "$expected" ] && [ "$output_auto" == "$expected" ]; then
+    print_status "pooled stages keep every line in order"
+else
+    print_error "pooled stages lost or reordered lines"
+fi
+output=$(./output/analyzer --pool 2 4 uppercaser [ flipper , rotator ] logger <$lines_file 2>/dev/null | grep -c "^\[logger\]")
+if [ "$output" == "6000" ]; then
+    print_status "pooled branches and merges pass every line"
+else
+    print_error "pooled branches passed $output lines"
+fi
+if ! ./output/analyzer --pool 0 4 logger </dev/null >/dev/null 2>&1 &&
+   ! ./output/analyzer --pool many 4 logger </dev/null >/dev/null 2>&1; then
+    print_status "bad pool sizes are rejected"
+else
+    print_error "bad pool size was accepted"
+fi
+rm -f $lines_file
+
+# test 43: io_uring input and sink output give what read(2) and write(2) give, lines across chunks included
+in_file=$(mktemp)
+out_file=$(mktemp)
+ref_file=$(mktemp)
+{ seq 1 20000; head -c 3000000 /dev/zero | tr '\0' 'x'; echo; seq 1 100; } > $in_file
+cat $in_file | SINK_OUTPUT=$ref_file SINK_FLUSH=size:4096 ./output/analyzer --no-end-marker 16 uppercaser sink >/dev/null 2>&1
+sink_log=$(cat $in_file | SINK_OUTPUT=$out_file SINK_FLUSH=size:4096 SINK_URING=1 ./output/analyzer --io-uring --no-end-marker 16 uppercaser sink 2>&1 >/dev/null | grep "^\[INFO\]\[sink\]")
+if [ -s $ref_file ] && cmp -s $out_file $ref_file; then
+    print_status "io_uring reads and writes every line in order"
+else
+    print_error "io_uring output differs from read(2) and write(2)"
+fi
+ring_writes=$(echo "$sink_log" | sed -n 's/.* - \([0-9]*\) writes through io_uring/\1/p')
+if [[ "$sink_log" == *"not available"* ]]; then
+    print_status "io_uring is not available here, the sink wrote with write(2)"
+elif [ -n "$ring_writes" ] && [ "$ring_writes" -gt 0 ]; then
+    print_status "the sink wrote through io_uring ($ring_writes writes)"
+else
+    print_error "the sink did not write through io_uring ($sink_log)"
+fi
+elapsed=$({ echo "one"; echo "<END>"; sleep 2; } | {
+    start=$(date +%s%N)
+    ./output/analyzer --io-uring 4 logger >/dev/null 2>&1
+    echo $(( ($(date +%s%N) - start) / 1000000 ))
+})
+if [ "$elapsed" -lt 1500 ]; then
+    print_status "io_uring reader stops at <END> with the pipe still open"
+else
+    print_error "io_uring reader waited for the pipe to close"
+fi
+rm -f $in_file $out_file $ref_file
+
+# test 44: --mmap-input hands out the mapped lines, and stages that change them get copies
+in_file=$(mktemp)
+{ seq 1 5000; printf 'last line without newline'; } > $in_file
+expected=$(./output/analyzer --input $in_file 8 uppercaser [ logger , flipper logger ] 2>/dev/null | sort | md5sum)
+output=$(./output/analyzer --mmap-input $in_file 8 uppercaser [ logger , flipper logger ] 2>/dev/null | sort | md5sum)
+read_only=$(./output/analyzer --mmap-input $in_file 8 logger 2>/dev/null | grep -c "^\[logger\]")
+if [ "$output" == "$expected" ] && [ "$read_only" == "5001" ] && [ "$(tail -c 25 $in_file)" == "last line without newline" ]; then
+    print_status "mapped input lines pass unchanged, and are copied only to be changed"
+else
+    print_error "mapped input gave different lines ($read_only lines)"
+fi
+if ./output/analyzer --mmap-input /dev/null 4 logger 2>&1 | grep -q "cannot map"; then
+    print_status "--mmap-input rejects what cannot be mapped"
+else
+    print_error "--mmap-input took an input it cannot map"
+fi
+rm -f $in_file
+
+# test 45: a chain compiled in with --static-chain runs as one stage and gives what the plugins give
+./build.sh --static-chain "uppercaser|rotator|flipper|logger" > /dev/null
+in_file=$(mktemp)
+{ seq 1 3000 | sed 's/$/ static chain/'; echo ""; echo "<END>"; } > $in_file
+expected=$(./output/analyzer 8 uppercaser rotator flipper logger < $in_file 2>/dev/null | md5sum)
+output=$(./output/analyzer_static 8 uppercaser rotator flipper logger < $in_file 2>/dev/null | md5sum)
+stages=$(./output/analyzer_static 8 uppercaser rotator flipper logger < $in_file 2>&1 >/dev/null | grep -c "^uppercaser|rotator|flipper|logger ")
+if [ "$output" == "$expected" ] && [ "$stages" == "1" ]; then
+    print_status "the static chain runs as one stage with the same output"
+else
+    print_error "the static chain gave different lines, or ran as $stages stages"
+fi
+expected=$(./output/analyzer 8 uppercaser flipper logger < $in_file 2>/dev/null | md5sum)
+output=$(./output/analyzer_static 8 uppercaser flipper logger < $in_file 2>/dev/null | md5sum)
+if [ "$output" == "$expected" ]; then
+    print_status "other chains still load the plugins"
+else
+    print_error "the static analyzer ran another chain differently"
+fi
+if ! ./build.sh --static-chain "logger|flipper" > /dev/null 2>&1; then
+    print_status "a hook only ends a static chain"
+else
+    print_error "a static chain took a hook before its end"
+fi
+rm -f $in_file
+
+# test 46: a release build gives the same lines, and its plugins export only the plugin api
+in_file=$(mktemp)
+{ seq 1 3000 | sed 's/$/ release build/'; echo "<END>"; } > $in_file
+expected=$(./output/analyzer 8 uppercaser rotator [ flipper , expander ] logger < $in_file 2>/dev/null | sort | md5sum)
+./build.sh --profile release > /dev/null
+output=$(./output/analyzer 8 uppercaser rotator [ flipper , expander ] logger < $in_file 2>/dev/null | sort | md5sum)
+exported=$(nm -D --defined-only output/plugins/uppercaser.so | grep -c " T consumer_producer_" || true)
+./build.sh > /dev/null
+if [ "$output" == "$expected" ] && [ "$exported" == "0" ]; then
+    print_status "the release build gives the same lines and hides the sync code"
+else
+    print_error "the release build differs ($exported sync functions exported)"
+fi
+rm -f $in_file
+
+# test 47: each sink takes its output and flush policy from its own stage settings, the environment fills in the rest
+conf_file=$(mktemp)
+out_a=$(mktemp)
+out_b=$(mktemp)
+out_env=$(mktemp)
+{
+    echo "queue_size 8"
+    echo "stage uppercaser"
+    echo "[ "
+    echo "stage sink output=$out_a flush=line"
+    echo ","
+    echo "stage flipper"
+    echo "stage sink output=$out_b"
+    echo "]"
+} > $conf_file
+seq 1 2000 | sed 's/$/ ab/' | SINK_OUTPUT=$out_env SINK_FLUSH=size:4096 ./output/analyzer --config $conf_file >/dev/null 2>&1
+if seq 1 2000 | sed 's/$/ AB/' | cmp -s - $out_a && seq 1 2000 | sed 's/$/ AB/' | rev | cmp -s - $out_b &&
+   [ ! -s $out_env ]; then
+    print_status "sinks of one chain write where their stage settings say"
+else
+    print_error "sink stage settings were not applied to each sink"
+fi
+if ! ./output/analyzer 4 sink ouptut=$out_a </dev/null >/dev/null 2>&1 && ! ./output/analyzer 4 flush=line sink </dev/null >/dev/null 2>&1; then
+    print_status "misspelt and misplaced stage settings are rejected"
+else
+    print_error "a misspelt or misplaced stage setting was accepted"
+fi
+rm -f $conf_file $out_a $out_b $out_env